@@ -0,0 +1,302 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "amdgpu.h"
+#include "clock.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace cpu_utils {
+
+namespace {
+
+// the driver takes any of these, it doesn't list them
+static const char * const PERFORMANCE_LEVELS[] = {
+  "auto", "low", "high", "manual", "profile_standard", "profile_min_sclk", "profile_min_mclk", "profile_peak",
+};
+
+static std::string read_line(const std::filesystem::path & path)
+{
+  std::ifstream input (path);
+  std::string line;
+  std::getline(input, line);
+  return line;
+}
+
+static uint64_t read_uint(const std::filesystem::path & path)
+{
+  return strtoull(read_line(path).c_str(), nullptr, 10);
+}
+
+static int open_file(const std::filesystem::path & path)
+{
+  return open(path.c_str(), O_RDONLY | O_CLOEXEC);
+}
+
+// whole file, false on a closed fd or a failed read
+static bool pread_text(int fd, char * buf, size_t size, size_t & len)
+{
+  if (fd < 0) return false;
+  ssize_t n = pread(fd, buf, size - 1, 0);
+  if (n <= 0) return false;
+  buf[n] = 0;
+  len = n;
+  return true;
+}
+
+static uint64_t pread_uint(int fd)
+{
+  char buf[32];
+  size_t len;
+  return pread_text(fd, buf, sizeof(buf), len) ? strtoull(buf, nullptr, 10) : 0;
+}
+
+// the line of a pp_dpm_* table marked with '*', e.g. "1: 1600Mhz *"
+static float current_level_mhz(int fd)
+{
+  char buf[512];
+  size_t len;
+  if (!pread_text(fd, buf, sizeof(buf), len)) return 0;
+  const char * star = strchr(buf, '*');
+  if (!star) return 0;
+  const char * line = star;
+  while (line > buf && line[-1] != '\n') --line;
+  const char * colon = strchr(line, ':');
+  return colon && colon < star ? strtof(colon + 1, nullptr) : 0;
+}
+
+// "0:        200Mhz" or "SCLK:     200Mhz       1600Mhz"
+static bool parse_mhz(const std::string & text, int & first, int & second)
+{
+  const char * p = strchr(text.c_str(), ':');
+  if (!p) return false;
+  char * end;
+  first = strtol(p + 1, &end, 10);
+  if (end == p + 1) return false;
+  while (*end && (*end < '0' || *end > '9')) ++end;
+  second = *end ? strtol(end, nullptr, 10) : -1;
+  return true;
+}
+
+}
+
+bool GpuState::init() {
+  TRACE_SPAN("gpu_init");
+  device.clear();
+  hwmon.clear();
+  // an APU's carve-out is smaller than any discrete card's VRAM
+  uint64_t smallest = UINT64_MAX;
+  std::error_code ec;
+  for (const auto & entry : std::filesystem::directory_iterator(sysfs_root / "class" / "drm", ec)) {
+    const std::string name = entry.path().filename().string();
+    // connectors are card0-eDP-1 and so on
+    if (name.rfind("card", 0) != 0 || name.find('-') != std::string::npos) continue;
+    const auto dev = entry.path() / "device";
+    if (std::filesystem::read_symlink(dev / "driver", ec).filename() != "amdgpu") continue;
+    const uint64_t vram = read_uint(dev / "mem_info_vram_total");
+    if (vram < smallest) {
+      smallest = vram;
+      device = dev;
+    }
+  }
+  if (device.empty()) return false;
+  for (const auto & entry : std::filesystem::directory_iterator(device / "hwmon", ec)) {
+    hwmon = entry.path();
+    break;
+  }
+  performance_levels.assign(std::begin(PERFORMANCE_LEVELS), std::end(PERFORMANCE_LEVELS));
+  refresh();
+  return true;
+}
+
+void GpuState::refresh() {
+  if (device.empty()) return;
+  performance_level = read_line(device / "power_dpm_force_performance_level");
+  readOverdrive();
+  readPowerProfiles();
+}
+
+void GpuState::readOverdrive() {
+  sclk_min = sclk_max = sclk_lo = sclk_hi = -1;
+  std::ifstream input (device / "pp_od_clk_voltage");
+  std::string line;
+  enum { NONE, SCLK, RANGE } section = NONE;
+  while (std::getline(input, line)) {
+    if (line.rfind("OD_", 0) == 0) {
+      section = line.rfind("OD_SCLK", 0) == 0 ? SCLK : line.rfind("OD_RANGE", 0) == 0 ? RANGE : NONE;
+      continue;
+    }
+    int first, second;
+    if (!parse_mhz(line, first, second)) continue;
+    if (section == SCLK) {
+      // "0:" is the minimum, "1:" the maximum
+      (atoi(line.c_str()) == 0 ? sclk_min : sclk_max) = first;
+    } else if (section == RANGE && line.find("SCLK") != std::string::npos) {
+      sclk_lo = first;
+      sclk_hi = second;
+    }
+  }
+  if (sclk_lo < 0 || sclk_min < 0 || sclk_max < 0) {
+    sclk_min = sclk_max = sclk_lo = sclk_hi = -1;
+  }
+}
+
+void GpuState::readPowerProfiles() {
+  power_profiles.clear();
+  power_profile = -1;
+  std::ifstream input (device / "pp_power_profile_mode");
+  std::string line;
+  while (std::getline(input, line)) {
+    // " 1 3D_FULL_SCREEN*:", discrete cards follow each with a table
+    std::istringstream words (line);
+    std::string number, name;
+    if (!(words >> number >> name) || number.find_first_not_of("0123456789") != std::string::npos) continue;
+    const size_t index = atoi(number.c_str());
+    const size_t colon = line.find(':');
+    const bool current = line.substr(0, colon).find('*') != std::string::npos;
+    name = name.substr(0, name.find_first_of("*:"));
+    if (name.empty()) continue;
+    if (power_profiles.size() <= index) power_profiles.resize(index + 1, "-");
+    power_profiles[index] = name;
+    if (current) power_profile = index;
+  }
+}
+
+bool GpuState::command(const char * attribute, const std::string & text) {
+  TRACE_SPAN("gpu_write");
+  int fd = open((device / attribute).c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd < 0) return false;
+  const bool ok = write(fd, text.data(), text.size()) == static_cast<ssize_t>(text.size());
+  const int error = errno;
+  close(fd);
+  errno = error;
+  return ok;
+}
+
+bool GpuState::ensureManual(SysfsWriter & writer) {
+  return performance_level == "manual" || setPerformanceLevel("manual", writer);
+}
+
+bool GpuState::setPerformanceLevel(const std::string & level, SysfsWriter & writer) {
+  if (device.empty()) return false;
+  const bool ok = writer.apply({ device / "power_dpm_force_performance_level" }, level).empty();
+  if (ok) performance_level = level;
+  return ok;
+}
+
+bool GpuState::setSclk(int min_mhz, int max_mhz, SysfsWriter & writer) {
+  if (device.empty() || sclk_lo < 0 || min_mhz < sclk_lo || max_mhz > sclk_hi || min_mhz > max_mhz) return false;
+  if (!ensureManual(writer)) return false;
+  // staged, then committed together
+  const bool ok = command("pp_od_clk_voltage", "s 0 " + std::to_string(min_mhz) + "\n") &&
+                  command("pp_od_clk_voltage", "s 1 " + std::to_string(max_mhz) + "\n") &&
+                  command("pp_od_clk_voltage", "c\n");
+  readOverdrive();
+  return ok;
+}
+
+bool GpuState::setPowerProfile(int index, SysfsWriter & writer) {
+  if (device.empty() || index < 0 || static_cast<size_t>(index) >= power_profiles.size()) return false;
+  if (!ensureManual(writer)) return false;
+  const bool ok = command("pp_power_profile_mode", std::to_string(index) + "\n");
+  readPowerProfiles();
+  return ok;
+}
+
+GpuSampler::~GpuSampler() {
+  close();
+}
+
+void GpuSampler::close() {
+  for (int & fd : _fds) {
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+  }
+}
+
+void GpuSampler::sync(const GpuState & gs) {
+  if (gs.device == _device) return;
+  close();
+  _device = gs.device;
+  _latest = GpuTelemetry {};
+  _head = _count = 0;
+  if (_device.empty()) return;
+  _fds[BUSY] = open_file(_device / "gpu_busy_percent");
+  // hwmon has the current clocks in Hz, APUs often only the sclk
+  const char * tables[] = { "pp_dpm_sclk", "pp_dpm_mclk" };
+  const char * inputs[] = { "freq1_input", "freq2_input" };
+  for (int i = 0; i < 2; ++i) {
+    int fd = gs.hwmon.empty() ? -1 : open_file(gs.hwmon / inputs[i]);
+    _clock_table[i] = fd < 0;
+    _fds[SCLK + i] = fd >= 0 ? fd : open_file(_device / tables[i]);
+  }
+  if (!gs.hwmon.empty()) {
+    _fds[POWER] = open_file(gs.hwmon / "power1_average");
+    if (_fds[POWER] < 0) _fds[POWER] = open_file(gs.hwmon / "power1_input");
+  }
+  _fds[VRAM_USED] = open_file(_device / "mem_info_vram_used");
+  _fds[GTT_USED] = open_file(_device / "mem_info_gtt_used");
+  _latest.vram_total_mb = read_uint(_device / "mem_info_vram_total") / 1048576.0f;
+  _latest.gtt_total_mb = read_uint(_device / "mem_info_gtt_total") / 1048576.0f;
+}
+
+uint64_t GpuSampler::sample() {
+  TRACE_SPAN("gpu_sample");
+  const uint64_t start = monotonicNs();
+  if (_device.empty()) return 0;
+  _latest.busy = pread_uint(_fds[BUSY]);
+  float * clocks[] = { &_latest.sclk_mhz, &_latest.mclk_mhz };
+  for (int i = 0; i < 2; ++i) {
+    *clocks[i] = _clock_table[i] ? current_level_mhz(_fds[SCLK + i]) : pread_uint(_fds[SCLK + i]) * 1e-6f;
+  }
+  _latest.power_w = _fds[POWER] >= 0 ? pread_uint(_fds[POWER]) * 1e-6f : -1;
+  _latest.vram_used_mb = pread_uint(_fds[VRAM_USED]) / 1048576.0f;
+  _latest.gtt_used_mb = pread_uint(_fds[GTT_USED]) / 1048576.0f;
+  _history[_head] = _latest.busy;
+  _head = (_head + 1) % HISTORY;
+  _count = std::min(_count + 1, HISTORY);
+  return monotonicNs() - start;
+}
+
+bool GpuSampler::ready() const {
+  return !_device.empty();
+}
+
+const GpuTelemetry & GpuSampler::latest() const {
+  return _latest;
+}
+
+int GpuSampler::history(float * out) const {
+  size_t at = (_head + HISTORY - _count) % HISTORY;
+  for (size_t i = 0; i < _count; ++i) {
+    out[i] = _history[at];
+    at = (at + 1) % HISTORY;
+  }
+  return static_cast<int>(_count);
+}
+
+}
@@ -0,0 +1,115 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "sysfs_writer.h"
+
+namespace cpu_utils {
+
+// The APU's amdgpu card under class/drm, its DPM settings and the options
+// for them. Reading needs no privileges, the setters need root.
+struct GpuState {
+  // finds the card and reads the settings, false without an amdgpu card
+  bool init();
+  // re-reads the settings of the card found by init()
+  void refresh();
+  bool setPerformanceLevel(const std::string & level, SysfsWriter & writer);
+  // overdrive only takes effect at the manual level, switches to it
+  bool setSclk(int min_mhz, int max_mhz, SysfsWriter & writer);
+  // also needs the manual level
+  bool setPowerProfile(int index, SysfsWriter & writer);
+
+  // empty without a card
+  std::filesystem::path device;
+  std::filesystem::path hwmon;
+  std::string performance_level;
+  std::vector<std::string> performance_levels;
+  // current overdrive sclk range and the bounds for it, -1 without
+  // overdrive (amdgpu.ppfeaturemask)
+  int sclk_min = -1;
+  int sclk_max = -1;
+  int sclk_lo = -1;
+  int sclk_hi = -1;
+  // names from pp_power_profile_mode, indexed by mode number
+  std::vector<std::string> power_profiles;
+  int power_profile = -1;
+
+  std::filesystem::path sysfs_root { "/sys" };
+
+private:
+  void readOverdrive();
+  void readPowerProfiles();
+  bool command(const char * attribute, const std::string & text);
+  bool ensureManual(SysfsWriter & writer);
+};
+
+struct GpuTelemetry {
+  float busy = 0;        // percent
+  float sclk_mhz = 0;
+  float mclk_mhz = 0;
+  float power_w = 0;     // hwmon power1, the whole package on an APU, -1 if missing
+  float vram_used_mb = 0;
+  float vram_total_mb = 0;
+  float gtt_used_mb = 0;
+  float gtt_total_mb = 0;
+};
+
+// Telemetry of the card GpuState found. Files stay open and are re-read
+// with pread, a sample is a handful of syscalls. Needs no privileges.
+struct GpuSampler {
+  static constexpr size_t HISTORY = 64;
+
+  GpuSampler() = default;
+
+  ~GpuSampler();
+
+  GpuSampler(const GpuSampler &) = delete;
+  GpuSampler & operator=(const GpuSampler &) = delete;
+
+  // reopens everything when the card changed
+  void sync(const GpuState & gs);
+  // returns how long it took, in ns
+  uint64_t sample();
+
+  bool ready() const;
+  const GpuTelemetry & latest() const;
+  // busy percent, oldest first, returns the number of points
+  int history(float * out) const;
+
+private:
+  enum File { BUSY, SCLK, MCLK, POWER, VRAM_USED, GTT_USED, FILES };
+
+  void close();
+
+  std::filesystem::path _device;
+  int _fds[FILES] = { -1, -1, -1, -1, -1, -1 };
+  // clocks from hwmon in Hz, or from the pp_dpm tables
+  bool _clock_table[2] = {};
+  GpuTelemetry _latest;
+  float _history[HISTORY] = {};
+  size_t _head = 0;
+  size_t _count = 0;
+};
+
+}
@@ -0,0 +1,89 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "backend.h"
+#include "trace.h"
+
+namespace cpu_utils {
+
+RyzenAdjBackend::RyzenAdjBackend() {
+  _ryzen = init_ryzenadj();
+  if(!_ryzen){
+    throw "Unable to init ryzenadj";
+  }
+}
+
+RyzenAdjBackend::~RyzenAdjBackend() {
+  cleanup_ryzenadj(_ryzen);
+}
+
+int RyzenAdjBackend::family() const {
+  return get_cpu_family(_ryzen);
+}
+
+void RyzenAdjBackend::read(RyzenTelemetry & out, MetricMask metrics) {
+  TRACE_SPAN("ryzen_read");
+  if (!_table) {
+    init_table(_ryzen);
+    _table = true;
+  }
+  {
+    TRACE_SPAN("refresh_table");
+    refresh_table(_ryzen);
+  }
+#define X(ID, field, type, kind, pair, label, unit, format, getter) \
+  if (metrics & metricBit(CH_##ID)) out.field = getter(_ryzen);
+  RYZEN_METRICS(X)
+#undef X
+}
+
+int RyzenAdjBackend::setStapmLimit(uint32_t mw) {
+  return set_stapm_limit(_ryzen, mw);
+}
+
+int RyzenAdjBackend::setFastLimit(uint32_t mw) {
+  return set_fast_limit(_ryzen, mw);
+}
+
+int RyzenAdjBackend::setSlowLimit(uint32_t mw) {
+  return set_slow_limit(_ryzen, mw);
+}
+
+int RyzenAdjBackend::setApuSlowLimit(uint32_t mw) {
+  return set_apu_slow_limit(_ryzen, mw);
+}
+
+int RyzenAdjBackend::setMaxPerformance() {
+  return set_max_performance(_ryzen);
+}
+
+int RyzenAdjBackend::setPowerSaving() {
+  return set_power_saving(_ryzen);
+}
+
+// offsets go to the SMU as 20 bit two's complement, per core with the core
+// in the bits above
+int RyzenAdjBackend::setCurveAll(int offset) {
+  return set_coall(_ryzen, static_cast<uint32_t>(offset) & 0xfffff);
+}
+
+int RyzenAdjBackend::setCurveCore(int core, int offset) {
+  return set_coper(_ryzen, (static_cast<uint32_t>(core) << 20) | (static_cast<uint32_t>(offset) & 0xfffff));
+}
+
+}
@@ -0,0 +1,78 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstdint>
+
+#include "cpu_utils.h"
+#include "ryzenadj.h"
+
+namespace cpu_utils {
+
+// Power limit telemetry and control of the APU. Setters take mW and return
+// 0 on success, like the ryzenadj calls they wrap.
+struct PowerBackend {
+  virtual ~PowerBackend() = default;
+
+  virtual int family() const = 0;
+
+  // refresh the PM table and copy out at least the metrics in the mask
+  virtual void read(RyzenTelemetry & out, MetricMask metrics) = 0;
+
+  virtual int setStapmLimit(uint32_t mw) = 0;
+  virtual int setFastLimit(uint32_t mw) = 0;
+  virtual int setSlowLimit(uint32_t mw) = 0;
+  virtual int setApuSlowLimit(uint32_t mw) = 0;
+
+  virtual int setMaxPerformance() = 0;
+  virtual int setPowerSaving() = 0;
+
+  // Curve Optimizer offsets, in counts of a few mV, negative undervolts.
+  // core is the Curve Optimizer core ID, see CPUState::curveCoreIds(). The SMU forgets them on reset.
+  virtual int setCurveAll(int offset) = 0;
+  virtual int setCurveCore(int core, int offset) = 0;
+};
+
+// The real thing, through libryzenadj. Needs root. The PM table is only
+// set up by the first read(), setting limits goes without it.
+struct RyzenAdjBackend : PowerBackend {
+  RyzenAdjBackend();
+
+  ~RyzenAdjBackend();
+
+  int family() const override;
+  void read(RyzenTelemetry & out, MetricMask metrics) override;
+
+  int setStapmLimit(uint32_t mw) override;
+  int setFastLimit(uint32_t mw) override;
+  int setSlowLimit(uint32_t mw) override;
+  int setApuSlowLimit(uint32_t mw) override;
+
+  int setMaxPerformance() override;
+  int setPowerSaving() override;
+
+  int setCurveAll(int offset) override;
+  int setCurveCore(int core, int offset) override;
+
+private:
+  ryzen_access _ryzen;
+  bool _table = false;
+};
+
+}
@@ -0,0 +1,511 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Benchmarks of the hot paths against a fake sysfs tree and a mock
+// libryzenadj: time, syscalls and allocations per operation.
+
+#include "backend.h"
+#include "channels.h"
+#include "amdgpu.h"
+#include "core_sampler.h"
+#include "process_sampler.h"
+#include "cpu_utils.h"
+#include "energy.h"
+#include "exporter.h"
+#include "governor.h"
+#include "history.h"
+#include "trace.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <csignal>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+std::atomic<uint64_t> allocations { 0 };
+
+}
+
+// every operator new in the process, the array and nothrow forms end up
+// here. Kept out of line with operator delete, inlined GCC takes malloc()
+// and free() for mismatched pairs.
+__attribute__((noinline)) void * operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void * p = malloc(size ? size : 1)) return p;
+  throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void * p) noexcept {
+  free(p);
+}
+
+__attribute__((noinline)) void operator delete(void * p, size_t) noexcept {
+  free(p);
+}
+
+namespace {
+
+// libryzenadj without the SMU, each getter is a copy out of the table
+struct MockBackend : cpu_utils::PowerBackend {
+  int family() const override { return cpu_utils::FAM_SIMULATED; }
+
+  void read(cpu_utils::RyzenTelemetry & out, cpu_utils::MetricMask metrics) override {
+    for (int ch = 0; ch < cpu_utils::CHANNEL_COUNT; ++ch) {
+      if (metrics & cpu_utils::metricBit(ch)) cpu_utils::setChannelValue(out, ch, _table[ch]);
+    }
+  }
+
+  int setStapmLimit(uint32_t mw) override { return set(cpu_utils::CH_STAPM_LIMIT, mw); }
+  int setFastLimit(uint32_t mw) override { return set(cpu_utils::CH_STAPM_FAST_LIMIT, mw); }
+  int setSlowLimit(uint32_t mw) override { return set(cpu_utils::CH_STAPM_SLOW_LIMIT, mw); }
+  int setApuSlowLimit(uint32_t mw) override { return set(cpu_utils::CH_APU_SLOW_LIMIT, mw); }
+  int setMaxPerformance() override { return 0; }
+  int setPowerSaving() override { return 0; }
+  int setCurveAll(int) override { return 0; }
+  int setCurveCore(int, int) override { return 0; }
+
+private:
+  int set(int ch, uint32_t mw) {
+    _table[ch] = mw / 1000;
+    return 0;
+  }
+
+  float _table[cpu_utils::CHANNEL_COUNT] {};
+};
+
+struct Bench {
+  const char * name;
+  // builds the state in whichever process runs it, returns the operation
+  std::function<std::function<void()>()> setup;
+};
+
+struct Result {
+  const char * name;
+  uint64_t ops;
+  double ns;
+  double allocs;
+  double syscalls; // -1 if they couldn't be counted
+};
+
+// no such syscall, brackets the counted operations
+constexpr long MARKER = 4095;
+constexpr int SYSCALL_ROUNDS = 20;
+
+static void make_tree(const std::filesystem::path & root, int cpus)
+{
+  namespace fs = std::filesystem;
+  const auto cpu_path = root / "sys" / "devices" / "system" / "cpu";
+  fs::create_directories(cpu_path / "smt");
+  fs::create_directories(cpu_path / "cpufreq");
+  const std::string all = cpus > 1 ? "0-" + std::to_string(cpus - 1) : "0";
+  for (const char * list : { "possible", "present", "online" }) {
+    std::ofstream (cpu_path / list) << all << '\n';
+  }
+  std::ofstream (cpu_path / "smt" / "control") << "on\n";
+  std::ofstream (cpu_path / "cpufreq" / "boost") << "1\n";
+
+  fs::create_directories(root / "proc");
+  std::ofstream stat (root / "proc" / "stat");
+  stat << "cpu  1000 0 1000 8000 0 0 0 0 0 0\n";
+  for (int i = 0; i < cpus; ++i) {
+    const auto dir = cpu_path / ("cpu" + std::to_string(i));
+    fs::create_directories(dir / "cpufreq");
+    fs::create_directories(dir / "topology");
+    fs::create_directories(dir / "cache" / "index3");
+    if (i) std::ofstream (dir / "online") << "1\n";
+    std::ofstream (dir / "topology" / "physical_package_id") << "0\n";
+    std::ofstream (dir / "topology" / "core_id") << i / 2 << '\n';
+    std::ofstream (dir / "cache" / "index3" / "id") << i / 16 << '\n';
+    std::ofstream (dir / "cpufreq" / "scaling_governor") << "powersave\n";
+    std::ofstream (dir / "cpufreq" / "scaling_available_governors") << "performance powersave\n";
+    std::ofstream (dir / "cpufreq" / "energy_performance_preference") << "balance_performance\n";
+    std::ofstream (dir / "cpufreq" / "energy_performance_available_preferences")
+        << "default performance balance_performance balance_power power\n";
+    std::ofstream (dir / "cpufreq" / "scaling_cur_freq") << 1400000 + i * 1000 << '\n';
+    stat << "cpu" << i << " 100 0 100 800 0 0 0 0 0 0\n";
+  }
+  stat << "intr 1 0 0 0\nctxt 0\n";
+  // about what a desktop runs
+  for (int pid = 1; pid <= 1000; ++pid) {
+    const auto dir = root / "proc" / std::to_string(pid);
+    fs::create_directories(dir);
+    std::ofstream (dir / "stat") << pid << " (worker " << pid << ") S 1 " << pid << ' ' << pid
+        << " 0 -1 4194560 1200 0 0 0 " << pid * 3 << ' ' << pid << " 0 0 20 0 4 0 " << 1000 + pid
+        << " 123456789 2048 18446744073709551615 1 1 0 0 0 0 0 4096 17663 0 0 0 17 1 0 0 0 0 0 0 0 0 0 0 0 0 0\n";
+  }
+
+  // an APU's card, hwmon has the sclk but no mclk
+  const auto card = root / "sys" / "devices" / "pci0000:00" / "0000:04:00.0";
+  const auto hwmon = card / "hwmon" / "hwmon4";
+  const auto driver = root / "sys" / "bus" / "pci" / "drivers" / "amdgpu";
+  fs::create_directories(hwmon);
+  fs::create_directories(driver);
+  fs::create_directories(card / "drm" / "card0");
+  fs::create_directories(root / "sys" / "class" / "drm");
+  fs::create_directory_symlink(card / "drm" / "card0", root / "sys" / "class" / "drm" / "card0");
+  fs::create_directory_symlink(card, card / "drm" / "card0" / "device");
+  fs::create_directory_symlink(driver, card / "driver");
+  std::ofstream (card / "gpu_busy_percent") << "37\n";
+  std::ofstream (card / "pp_dpm_mclk") << "0: 400Mhz \n1: 800Mhz \n2: 1200Mhz *\n3: 1600Mhz \n";
+  std::ofstream (card / "mem_info_vram_total") << "1073741824\n";
+  std::ofstream (card / "mem_info_vram_used") << "402653184\n";
+  std::ofstream (card / "mem_info_gtt_total") << "8589934592\n";
+  std::ofstream (card / "mem_info_gtt_used") << "1073741824\n";
+  std::ofstream (card / "power_dpm_force_performance_level") << "auto\n";
+  std::ofstream (hwmon / "freq1_input") << "1600000000\n";
+  std::ofstream (hwmon / "power1_average") << "9000000\n";
+}
+
+static std::vector<Bench> benches(const std::filesystem::path & root)
+{
+  using namespace cpu_utils;
+  const auto sysfs = root / "sys";
+  const auto proc = root / "proc";
+  auto ryzen = [] {
+    auto rs = std::make_shared<RyzenState>(std::make_unique<MockBackend>());
+    rs->tick();
+    return rs;
+  };
+  auto cpu_state = [sysfs] {
+    auto cs = std::make_shared<CPUState>();
+    cs->sysfs_root = sysfs;
+    cs->init();
+    return cs;
+  };
+  auto snapshot = [] {
+    Snapshot snap {};
+    for (int ch = 0; ch < CHANNEL_COUNT; ++ch) setChannelValue(snap.ryzen, ch, ch);
+    return snap;
+  };
+
+  return {
+    { "ryzen_tick", [=] {
+        auto rs = ryzen();
+        return [rs] { rs->tick(); };
+      } },
+    { "ryzen_tick_overview", [=] {
+        auto rs = ryzen();
+        // what the UI subscribes to without the details
+        const MetricMask metrics = metricBit(CH_STAPM_VALUE) | metricBit(CH_STAPM_FAST_VALUE) |
+                                   metricBit(CH_STAPM_SLOW_VALUE) | metricBit(CH_STAPM_LIMIT) |
+                                   metricBit(CH_STAPM_FAST_LIMIT) | metricBit(CH_STAPM_SLOW_LIMIT);
+        return [rs, metrics] { rs->tick(metrics); };
+      } },
+    { "ryzen_set_tdp", [=] {
+        auto rs = ryzen();
+        auto n = std::make_shared<int>(0);
+        return [rs, n] { rs->setTdp(15 + (++*n & 1), true); };
+      } },
+    { "cpu_init", [=] {
+        return [sysfs] {
+          CPUState cs;
+          cs.sysfs_root = sysfs;
+          cs.init();
+        };
+      } },
+    { "set_epp", [=] {
+        auto cs = cpu_state();
+        auto writer = std::make_shared<SysfsWriter>();
+        auto n = std::make_shared<int>(0);
+        return [cs, writer, n] { cs->setEPP(++*n & 1 ? "power" : "balance_power", *writer); };
+      } },
+    { "set_epp_unchanged", [=] {
+        auto cs = cpu_state();
+        auto writer = std::make_shared<SysfsWriter>();
+        cs->setEPP("power", *writer);
+        return [cs, writer] { cs->setEPP("power", *writer); };
+      } },
+    { "core_sample", [=] {
+        auto cs = cpu_state();
+        auto cores = std::make_shared<CoreSampler>(proc);
+        cores->sync(*cs);
+        cores->sample();
+        return [cores] { cores->sample(); };
+      } },
+    { "gpu_sample", [=] {
+        GpuState gs;
+        gs.sysfs_root = sysfs;
+        gs.init();
+        auto gpu = std::make_shared<GpuSampler>();
+        gpu->sync(gs);
+        gpu->sample();
+        return [gpu] { gpu->sample(); };
+      } },
+    { "process_sample", [=] {
+        auto processes = std::make_shared<ProcessSampler>(proc);
+        processes->sample(10);
+        return [processes] { processes->sample(10); };
+      } },
+    { "history_push", [=] {
+        auto history = std::make_shared<History>();
+        auto snap = std::make_shared<Snapshot>(snapshot());
+        return [history, snap] {
+          snap->timestamp_ns += 250000000;
+          history->push(*snap);
+        };
+      } },
+    { "energy_push", [=] {
+        auto energy = std::make_shared<EnergyAccount>();
+        auto snap = std::make_shared<Snapshot>(snapshot());
+        return [energy, snap] {
+          snap->timestamp_ns += 250000000;
+          snap->ryzen.stapm_fast_value += 0.25f;
+          energy->push(*snap, "balanced");
+        };
+      } },
+    { "frame_data", [=] {
+        // what a frame does with the telemetry before drawing: a fresh
+        // sample goes into the history, then the three overview plots
+        auto history = std::make_shared<History>();
+        auto snap = std::make_shared<Snapshot>(snapshot());
+        auto points = std::make_shared<std::vector<float>>(512);
+        for (int i = 0; i < 1000; ++i) {
+          snap->timestamp_ns += 250000000;
+          history->push(*snap);
+        }
+        return [history, snap, points] {
+          snap->timestamp_ns += 250000000;
+          history->push(*snap);
+          for (int ch : { CH_STAPM_VALUE, CH_STAPM_FAST_VALUE, CH_STAPM_SLOW_VALUE }) {
+            history->plot(0, ch, History::AVG, points->data(), 300);
+            float lo, hi;
+            history->range(0, ch, lo, hi);
+          }
+        };
+      } },
+    { "metrics_update", [=] {
+        auto text = std::make_shared<MetricsText>(MetricsText::OPENMETRICS);
+        auto snap = std::make_shared<Snapshot>(snapshot());
+        return [text, snap] {
+          ++snap->seq;
+          snap->ryzen.stapm_value += 0.25f;
+          text->update(*snap);
+        };
+      } },
+    // last, the enabled one leaves tracing on
+    { "trace_span_disabled", [] {
+        trace::setEnabled(false);
+        return [] { TRACE_SPAN("bench"); };
+      } },
+    { "trace_span_enabled", [] {
+        trace::setEnabled(true);
+        return [] { TRACE_SPAN("bench"); };
+      } },
+  };
+}
+
+static Result time_bench(const Bench & bench, double min_time_s)
+{
+  using clock = std::chrono::steady_clock;
+  auto op = bench.setup();
+  op();
+  uint64_t ops = 0;
+  const uint64_t allocs = allocations.load();
+  const auto start = clock::now();
+  double elapsed = 0;
+  do {
+    for (int i = 0; i < 16; ++i) op();
+    ops += 16;
+    elapsed = std::chrono::duration<double>(clock::now() - start).count();
+  } while (elapsed < min_time_s);
+  return { bench.name, ops, elapsed * 1e9 / ops, static_cast<double>(allocations.load() - allocs) / ops, -1 };
+}
+
+// Runs the operation in a traced child and counts the syscalls of all its
+// threads between the markers.
+static double count_syscalls(const Bench & bench)
+{
+  pid_t pid = fork();
+  if (pid < 0) return -1;
+  if (pid == 0) {
+    if (ptrace(PTRACE_TRACEME, 0, nullptr, nullptr) < 0) _exit(1);
+    raise(SIGSTOP);
+    auto op = bench.setup();
+    op();
+    syscall(MARKER);
+    for (int i = 0; i < SYSCALL_ROUNDS; ++i) op();
+    syscall(MARKER);
+    _exit(0);
+  }
+
+  int status;
+  if (waitpid(pid, &status, 0) < 0 || !WIFSTOPPED(status) ||
+      ptrace(PTRACE_SETOPTIONS, pid, nullptr, PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL) < 0) {
+    kill(pid, SIGKILL);
+    waitpid(pid, &status, 0);
+    return -1;
+  }
+  ptrace(PTRACE_SYSCALL, pid, nullptr, nullptr);
+  long count = 0;
+  int markers = 0;
+  while (true) {
+    pid_t tid = waitpid(-1, &status, __WALL);
+    if (tid < 0) break;
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+      if (tid == pid) break;
+      continue;
+    }
+    int sig = 0;
+    if (WSTOPSIG(status) == (SIGTRAP | 0x80)) {
+      __ptrace_syscall_info info;
+      if (ptrace(PTRACE_GET_SYSCALL_INFO, tid, sizeof(info), &info) > 0 && info.op == PTRACE_SYSCALL_INFO_ENTRY) {
+        if (static_cast<long>(info.entry.nr) == MARKER) {
+          ++markers;
+        } else if (markers == 1) {
+          ++count;
+        }
+      }
+    } else if (WSTOPSIG(status) != SIGTRAP && WSTOPSIG(status) != SIGSTOP) {
+      // not ours, pass it on
+      sig = WSTOPSIG(status);
+    }
+    ptrace(PTRACE_SYSCALL, tid, nullptr, sig);
+  }
+  return markers == 2 ? static_cast<double>(count) / SYSCALL_ROUNDS : -1;
+}
+
+// Closed loop runs of the TDP governor against the simulated APU, from
+// below and above each target. False if one doesn't settle within the run
+// or overshoots past its bound. The simulated APU has no battery.
+static bool check_governor()
+{
+  using cpu_utils::TdpGovernor;
+  struct Case {
+    int mode;
+    float target;
+    double seconds;
+    double overshoot; // at most, in the mode's unit
+  };
+  const Case cases[] = {
+    { TdpGovernor::SKIN_TEMP, 40, 600, 2 },
+    { TdpGovernor::SKIN_TEMP, 45, 600, 2 },
+    { TdpGovernor::PACKAGE_POWER, 10, 120, 2.5 },
+    { TdpGovernor::PACKAGE_POWER, 20, 120, 2.5 },
+  };
+  bool ok = true;
+  for (const auto & c : cases) {
+    TdpGovernor::Settings settings;
+    settings.mode = c.mode;
+    settings.target = c.target;
+    for (int start : { settings.min_tdp + 2, settings.max_tdp - 5 }) {
+      const auto result = cpu_utils::simulateGovernor(settings, c.seconds, 4, start);
+      const bool passed = result.convergence_s >= 0 && result.overshoot <= c.overshoot;
+      printf("%-16s %4.1f %s from %2d W: converged in %4.0f s, overshoot %.2f%s\n", TdpGovernor::modeName(c.mode),
+             c.target, TdpGovernor::modeUnit(c.mode), start, result.convergence_s, result.overshoot,
+             passed ? "" : ", FAILED");
+      ok &= passed;
+    }
+  }
+  return ok;
+}
+
+static void usage(const char * name)
+{
+  printf("Usage: %s [--cpus <n>] [--min-time <seconds>] [--filter <text>] [--json]\n"
+         "       %s --governor\n", name, name);
+}
+
+}
+
+int main(int argc, char ** argv){
+  int cpus = 16;
+  double minTime = 0.2;
+  const char * filter = nullptr;
+  bool json = false;
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--cpus") && i + 1 < argc) {
+      cpus = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--min-time") && i + 1 < argc) {
+      minTime = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--filter") && i + 1 < argc) {
+      filter = argv[++i];
+    } else if (!strcmp(argv[i], "--json")) {
+      json = true;
+    } else if (!strcmp(argv[i], "--governor")) {
+      return check_governor() ? 0 : 1;
+    } else {
+      usage(argv[0]);
+      return -1;
+    }
+  }
+  if (cpus < 1) {
+    usage(argv[0]);
+    return -1;
+  }
+
+  // CPUState::init() reports what it found, keep the output parseable
+  std::cout.rdbuf(nullptr);
+
+  char dir[] = "/tmp/simpletdp-bench.XXXXXX";
+  if (!mkdtemp(dir)) {
+    printf("Error: cannot create a temporary directory: %s\n", strerror(errno));
+    return -1;
+  }
+  std::vector<Result> results;
+  try {
+    make_tree(dir, cpus);
+    for (const auto & bench : benches(dir)) {
+      if (filter && !strstr(bench.name, filter)) continue;
+      Result result = time_bench(bench, minTime);
+      result.syscalls = count_syscalls(bench);
+      results.push_back(result);
+      if (!json) {
+        printf("%-20s %12.0f ns/op %10.1f syscalls/op %8.1f allocs/op %10llu ops\n", result.name, result.ns,
+               result.syscalls, result.allocs, static_cast<unsigned long long>(result.ops));
+      }
+    }
+  } catch (const char * err) {
+    std::filesystem::remove_all(dir);
+    printf("Error: %s\n", err);
+    return -1;
+  }
+  std::filesystem::remove_all(dir);
+
+  if (json) {
+    printf("{\"cpus\": %d, \"benchmarks\": [", cpus);
+    for (size_t i = 0; i < results.size(); ++i) {
+      const Result & r = results[i];
+      printf("%s\n  {\"name\": \"%s\", \"ns_per_op\": %.1f, \"syscalls_per_op\": ", i ? "," : "", r.name, r.ns);
+      // null when ptrace isn't allowed
+      if (r.syscalls < 0) {
+        printf("null");
+      } else {
+        printf("%.2f", r.syscalls);
+      }
+      printf(", \"allocs_per_op\": %.2f, \"ops\": %llu}", r.allocs, static_cast<unsigned long long>(r.ops));
+    }
+    printf("\n]}\n");
+  }
+  return 0;
+}
@@ -0,0 +1,52 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "channels.h"
+
+#include <cmath>
+#include <type_traits>
+
+namespace cpu_utils {
+
+const char * channelName(int ch) {
+  if (ch < 0 || ch >= CHANNEL_COUNT) return "unknown";
+  return CHANNELS[ch].name;
+}
+
+float channelValue(const RyzenTelemetry & ry, int ch) {
+  switch (ch) {
+#define X(ID, field, ...) case CH_##ID: return ry.field;
+    RYZEN_METRICS(X)
+#undef X
+    default:
+      break;
+  }
+  return 0;
+}
+
+void setChannelValue(RyzenTelemetry & ry, int ch, float value) {
+  switch (ch) {
+#define X(ID, field, type, ...) case CH_##ID: ry.field = std::is_integral_v<type> && std::isnan(value) ? 0 : static_cast<type>(value); break;
+    RYZEN_METRICS(X)
+#undef X
+    default:
+      break;
+  }
+}
+
+}
@@ -0,0 +1,46 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "cpu_utils.h"
+
+namespace cpu_utils {
+
+enum MetricKind { METRIC_LIMIT, METRIC_VALUE, METRIC_PARAM };
+
+struct ChannelInfo {
+  const char * name;   // the RyzenTelemetry field
+  const char * label;
+  const char * unit;
+  const char * format; // printf, of the value as a float
+  MetricKind kind;
+  int pair;            // CH_NONE if it has no limit or value
+};
+
+constexpr ChannelInfo CHANNELS[CHANNEL_COUNT] = {
+#define X(ID, field, type, kind, pair, label, unit, format, getter) { #field, label, unit, format, METRIC_##kind, CH_##pair },
+  RYZEN_METRICS(X)
+#undef X
+};
+
+const char * channelName(int ch);
+float channelValue(const RyzenTelemetry & ry, int ch);
+void setChannelValue(RyzenTelemetry & ry, int ch, float value);
+
+}
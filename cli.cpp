@@ -0,0 +1,241 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "cli.h"
+#include "backend.h"
+#include "channels.h"
+#include "protocol.h"
+#include "sampler.h"
+#include "sim_backend.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+#include <unistd.h>
+
+// the range simpletdpd accepts
+#define MIN_TDP 1
+#define MAX_TDP 120
+
+namespace cpu_utils {
+
+namespace {
+
+// what --get prints, from either side
+struct State {
+  protocol::Info info;
+  RyzenTelemetry ryzen {};
+};
+
+static bool contains(const std::vector<std::string> & options, const std::string & option)
+{
+  return std::find(options.begin(), options.end(), option) != options.end();
+}
+
+static void print_json_string(const std::string & text)
+{
+  putchar('"');
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      printf("\\%c", c);
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      printf("\\u%04x", c);
+    } else {
+      putchar(c);
+    }
+  }
+  putchar('"');
+}
+
+static void print_state(const State & state, bool json)
+{
+  const CPUState & cs = state.info.cpu;
+  if (!json) {
+    printf("%-24s %s\n", "family", familyName(state.info.family));
+    printf("%-24s %s\n", "profile", state.info.profile.empty() ? "-" : state.info.profile.c_str());
+    printf("%-24s %s\n", "tdp_governor", TdpGovernor::modeName(state.info.tdp_governor.mode));
+    printf("%-24s %s\n", "scaling_governor", cs.scaling_governor.c_str());
+    printf("%-24s %s\n", "epp", cs.epp.c_str());
+    printf("%-24s %d\n", "smt", cs.smt);
+    printf("%-24s %d\n", "boost", cs.boost);
+    for (int ch = 0; ch < CHANNEL_COUNT; ++ch) {
+      char value[32];
+      snprintf(value, sizeof(value), CHANNELS[ch].format, channelValue(state.ryzen, ch));
+      printf("%-24s %s %s\n", CHANNELS[ch].name, value, CHANNELS[ch].unit);
+    }
+    return;
+  }
+  printf("{\"family\": ");
+  print_json_string(familyName(state.info.family));
+  printf(", \"profile\": ");
+  if (state.info.profile.empty()) {
+    printf("null");
+  } else {
+    print_json_string(state.info.profile);
+  }
+  printf(", \"tdp_governor\": ");
+  print_json_string(TdpGovernor::modeName(state.info.tdp_governor.mode));
+  printf(", \"scaling_governor\": ");
+  print_json_string(cs.scaling_governor);
+  printf(", \"epp\": ");
+  print_json_string(cs.epp);
+  printf(", \"smt\": %d, \"boost\": %d, \"metrics\": {", cs.smt, cs.boost);
+  for (int ch = 0; ch < CHANNEL_COUNT; ++ch) {
+    const double value = channelValue(state.ryzen, ch);
+    printf(ch ? ", \"%s\": " : "\"%s\": ", CHANNELS[ch].name);
+    if (std::isfinite(value)) {
+      printf(CHANNELS[ch].format, value);
+    } else {
+      printf("null");
+    }
+  }
+  printf("}}\n");
+}
+
+// sends a setter and waits for its ACK
+static bool request(int fd, uint16_t type, const void * payload, size_t size, const char * what)
+{
+  protocol::Message msg;
+  if (!protocol::send(fd, type, payload, size) || !protocol::recv(fd, msg) || msg.header.type != protocol::MSG_ACK) {
+    fprintf(stderr, "Error: lost connection to simpletdpd\n");
+    return false;
+  }
+  int32_t status = EPROTO;
+  if (!msg.as(status) || status) {
+    fprintf(stderr, "Error: simpletdpd refused %s: %s\n", what, strerror(status));
+    return false;
+  }
+  return true;
+}
+
+static int run_remote(int fd, const CliOptions & options)
+{
+  using namespace protocol;
+  if (!options.governor.empty() && !request(fd, MSG_SET_GOVERNOR, options.governor.data(), options.governor.size(), "the governor")) return 1;
+  if (!options.epp.empty() && !request(fd, MSG_SET_EPP, options.epp.data(), options.epp.size(), "the EPP")) return 1;
+  if (options.tdp >= 0) {
+    const int32_t tdp = options.tdp;
+    if (!request(fd, MSG_SET_TDP, &tdp, sizeof(tdp), "the TDP")) return 1;
+  }
+  if (!options.get) return 0;
+
+  State state;
+  Message msg;
+  if (!send(fd, MSG_GET_INFO) || !recv(fd, msg) || msg.header.type != MSG_INFO || !parseInfo(msg.text(), state.info) ||
+      !send(fd, MSG_SUBSCRIBE) || !recv(fd, msg) || msg.header.type != MSG_ACK) {
+    fprintf(stderr, "Error: lost connection to simpletdpd\n");
+    return 1;
+  }
+  // the daemon only reads what its clients subscribe to, the first sample
+  // pushed may still be one taken without us
+  Snapshot snap;
+  for (int pushed = 0; pushed < 2;) {
+    if (!recv(fd, msg)) {
+      fprintf(stderr, "Error: lost connection to simpletdpd\n");
+      return 1;
+    }
+    if (msg.header.type == MSG_SNAPSHOT && msg.as(snap)) ++pushed;
+  }
+  state.ryzen = snap.ryzen;
+  print_state(state, options.json);
+  return 0;
+}
+
+static int run_local(const CliOptions & options, bool simulate, const std::filesystem::path & sysfs_root)
+{
+  State state;
+  CPUState & cs = state.info.cpu;
+  if (!options.governor.empty() || !options.epp.empty() || options.get) {
+    cs.sysfs_root = sysfs_root;
+    cs.initOnline();
+  }
+  // a handful of files, no pool
+  SysfsWriter writer (1);
+  auto set = [&](const char * what, const std::string & option, const std::vector<std::string> & available,
+                 std::vector<SysfsWriter::Failure> (CPUState::*setter)(const std::string &, SysfsWriter &)) {
+    if (!available.empty() && !contains(available, option)) {
+      fprintf(stderr, "Error: %s is not an available %s\n", option.c_str(), what);
+      return false;
+    }
+    const auto failures = (cs.*setter)(option, writer);
+    if (!failures.empty()) {
+      fprintf(stderr, "Error: cannot set the %s of CPU %zu: %s\n", what, failures.front().index, strerror(failures.front().error));
+      return false;
+    }
+    return true;
+  };
+  if (!options.governor.empty() && !set("scaling governor", options.governor, cs.scaling_available_governors, &CPUState::setScalingGovernor)) return 1;
+  if (!options.epp.empty() && !set("EPP", options.epp, cs.epp_available_options, &CPUState::setEPP)) return 1;
+
+  if (options.tdp >= 0 || options.get) {
+    try {
+      std::unique_ptr<PowerBackend> backend;
+      if (simulate) {
+        backend = std::make_unique<SimulatedBackend>();
+      } else {
+        backend = std::make_unique<RyzenAdjBackend>();
+      }
+      RyzenState rs (std::move(backend));
+      if (options.tdp >= 0 && !rs.setTdp(options.tdp, true)) {
+        fprintf(stderr, "Error: the SMU refused a %d W limit\n", options.tdp);
+        return 1;
+      }
+      if (options.get) {
+        rs.tick();
+        state.ryzen = rs;
+        state.info.family = rs.getFamily();
+      }
+    } catch (const char * err) {
+      fprintf(stderr, "Error: %s\n", err);
+      return 1;
+    }
+  }
+  if (options.get) {
+    print_state(state, options.json);
+  }
+  return 0;
+}
+
+}
+
+bool CliOptions::any() const {
+  return tdp >= 0 || !governor.empty() || !epp.empty() || get;
+}
+
+int runCli(const CliOptions & options, const char * socket_path, bool local, bool simulate,
+           const std::filesystem::path & sysfs_root) {
+  if (options.tdp >= 0 && (options.tdp < MIN_TDP || options.tdp > MAX_TDP)) {
+    fprintf(stderr, "Error: the TDP must be %d-%d W\n", MIN_TDP, MAX_TDP);
+    return 1;
+  }
+  if (!local && !simulate) {
+    const int fd = protocol::connectSocket(socket_path);
+    if (fd >= 0) {
+      const int status = run_remote(fd, options);
+      close(fd);
+      return status;
+    }
+  }
+  return run_local(options, simulate, sysfs_root);
+}
+
+}
@@ -0,0 +1,45 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <filesystem>
+#include <string>
+
+namespace cpu_utils {
+
+// One-shot commands for scripts, run instead of the UI. -1 and empty
+// strings leave a setting alone.
+struct CliOptions {
+  int tdp = -1;
+  std::string governor;
+  std::string epp;
+  bool get = false;
+  bool json = false;
+
+  bool any() const;
+};
+
+// Through simpletdpd at socket_path if it runs and local isn't set,
+// otherwise on the hardware, touching only what the command needs: the
+// cpufreq files of the online CPUs for the governor and EPP, the SMU for
+// the TDP, and its PM table for --get. Returns the exit status.
+int runCli(const CliOptions & options, const char * socket_path, bool local, bool simulate,
+           const std::filesystem::path & sysfs_root);
+
+}
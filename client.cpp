@@ -0,0 +1,222 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "client.h"
+#include "protocol.h"
+
+#include <cstdint>
+#include <iostream>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace cpu_utils {
+
+RemoteController::RemoteController(const char * path) {
+  _fd = protocol::connectSocket(path);
+  if (_fd < 0) {
+    throw "Unable to connect to simpletdpd";
+  }
+  // fetch the initial state synchronously so the UI starts with real values
+  protocol::Message msg;
+  if (!protocol::send(_fd, protocol::MSG_GET_INFO) || !protocol::recv(_fd, msg) || !handle(msg) ||
+      !protocol::send(_fd, protocol::MSG_GET_SNAPSHOT) || !protocol::recv(_fd, msg) || !handle(msg)) {
+    close(_fd);
+    throw "Unable to talk to simpletdpd";
+  }
+  update();
+}
+
+RemoteController::~RemoteController() {
+  _closing = true;
+  shutdown(_fd, SHUT_RDWR);
+  if (_reader.joinable()) {
+    _reader.join();
+  }
+  close(_fd);
+}
+
+void RemoteController::setListener(std::function<void()> listener) {
+  _listener = std::move(listener);
+}
+
+void RemoteController::start() {
+  if (_reader.joinable()) return;
+  protocol::sendValue(_fd, protocol::MSG_SUBSCRIBE, _metrics);
+  _reader = std::thread(&RemoteController::run, this);
+}
+
+Snapshot RemoteController::latest() const {
+  return _snapshot.load();
+}
+
+const CPUState & RemoteController::cpuState() const {
+  return _cs;
+}
+
+const char * RemoteController::getFamilyName() const {
+  return familyName(_family);
+}
+
+int RemoteController::rate() const {
+  return _rate.load(std::memory_order_relaxed);
+}
+
+TdpGovernor::Settings RemoteController::tdpGovernor() const {
+  return _tdp_governor;
+}
+
+const std::string & RemoteController::profile() const {
+  return _profile;
+}
+
+const GpuState & RemoteController::gpuState() const {
+  return _gs;
+}
+
+const CoreSteering::Settings & RemoteController::steering() const {
+  return _steering;
+}
+
+const std::vector<int> & RemoteController::curve() const {
+  return _curve;
+}
+
+void RemoteController::update() {
+  if (_info_version.load(std::memory_order_acquire) == _applied_version) return;
+  std::lock_guard<std::mutex> guard(_lock);
+  _cs = _received.cpu;
+  _family = _received.family;
+  _tdp_governor = _received.tdp_governor;
+  _profile = _received.profile;
+  _gs = _received.gpu;
+  _steering = _received.steering;
+  _curve = _received.curve;
+  _applied_version = _info_version.load(std::memory_order_relaxed);
+}
+
+void RemoteController::subscribe(MetricMask metrics) {
+  if (metrics == _metrics) return;
+  _metrics = metrics;
+  // start() sends it otherwise
+  if (_reader.joinable()) {
+    protocol::sendValue(_fd, protocol::MSG_SUBSCRIBE, _metrics);
+  }
+}
+
+void RemoteController::setTdp(int tdp) {
+  protocol::sendValue(_fd, protocol::MSG_SET_TDP, static_cast<int32_t>(tdp));
+}
+
+void RemoteController::setScalingGovernor(const std::string & option) {
+  protocol::sendText(_fd, protocol::MSG_SET_GOVERNOR, option);
+}
+
+void RemoteController::setEPP(const std::string & option) {
+  protocol::sendText(_fd, protocol::MSG_SET_EPP, option);
+}
+
+void RemoteController::setRate(int rate_hz) {
+  protocol::sendValue(_fd, protocol::MSG_SET_RATE, static_cast<int32_t>(rate_hz));
+}
+
+void RemoteController::setTdpGovernor(const TdpGovernor::Settings & settings) {
+  protocol::sendValue(_fd, protocol::MSG_SET_TDP_GOVERNOR, settings);
+}
+
+void RemoteController::setSmt(bool enabled) {
+  protocol::sendValue(_fd, protocol::MSG_SET_SMT, static_cast<int32_t>(enabled));
+}
+
+void RemoteController::setBoost(bool enabled) {
+  protocol::sendValue(_fd, protocol::MSG_SET_BOOST, static_cast<int32_t>(enabled));
+}
+
+void RemoteController::applyProfile(const Profile & profile) {
+  protocol::sendText(_fd, protocol::MSG_APPLY_PROFILE, formatProfile(profile));
+}
+
+void RemoteController::setGpuPerformanceLevel(const std::string & level) {
+  protocol::sendText(_fd, protocol::MSG_SET_GPU_LEVEL, level);
+}
+
+void RemoteController::setGpuSclk(int min_mhz, int max_mhz) {
+  const int32_t range[2] = { min_mhz, max_mhz };
+  protocol::sendValue(_fd, protocol::MSG_SET_GPU_SCLK, range);
+}
+
+void RemoteController::setGpuPowerProfile(int index) {
+  protocol::sendValue(_fd, protocol::MSG_SET_GPU_POWER_PROFILE, static_cast<int32_t>(index));
+}
+
+void RemoteController::setPstateStatus(const std::string & status) {
+  protocol::sendText(_fd, protocol::MSG_SET_PSTATE, status);
+}
+
+void RemoteController::setFreqRange(const std::vector<int> & cpus, int min_khz, int max_khz) {
+  protocol::sendText(_fd, protocol::MSG_SET_FREQ_RANGE, protocol::formatFreqRange(cpus, min_khz, max_khz));
+}
+
+void RemoteController::steer(const CoreSteering::Settings & settings) {
+  protocol::sendValue(_fd, protocol::MSG_STEER, settings);
+}
+
+void RemoteController::setCurve(const std::vector<int> & offsets) {
+  protocol::sendText(_fd, protocol::MSG_SET_CURVE, protocol::formatCurve(offsets));
+}
+
+bool RemoteController::handle(const protocol::Message & msg) {
+  switch (msg.header.type) {
+    case protocol::MSG_SNAPSHOT: {
+      Snapshot snap;
+      if (!msg.as(snap)) return false;
+      _snapshot.store(snap);
+      return true;
+    }
+    case protocol::MSG_INFO: {
+      std::lock_guard<std::mutex> guard(_lock);
+      if (!protocol::parseInfo(msg.text(), _received)) return false;
+      _rate.store(_received.rate, std::memory_order_relaxed);
+      _info_version.fetch_add(1, std::memory_order_release);
+      return true;
+    }
+    case protocol::MSG_ACK: {
+      int32_t status;
+      if (msg.as(status) && status != 0) {
+        std::cerr << "simpletdpd rejected request: " << status << std::endl;
+      }
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+void RemoteController::run() {
+  protocol::Message msg;
+  while (protocol::recv(_fd, msg)) {
+    if (handle(msg) && msg.header.type != protocol::MSG_ACK && _listener) {
+      _listener();
+    }
+  }
+  if (!_closing) {
+    std::cerr << "Lost connection to simpletdpd" << std::endl;
+  }
+}
+
+}
@@ -0,0 +1,97 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include "controller.h"
+#include "protocol.h"
+#include "seqlock.h"
+
+namespace cpu_utils {
+
+// Unprivileged front end for simpletdpd. Telemetry is pushed by the daemon
+// and read on a background thread, setters are fire and forget.
+struct RemoteController : Controller {
+  RemoteController(const char * path);
+
+  ~RemoteController();
+
+  void setListener(std::function<void()> listener) override;
+  void start() override;
+
+  Snapshot latest() const override;
+  const CPUState & cpuState() const override;
+  const char * getFamilyName() const override;
+  int rate() const override;
+  TdpGovernor::Settings tdpGovernor() const override;
+  const std::string & profile() const override;
+  const GpuState & gpuState() const override;
+  const CoreSteering::Settings & steering() const override;
+  const std::vector<int> & curve() const override;
+
+  void update() override;
+  void subscribe(MetricMask metrics) override;
+
+  void setTdp(int tdp) override;
+  void setScalingGovernor(const std::string & option) override;
+  void setEPP(const std::string & option) override;
+  void setRate(int rate_hz) override;
+  void setTdpGovernor(const TdpGovernor::Settings & settings) override;
+  void setSmt(bool enabled) override;
+  void setBoost(bool enabled) override;
+  void applyProfile(const Profile & profile) override;
+  void setGpuPerformanceLevel(const std::string & level) override;
+  void setGpuSclk(int min_mhz, int max_mhz) override;
+  void setGpuPowerProfile(int index) override;
+  void setPstateStatus(const std::string & status) override;
+  void setFreqRange(const std::vector<int> & cpus, int min_khz, int max_khz) override;
+  void steer(const CoreSteering::Settings & settings) override;
+  void setCurve(const std::vector<int> & offsets) override;
+
+private:
+  void run();
+  bool handle(const protocol::Message & msg);
+
+  int _fd;
+  std::thread _reader;
+  std::atomic<bool> _closing { false };
+  std::function<void()> _listener;
+  SeqLock<Snapshot> _snapshot;
+
+  // written by the reader thread, picked up by update()
+  std::mutex _lock;
+  protocol::Info _received;
+  std::atomic<int> _rate { 0 };
+  std::atomic<uint64_t> _info_version { 0 };
+
+  uint64_t _applied_version = 0;
+  CPUState _cs;
+  int _family = -1;
+  TdpGovernor::Settings _tdp_governor;
+  std::string _profile;
+  GpuState _gs;
+  CoreSteering::Settings _steering;
+  std::vector<int> _curve;
+  MetricMask _metrics = ALL_METRICS;
+};
+
+}
@@ -0,0 +1,505 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "controller.h"
+#include "clock.h"
+#include "backend.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+// how long after a resume the limits are watched, some firmware puts its
+// own back a while after the wakeup
+#define RESUME_WATCH_NS 5000000000ull
+// the state file is written once the settings stop changing for this long,
+// not for every step of a slider
+#define STATE_QUIET_NS 1000000000ull
+
+namespace cpu_utils {
+
+namespace {
+
+static void report(const char * attribute, const std::string & option, const std::vector<SysfsWriter::Failure> & failures)
+{
+  for (const auto & failure : failures) {
+    std::cerr << "cpu" << failure.index << ": cannot set " << attribute << " to " << option << ": " << strerror(failure.error) << std::endl;
+  }
+}
+
+}
+
+LocalController::LocalController(int rate_hz, std::unique_ptr<PowerBackend> backend, const std::filesystem::path & sysfs_root)
+  : _rs(std::move(backend)), _sampler(_rs, rate_hz), _sysfs_root(sysfs_root) {
+  // everything until the caller says otherwise
+  _caller_metrics = _sampler.subscribe(ALL_METRICS);
+  _governor_metrics = _sampler.subscribe(0);
+  _recorder_metrics = _sampler.subscribe(0);
+  _cs.sysfs_root = sysfs_root;
+  _cs.init();
+  // the SMU starts without offsets
+  _curve.assign(_cs.physicalCores().size(), 0);
+  _curve_ids = _cs.curveCoreIds();
+  _gs.sysfs_root = sysfs_root;
+  _gs.init();
+  _sampler.setListener([this] {
+    const Snapshot snap = _sampler.latest();
+    if (_recorder) _recorder->record(snap);
+    watchResume(snap);
+    govern(snap);
+    writeState(false);
+    if (_listener) _listener();
+  });
+}
+
+LocalController::~LocalController() {
+  // the monitor calls into us, stop it before anything is torn down
+  _hotplug.stop();
+  _sampler.stop();
+  // settings changed in the last quiet period
+  writeState(true);
+}
+
+void LocalController::govern(const Snapshot & snap) {
+  std::lock_guard<std::mutex> guard(_governor_lock);
+  const int mode = _governor.settings().mode;
+  double measured;
+  if (mode == TdpGovernor::OFF) return;
+  // holds the TDP, on AC for the battery drain
+  if (!TdpGovernor::measure(mode, snap.ryzen, _sysfs_root, measured)) {
+    _governor.hold();
+    return;
+  }
+  int tdp = _governor.update(measured, snap.ryzen.stapm_limit, snap.timestamp_ns * 1e-9);
+  if (tdp > 0) {
+    _rs.setTdp(tdp);
+    _requested_tdp.store(tdp, std::memory_order_relaxed);
+    if (_recorder) _recorder->event(flight_log::EV_SET_TDP, tdp);
+  }
+}
+
+void LocalController::watchResume(const Snapshot & snap) {
+  // monotonic time stops while suspended, the wakeup was after the sample
+  // before at the earliest
+  const uint64_t previous_ns = _last_sample_ns ? _last_sample_ns : snap.timestamp_ns;
+  _last_sample_ns = snap.timestamp_ns;
+  const uint64_t suspended_ns = _suspend_clock.suspendedNs();
+  if (suspended_ns) {
+    _resume_ns = previous_ns;
+    _resume_limits = { -1, -1 };
+    std::cout << "Resumed after " << suspended_ns / 1000000000ull << " s suspended" << std::endl;
+    std::vector<int> curve, ids;
+    {
+      std::lock_guard<std::mutex> guard(_curve_lock);
+      curve = _curve;
+      ids = _curve_ids;
+    }
+    if (std::any_of(curve.begin(), curve.end(), [](int offset) { return offset != 0; }) && !_rs.setCurve(curve, ids)) {
+      std::cerr << "cannot restore the curve offsets" << std::endl;
+    }
+  }
+  if (!_resume_ns) return;
+  if (snap.timestamp_ns - _resume_ns > RESUME_WATCH_NS) {
+    _resume_ns = 0;
+    return;
+  }
+  // once for the reset, and again only if the firmware changes them after
+  // that, not for every read of a limit it clamped
+  const std::pair<int, int> limits { snap.ryzen.stapm_limit, snap.ryzen.stapm_fast_limit };
+  if (!_rs.limitsHeld() && limits != _resume_limits) {
+    const uint64_t start_ns = monotonicNs();
+    const bool ok = _rs.restoreLimits();
+    const uint64_t end_ns = monotonicNs();
+    std::cout << "Limits were reset to " << limits.first << "/" << limits.second << " W, "
+              << (ok ? "restored" : "refused") << " in " << (end_ns - start_ns) / 1000 << " us, at most "
+              << (end_ns - _resume_ns) / 1000000 << " ms after the resume" << std::endl;
+    if (_recorder) _recorder->event(flight_log::EV_SET_TDP, _requested_tdp.load(std::memory_order_relaxed));
+  }
+  _resume_limits = limits;
+}
+
+void LocalController::setListener(std::function<void()> listener) {
+  _listener = std::move(listener);
+}
+
+void LocalController::record(const std::string & path) {
+  _recorder = std::make_unique<Recorder>(path, getFamily());
+  _sampler.setSubscription(_recorder_metrics, ALL_METRICS);
+  // start every log with the current settings
+  _recorder->event(flight_log::EV_SET_RATE, rate());
+  _recorder->event(flight_log::EV_SET_GOVERNOR, 0, _cs.scaling_governor);
+  _recorder->event(flight_log::EV_SET_EPP, 0, _cs.epp);
+}
+
+void LocalController::start() {
+  _sampler.start();
+  const bool monitored = _hotplug.start([this](int cpu) {
+    {
+      std::lock_guard<std::mutex> guard(_hotplug_lock);
+      _hotplugged.push_back(cpu);
+    }
+    _hotplug_pending.store(true, std::memory_order_release);
+    if (_listener) _listener();
+  });
+  if (!monitored) {
+    std::cerr << "Cannot listen for CPU hotplug events: " << strerror(errno) << std::endl;
+  }
+}
+
+void LocalController::update() {
+  if (!_hotplug_pending.exchange(false, std::memory_order_acquire)) return;
+  std::vector<int> hotplugged;
+  {
+    std::lock_guard<std::mutex> guard(_hotplug_lock);
+    hotplugged.swap(_hotplugged);
+  }
+  bool changed = false;
+  for (int cpu : hotplugged) {
+    changed |= _cs.hotplug(cpu);
+  }
+  if (!changed) return;
+  // files of an offlined CPU go stale, and one that comes back starts out
+  // with the kernel defaults
+  _writer.reset();
+  if (!_cs.scaling_governor.empty()) report("scaling_governor", _cs.scaling_governor, _cs.setScalingGovernor(_cs.scaling_governor, _writer));
+  if (!_cs.epp.empty()) report("energy_performance_preference", _cs.epp, _cs.setEPP(_cs.epp, _writer));
+  refreshCurveIds();
+  ++_cpu_version;
+}
+
+void LocalController::refreshCurveIds() {
+  std::vector<int> ids = _cs.curveCoreIds();
+  std::lock_guard<std::mutex> guard(_curve_lock);
+  _curve_ids = std::move(ids);
+}
+
+uint64_t LocalController::cpuVersion() const {
+  return _cpu_version;
+}
+
+Snapshot LocalController::latest() const {
+  return _sampler.latest();
+}
+
+const CPUState & LocalController::cpuState() const {
+  return _cs;
+}
+
+const char * LocalController::getFamilyName() const {
+  return _rs.getFamilyName();
+}
+
+int LocalController::getFamily() const {
+  return _rs.getFamily();
+}
+
+int LocalController::rate() const {
+  return _sampler.rate();
+}
+
+TdpGovernor::Settings LocalController::tdpGovernor() const {
+  std::lock_guard<std::mutex> guard(_governor_lock);
+  return _governor.settings();
+}
+
+const std::string & LocalController::profile() const {
+  return _profile;
+}
+
+const GpuState & LocalController::gpuState() const {
+  return _gs;
+}
+
+const CoreSteering::Settings & LocalController::steering() const {
+  return _steering.settings();
+}
+
+const std::vector<int> & LocalController::curve() const {
+  return _curve;
+}
+
+void LocalController::persist(const std::filesystem::path & path, bool restore) {
+  _state_path.clear();
+  std::ifstream input (path);
+  std::string line;
+  while (restore && std::getline(input, line)) {
+    std::istringstream fields (line);
+    std::string key;
+    fields >> key;
+    if (key == "profile") {
+      std::string text;
+      std::getline(fields >> std::ws, text);
+      Profile profile;
+      if (!parseProfile(text, profile)) continue;
+      apply(profile);
+      // not one of the named profiles
+      if (profile.name == "saved") _profile.clear();
+    } else if (key == "tdp_governor") {
+      TdpGovernor::Settings settings;
+      if (fields >> settings.mode >> settings.target >> settings.min_tdp >> settings.max_tdp &&
+          settings.mode > TdpGovernor::OFF && settings.mode < TdpGovernor::MODE_COUNT) {
+        setTdpGovernor(settings);
+      }
+    }
+  }
+  _state_path = path;
+  markState();
+}
+
+void LocalController::markState() {
+  if (_state_path.empty()) return;
+  const TdpGovernor::Settings governor = tdpGovernor();
+  const int tdp = _requested_tdp.load(std::memory_order_relaxed);
+  // the governor picks the TDP itself
+  Profile state { _profile.empty() ? "saved" : _profile, governor.mode == TdpGovernor::OFF && tdp > 0 ? tdp : -1,
+                  _cs.scaling_governor, _cs.epp, _cs.smt, _cs.boost };
+  std::ostringstream text;
+  text << "profile " << formatProfile(state) << '\n'
+       << "tdp_governor " << governor.mode << ' ' << governor.target << ' ' << governor.min_tdp << ' '
+       << governor.max_tdp << '\n';
+  std::lock_guard<std::mutex> guard(_state_lock);
+  _state_text = text.str();
+  _state_changed_ns = monotonicNs();
+}
+
+void LocalController::writeState(bool now) {
+  std::lock_guard<std::mutex> guard(_state_lock);
+  if (!_state_changed_ns || (!now && monotonicNs() - _state_changed_ns < STATE_QUIET_NS)) return;
+  _state_changed_ns = 0;
+  std::error_code ec;
+  if (_state_path.has_parent_path()) std::filesystem::create_directories(_state_path.parent_path(), ec);
+  auto temp = _state_path;
+  temp += ".new";
+  {
+    std::ofstream out (temp);
+    out << _state_text;
+    if (!out.flush()) ec = std::make_error_code(std::errc::io_error);
+  }
+  if (!ec) std::filesystem::rename(temp, _state_path, ec);
+  if (ec) {
+    std::cerr << "cannot save the settings to " << _state_path.string() << ": " << ec.message() << std::endl;
+  }
+}
+
+void LocalController::setTdp(int tdp) {
+  writeTdp(tdp, false);
+  _profile.clear();
+  markState();
+}
+
+bool LocalController::writeTdp(int tdp, bool now) {
+  {
+    std::lock_guard<std::mutex> guard(_governor_lock);
+    if (_governor.settings().mode != TdpGovernor::OFF) {
+      _governor.configure({}, TdpGovernor::defaultTuning(TdpGovernor::OFF));
+      _sampler.setSubscription(_governor_metrics, 0);
+      if (_recorder) _recorder->event(flight_log::EV_SET_TDP_GOVERNOR, TdpGovernor::OFF);
+    }
+  }
+  const bool ok = _rs.setTdp(tdp, now);
+  _requested_tdp.store(tdp, std::memory_order_relaxed);
+  if (_recorder) _recorder->event(flight_log::EV_SET_TDP, tdp);
+  return ok;
+}
+
+void LocalController::setScalingGovernor(const std::string & option) {
+  report("scaling_governor", option, _cs.setScalingGovernor(option, _writer));
+  if (_recorder) _recorder->event(flight_log::EV_SET_GOVERNOR, 0, option);
+  _profile.clear();
+  markState();
+}
+
+void LocalController::setEPP(const std::string & option) {
+  report("energy_performance_preference", option, _cs.setEPP(option, _writer));
+  if (_recorder) _recorder->event(flight_log::EV_SET_EPP, 0, option);
+  _profile.clear();
+  markState();
+}
+
+void LocalController::subscribe(MetricMask metrics) {
+  _sampler.setSubscription(_caller_metrics, metrics);
+}
+
+void LocalController::setRate(int rate_hz) {
+  _sampler.setRate(rate_hz);
+  if (_recorder) _recorder->event(flight_log::EV_SET_RATE, _sampler.rate());
+}
+
+void LocalController::setSmt(bool enabled) {
+  apply({ "smt", -1, "", "", enabled, -1 });
+  _profile.clear();
+  markState();
+}
+
+void LocalController::setBoost(bool enabled) {
+  apply({ "boost", -1, "", "", -1, enabled });
+  _profile.clear();
+  markState();
+}
+
+void LocalController::setGpuPerformanceLevel(const std::string & level) {
+  if (!_gs.setPerformanceLevel(level, _writer)) {
+    std::cerr << "cannot set the GPU performance level to " << level << std::endl;
+  }
+}
+
+void LocalController::setGpuSclk(int min_mhz, int max_mhz) {
+  if (!_gs.setSclk(min_mhz, max_mhz, _writer)) {
+    std::cerr << "cannot set the GPU sclk range to " << min_mhz << "-" << max_mhz << " MHz: " << strerror(errno) << std::endl;
+  }
+}
+
+void LocalController::setGpuPowerProfile(int index) {
+  if (!_gs.setPowerProfile(index, _writer)) {
+    std::cerr << "cannot set the GPU power profile to " << index << ": " << strerror(errno) << std::endl;
+  }
+}
+
+void LocalController::setPstateStatus(const std::string & status) {
+  if (!_cs.setPstateStatus(status, _writer)) {
+    std::cerr << "cannot set the amd-pstate mode to " << status << std::endl;
+  }
+  // the new driver starts with its own governor and EPP
+  _profile.clear();
+  markState();
+}
+
+void LocalController::setFreqRange(const std::vector<int> & cpus, int min_khz, int max_khz) {
+  report("scaling_min_freq/scaling_max_freq", std::to_string(min_khz) + "-" + std::to_string(max_khz),
+         _cs.setFreqRange(cpus, min_khz, max_khz, _writer));
+}
+
+void LocalController::steer(const CoreSteering::Settings & settings) {
+  if (!steerProcess(settings)) {
+    std::cerr << "cannot steer process " << settings.pid << ": " << strerror(errno) << std::endl;
+  }
+}
+
+bool LocalController::steerProcess(const CoreSteering::Settings & settings) {
+  if (settings.pid == 0) {
+    _steering.release(_cs, _writer);
+    return true;
+  }
+  return _steering.steer(_cs, settings, _writer);
+}
+
+void LocalController::setCurve(const std::vector<int> & offsets) {
+  std::vector<int> ids;
+  {
+    std::lock_guard<std::mutex> guard(_curve_lock);
+    ids = _curve_ids;
+  }
+  if (!_rs.setCurve(offsets, ids)) {
+    std::cerr << "cannot set the curve offsets" << std::endl;
+    return;
+  }
+  std::lock_guard<std::mutex> guard(_curve_lock);
+  _curve = offsets;
+}
+
+void LocalController::applyProfile(const Profile & profile) {
+  apply(profile);
+}
+
+ApplyReport LocalController::apply(const Profile & profile) {
+  auto flag = [](int value) { return value < 0 ? std::string() : std::to_string(value); };
+  // SMT first, it decides which CPUs the cpufreq settings go to, and the
+  // governor before the EPP, which some governors lock
+  std::vector<ProfileStep> steps;
+  if (profile.smt >= 0 && _cs.smt >= 0) {
+    steps.push_back({ "smt", flag(profile.smt),
+                      [&] { return flag(_cs.smt); },
+                      [&](const std::string & value) {
+                        const bool ok = _cs.setSmt(value == "1", _writer);
+                        // CPUs came or went, their cpufreq files with them
+                        _writer.reset();
+                        refreshCurveIds();
+                        return ok;
+                      } });
+  }
+  if (profile.boost >= 0 && _cs.boost >= 0) {
+    steps.push_back({ "boost", flag(profile.boost),
+                      [&] { return flag(_cs.boost); },
+                      [&](const std::string & value) { return _cs.setBoost(value == "1", _writer); } });
+  }
+  if (!profile.governor.empty()) {
+    steps.push_back({ "governor", profile.governor,
+                      [&] { return _cs.scaling_governor; },
+                      [&](const std::string & value) {
+                        auto failures = _cs.setScalingGovernor(value, _writer);
+                        report("scaling_governor", value, failures);
+                        if (_recorder) _recorder->event(flight_log::EV_SET_GOVERNOR, 0, value);
+                        return failures.empty();
+                      } });
+  }
+  if (!profile.epp.empty()) {
+    steps.push_back({ "epp", profile.epp,
+                      [&] { return _cs.epp; },
+                      [&](const std::string & value) {
+                        auto failures = _cs.setEPP(value, _writer);
+                        report("energy_performance_preference", value, failures);
+                        if (_recorder) _recorder->event(flight_log::EV_SET_EPP, 0, value);
+                        return failures.empty();
+                      } });
+  }
+  if (profile.tdp >= 0) {
+    steps.push_back({ "tdp", std::to_string(profile.tdp),
+                      [&] {
+                        // the telemetry lags behind a write
+                        const int requested = _requested_tdp.load(std::memory_order_relaxed);
+                        return std::to_string(requested > 0 ? requested : latest().ryzen.stapm_limit);
+                      },
+                      [&](const std::string & value) { return writeTdp(atoi(value.c_str()), true); } });
+  }
+
+  ApplyReport result = applyTransaction(steps);
+  std::cout << "Profile " << profile.name << (result.ok ? " applied" : " failed") << " in " << result.total_us << " us:";
+  for (const auto & step : result.steps) {
+    std::cout << ' ' << step.name << ' ' << (step.skipped ? "unchanged" : std::to_string(static_cast<int>(step.us)) + " us");
+  }
+  std::cout << std::endl;
+  if (!result.ok) {
+    std::cerr << "Profile " << profile.name << ": " << result.failed << " refused, "
+              << (result.rolled_back ? "rolled back" : "rollback incomplete") << std::endl;
+  }
+  if (_recorder) _recorder->event(flight_log::EV_APPLY_PROFILE, result.ok, profile.name);
+  if (result.ok) {
+    _profile = profile.name;
+  } else if (!result.rolled_back) {
+    _profile.clear();
+  }
+  markState();
+  return result;
+}
+
+void LocalController::setTdpGovernor(const TdpGovernor::Settings & settings) {
+  {
+    std::lock_guard<std::mutex> guard(_governor_lock);
+    _governor.configure(settings, TdpGovernor::defaultTuning(settings.mode));
+    _sampler.setSubscription(_governor_metrics, TdpGovernor::metrics(settings.mode));
+    if (_recorder) _recorder->event(flight_log::EV_SET_TDP_GOVERNOR, settings.mode, std::to_string(settings.target));
+    _profile.clear();
+  }
+  markState();
+}
+
+}
@@ -0,0 +1,209 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "amdgpu.h"
+#include "cpu_utils.h"
+#include "governor.h"
+#include "profile.h"
+#include "recorder.h"
+#include "sampler.h"
+#include "steering.h"
+#include "suspend.h"
+
+namespace cpu_utils {
+
+// What the UI talks to: either the hardware in this process or simpletdpd
+// over its socket.
+struct Controller {
+  virtual ~Controller() = default;
+
+  // called whenever new telemetry or cpu state is available, possibly from
+  // another thread. Set it before start().
+  virtual void setListener(std::function<void()> listener) = 0;
+  virtual void start() = 0;
+
+  virtual Snapshot latest() const = 0;
+  // cpu state as of the last update()
+  virtual const CPUState & cpuState() const = 0;
+  virtual const char * getFamilyName() const = 0;
+  virtual int rate() const = 0;
+  // as of the last update()
+  virtual TdpGovernor::Settings tdpGovernor() const = 0;
+  // name of the profile applied last, empty once a setting is changed on
+  // its own. As of the last update().
+  virtual const std::string & profile() const = 0;
+  // as of the last update(), no device without an amdgpu card
+  virtual const GpuState & gpuState() const = 0;
+  // as of the last update()
+  virtual const CoreSteering::Settings & steering() const = 0;
+  // Curve Optimizer offsets by physical core, as of the last update()
+  virtual const std::vector<int> & curve() const = 0;
+
+  // pulls state received in the background into cpuState(), call it from the
+  // thread that reads it
+  virtual void update() {}
+  // the metrics the caller reads from latest(), the rest may go stale.
+  // Replaces the previous call, everything until the first.
+  virtual void subscribe(MetricMask) {}
+
+  virtual void setTdp(int tdp) = 0;
+  virtual void setScalingGovernor(const std::string & option) = 0;
+  virtual void setEPP(const std::string & option) = 0;
+  virtual void setRate(int rate_hz) = 0;
+  // a manual setTdp() switches the governor off
+  virtual void setTdpGovernor(const TdpGovernor::Settings & settings) = 0;
+  virtual void setSmt(bool enabled) = 0;
+  virtual void setBoost(bool enabled) = 0;
+  // all or nothing, see applyTransaction()
+  virtual void applyProfile(const Profile & profile) = 0;
+  virtual void setGpuPerformanceLevel(const std::string & level) = 0;
+  // switches to the manual performance level
+  virtual void setGpuSclk(int min_mhz, int max_mhz) = 0;
+  virtual void setGpuPowerProfile(int index) = 0;
+  virtual void setPstateStatus(const std::string & status) = 0;
+  // of the given CPUs, clamped per CPU
+  virtual void setFreqRange(const std::vector<int> & cpus, int min_khz, int max_khz) = 0;
+  // a pid of 0 releases the process steered before
+  virtual void steer(const CoreSteering::Settings & settings) = 0;
+  // one offset per physical core, see PowerBackend::setCurveCore()
+  virtual void setCurve(const std::vector<int> & offsets) = 0;
+};
+
+// Owns the hardware, needs root unless both the backend and the sysfs
+// tree are fake.
+struct LocalController : Controller {
+  LocalController(int rate_hz, std::unique_ptr<PowerBackend> backend, const std::filesystem::path & sysfs_root = "/sys");
+
+  ~LocalController();
+
+  void setListener(std::function<void()> listener) override;
+  void start() override;
+
+  Snapshot latest() const override;
+  const CPUState & cpuState() const override;
+  const char * getFamilyName() const override;
+  int getFamily() const;
+  int rate() const override;
+  TdpGovernor::Settings tdpGovernor() const override;
+  const std::string & profile() const override;
+  const GpuState & gpuState() const override;
+  const CoreSteering::Settings & steering() const override;
+  const std::vector<int> & curve() const override;
+
+  // applies CPU hotplug events, and the governor and EPP to CPUs that came
+  // online
+  void update() override;
+  // bumped by update() whenever cpuState() changed
+  uint64_t cpuVersion() const;
+
+  void subscribe(MetricMask metrics) override;
+
+  void setTdp(int tdp) override;
+  void setScalingGovernor(const std::string & option) override;
+  void setEPP(const std::string & option) override;
+  void setRate(int rate_hz) override;
+  void setTdpGovernor(const TdpGovernor::Settings & settings) override;
+  void setSmt(bool enabled) override;
+  void setBoost(bool enabled) override;
+  void applyProfile(const Profile & profile) override;
+  // the same, with the per-step report
+  ApplyReport apply(const Profile & profile);
+  void setGpuPerformanceLevel(const std::string & level) override;
+  void setGpuSclk(int min_mhz, int max_mhz) override;
+  void setGpuPowerProfile(int index) override;
+  void setPstateStatus(const std::string & status) override;
+  void setFreqRange(const std::vector<int> & cpus, int min_khz, int max_khz) override;
+  void steer(const CoreSteering::Settings & settings) override;
+  // the same, false with errno set if the process couldn't be pinned
+  bool steerProcess(const CoreSteering::Settings & settings);
+  // curve() keeps the old offsets if the SMU refused them
+  void setCurve(const std::vector<int> & offsets) override;
+
+  // log every sample and control change to a flight recorder file,
+  // throws if the log can't be created
+  void record(const std::string & path);
+  // Saves the settings to path once they stop changing, from here on.
+  // restore applies the ones saved there first, e.g. at boot. Call it
+  // before start().
+  void persist(const std::filesystem::path & path, bool restore);
+
+private:
+  // runs on the sampler thread
+  void govern(const Snapshot & snap);
+  // the firmware puts its own limits back on resume and forgets the curve
+  void watchResume(const Snapshot & snap);
+  // after the topology changed, on the caller's thread
+  void refreshCurveIds();
+  bool writeTdp(int tdp, bool now);
+  // takes the settings to save, writeState() writes them out on the
+  // sampler thread, or right away with now
+  void markState();
+  void writeState(bool now);
+
+  RyzenState _rs;
+  CPUState _cs;
+  GpuState _gs;
+  SysfsWriter _writer;
+  CoreSteering _steering;
+  // written on the caller's thread, read after a resume on the sampler's
+  std::mutex _curve_lock;
+  std::vector<int> _curve;
+  std::vector<int> _curve_ids;   // _cs.curveCoreIds(), _cs is the caller's
+  Sampler _sampler;
+  // subscription ids
+  int _caller_metrics;
+  int _governor_metrics;
+  int _recorder_metrics;
+  std::filesystem::path _sysfs_root;
+  mutable std::mutex _governor_lock;
+  TdpGovernor _governor;
+  // last limit written by us or the governor, 0 before the first
+  std::atomic<int> _requested_tdp { 0 };
+  std::function<void()> _listener;
+  std::unique_ptr<Recorder> _recorder;
+  std::string _profile;
+  std::filesystem::path _state_path;
+  std::mutex _state_lock;
+  std::string _state_text;
+  uint64_t _state_changed_ns = 0;  // 0 once written
+
+  // sampler thread only
+  SuspendClock _suspend_clock;
+  uint64_t _last_sample_ns = 0;
+  // watching the limits until a while after a resume, 0 otherwise
+  uint64_t _resume_ns = 0;
+  std::pair<int, int> _resume_limits;
+
+  // CPUs with uevents, from the monitor thread
+  HotplugMonitor _hotplug;
+  std::mutex _hotplug_lock;
+  std::vector<int> _hotplugged;
+  std::atomic<bool> _hotplug_pending { false };
+  uint64_t _cpu_version = 0;
+};
+
+}
@@ -0,0 +1,226 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "core_sampler.h"
+#include "clock.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <fstream>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace cpu_utils {
+
+namespace {
+
+static uint64_t parse_uint(const char *& p, const char * end)
+{
+  while (p < end && *p == ' ') ++p;
+  uint64_t value = 0;
+  while (p < end && *p >= '0' && *p <= '9') {
+    value = value * 10 + (*p++ - '0');
+  }
+  return value;
+}
+
+static const char * next_line(const char * p, const char * end)
+{
+  while (p < end && *p != '\n') ++p;
+  return p < end ? p + 1 : end;
+}
+
+}
+
+CoreSampler::CoreSampler(const std::filesystem::path & proc_root)
+  : _stat_fd(open((proc_root / "stat").c_str(), O_RDONLY | O_CLOEXEC)), _stat_buf(4096) {}
+
+CoreSampler::~CoreSampler() {
+  for (int fd : _freq_fds) {
+    if (fd >= 0) close(fd);
+  }
+  if (_stat_fd >= 0) close(_stat_fd);
+}
+
+void CoreSampler::sync(const CPUState & cs) {
+  const size_t n = cs.cpus.size();
+  if (n != _freq_fds.size()) {
+    for (int fd : _freq_fds) {
+      if (fd >= 0) close(fd);
+    }
+    _freq_fds.assign(n, -1);
+    _online.assign(n, false);
+    _busy.assign(n, 0);
+    _total.assign(n, 0);
+    _prev_busy.assign(n, 0);
+    _prev_total.assign(n, 0);
+    _freq.assign(n, 0);
+    _util.assign(n, 0);
+    _history.assign(n * HISTORY, 0);
+    _head = 0;
+    _count = 0;
+    _next_freq = 0;
+  }
+  for (size_t i = 0; i < n; ++i) {
+    const auto & [path, online] = cs.cpus[i];
+    if (online == _online[i] && (!online || _freq_fds[i] >= 0)) continue;
+    if (_freq_fds[i] >= 0) close(_freq_fds[i]);
+    _freq_fds[i] = online ? open((path / "cpufreq" / "scaling_cur_freq").c_str(), O_RDONLY | O_CLOEXEC) : -1;
+    _online[i] = online;
+    _freq[i] = 0;
+  }
+}
+
+uint64_t CoreSampler::sample() {
+  TRACE_SPAN("core_sample");
+  const uint64_t start = monotonicNs();
+  const size_t n = _freq_fds.size();
+  if (n == 0) return 0;
+
+  if (readStat()) {
+    const uint64_t * busy = _busy.data();
+    const uint64_t * total = _total.data();
+    const uint64_t * prev_busy = _prev_busy.data();
+    const uint64_t * prev_total = _prev_total.data();
+    float * util = _util.data();
+    for (size_t i = 0; i < n; ++i) {
+      const float d_busy = static_cast<float>(busy[i] - prev_busy[i]);
+      const float d_total = static_cast<float>(total[i] - prev_total[i]);
+      util[i] = d_total > 0 ? d_busy / d_total : 0;
+    }
+    std::copy(_busy.begin(), _busy.end(), _prev_busy.begin());
+    std::copy(_total.begin(), _total.end(), _prev_total.begin());
+    for (size_t i = 0; i < n; ++i) {
+      _history[i * HISTORY + _head] = util[i];
+    }
+    _head = (_head + 1) % HISTORY;
+    _count = std::min(_count + 1, HISTORY);
+  }
+
+  // frequencies cost a syscall each, keep within the budget
+  char buf[32];
+  for (size_t done = 0; done < n; ++done) {
+    if (done % 8 == 7 && monotonicNs() - start > BUDGET_NS) break;
+    const size_t i = _next_freq;
+    _next_freq = (_next_freq + 1) % n;
+    if (_freq_fds[i] < 0) continue;
+    ssize_t len = pread(_freq_fds[i], buf, sizeof(buf), 0);
+    if (len <= 0) continue;
+    const char * p = buf;
+    _freq[i] = parse_uint(p, buf + len) * 1e-3f;
+  }
+  return monotonicNs() - start;
+}
+
+bool CoreSampler::readStat() {
+  if (_stat_fd < 0) return false;
+  while (true) {
+    ssize_t len = pread(_stat_fd, _stat_buf.data(), _stat_buf.size(), 0);
+    if (len <= 0) return false;
+    const char * end = _stat_buf.data() + len;
+    // the aggregate "cpu " line comes first
+    const char * p = next_line(_stat_buf.data(), end);
+    bool complete = false;
+    while (p < end) {
+      const char * eol = next_line(p, end);
+      if (eol == end && end[-1] != '\n') break;
+      if (end - p < 4 || p[0] != 'c' || p[1] != 'p' || p[2] != 'u') {
+        complete = true;
+        break;
+      }
+      p += 3;
+      const size_t cpu = parse_uint(p, eol);
+      uint64_t fields[8] = {};
+      for (auto & field : fields) {
+        field = parse_uint(p, eol);
+      }
+      if (cpu < _total.size()) {
+        // user nice system idle iowait irq softirq steal, guest time is
+        // already counted in user
+        uint64_t total = 0;
+        for (uint64_t field : fields) total += field;
+        _total[cpu] = total;
+        _busy[cpu] = total - fields[3] - fields[4];
+      }
+      p = eol;
+    }
+    // the file is generated per read, only the cpu lines matter
+    if (complete || static_cast<size_t>(len) < _stat_buf.size()) return true;
+    _stat_buf.resize(_stat_buf.size() * 2);
+  }
+}
+
+size_t CoreSampler::size() const {
+  return _freq_fds.size();
+}
+
+const float * CoreSampler::freqMhz() const {
+  return _freq.data();
+}
+
+const float * CoreSampler::utilization() const {
+  return _util.data();
+}
+
+int CoreSampler::history(size_t cpu, float * out) const {
+  if (cpu >= _freq_fds.size()) return 0;
+  const float * ring = _history.data() + cpu * HISTORY;
+  size_t at = (_head + HISTORY - _count) % HISTORY;
+  for (size_t i = 0; i < _count; ++i) {
+    out[i] = ring[at];
+    at = (at + 1) % HISTORY;
+  }
+  return static_cast<int>(_count);
+}
+
+CoreBenchResult benchCoreSampler(const std::filesystem::path & root, int cpus, int rounds) {
+  {
+    std::filesystem::create_directories(root / "proc");
+    std::ofstream stat (root / "proc" / "stat");
+    stat << "cpu  1000 0 1000 8000 0 0 0 0 0 0\n";
+    for (int i = 0; i < cpus; ++i) {
+      const auto dir = root / "sys" / "devices" / "system" / "cpu" / ("cpu" + std::to_string(i)) / "cpufreq";
+      std::filesystem::create_directories(dir);
+      std::ofstream (dir / "scaling_cur_freq") << 1400000 + i * 1000 << std::endl;
+      stat << "cpu" << i << " 100 0 100 800 0 0 0 0 0 0\n";
+    }
+    // what follows the cpu lines on a real system, not parsed
+    stat << "intr 1";
+    for (int i = 0; i < 4096; ++i) stat << " 0";
+    stat << "\nctxt 0\n";
+  }
+
+  CPUState cs;
+  cs.sysfs_root = root / "sys";
+  cs.init();
+  CoreSampler sampler (root / "proc");
+  sampler.sync(cs);
+  sampler.sample();
+
+  CoreBenchResult result {};
+  for (int i = 0; i < rounds; ++i) {
+    const double us = sampler.sample() * 1e-3;
+    result.mean_us += us;
+    result.max_us = std::max(result.max_us, us);
+  }
+  result.mean_us /= rounds;
+  return result;
+}
+
+}
@@ -0,0 +1,90 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+#include "cpu_utils.h"
+
+namespace cpu_utils {
+
+// Frequency and utilization of every logical CPU, from scaling_cur_freq and
+// /proc/stat. Files stay open and are re-read with pread, values are kept as
+// one array per field. Needs no privileges.
+struct CoreSampler {
+  // utilization samples kept per CPU
+  static constexpr size_t HISTORY = 64;
+  // a sample() stops reading frequencies once it took this long and picks
+  // up where it left off next time
+  static constexpr uint64_t BUDGET_NS = 500000;
+
+  explicit CoreSampler(const std::filesystem::path & proc_root = "/proc");
+
+  ~CoreSampler();
+
+  CoreSampler(const CoreSampler &) = delete;
+  CoreSampler & operator=(const CoreSampler &) = delete;
+
+  // follows the CPU list, reopens only CPUs that changed
+  void sync(const CPUState & cs);
+  // returns how long it took, in ns
+  uint64_t sample();
+
+  size_t size() const;
+  // 0 for offline CPUs
+  const float * freqMhz() const;
+  // 0 to 1, over the time since the previous sample
+  const float * utilization() const;
+  // utilization of cpu, oldest first, returns the number of points
+  int history(size_t cpu, float * out) const;
+
+private:
+  bool readStat();
+
+  int _stat_fd = -1;
+  std::vector<char> _stat_buf;
+
+  std::vector<int> _freq_fds;
+  std::vector<bool> _online;
+  size_t _next_freq = 0;
+
+  std::vector<uint64_t> _busy;
+  std::vector<uint64_t> _total;
+  std::vector<uint64_t> _prev_busy;
+  std::vector<uint64_t> _prev_total;
+  std::vector<float> _freq;
+  std::vector<float> _util;
+  // CPU major, HISTORY entries each
+  std::vector<float> _history;
+  size_t _head = 0;
+  size_t _count = 0;
+};
+
+// Times CoreSampler::sample() against a fake sysfs and /proc tree of the
+// given size.
+struct CoreBenchResult {
+  double mean_us;
+  double max_us;
+};
+
+CoreBenchResult benchCoreSampler(const std::filesystem::path & root, int cpus, int rounds);
+
+}
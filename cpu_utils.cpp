@@ -17,20 +17,21 @@
 */
 
 #include "cpu_utils.h"
+#include "clock.h"
+#include "backend.h"
+#include "trace.h"
 
+#include <algorithm>
+#include <cstdlib>
+#include <map>
 #include <iostream>
 #include <fstream>
-#include <sstream>
-
-#define CPU_PATH "/sys/devices/system/cpu"
 
 namespace cpu_utils {
 
-namespace {
-
-static const char *family_name(ryzen_family fam)
+const char * familyName(int family)
 {
-  switch (fam)
+  switch (family)
   {
     case FAM_RAVEN: return "Raven";
     case FAM_PICASSO: return "Picasso";
@@ -43,6 +44,7 @@ static const char *family_name(ryzen_family fam)
     case FAM_PHOENIX: return "Phoenix Point";
     case FAM_HAWKPOINT: return "Hawk Point";
     case FAM_STRIXPOINT: return "Strix Point";
+    case FAM_SIMULATED: return "Simulated";
     default:
       break;
   }
@@ -50,158 +52,379 @@ static const char *family_name(ryzen_family fam)
   return "Unknown";
 }
 
+namespace {
+
+static std::string read_line(const std::filesystem::path & path)
+{
+  std::ifstream input (path);
+  std::string line;
+  std::getline(input, line);
+  return line;
+}
+
+static int read_int(const std::filesystem::path & path)
+{
+  const std::string line = read_line(path);
+  return line.empty() ? -1 : atoi(line.c_str());
+}
+
+static bool failed(const std::vector<SysfsWriter::Failure> & failures, int cpu)
+{
+  return std::any_of(failures.begin(), failures.end(), [&](const auto & f) { return static_cast<int>(f.index) == cpu; });
+}
+
+static std::vector<std::string> read_words(const std::filesystem::path & path)
+{
+  std::vector<std::string> words;
+  std::ifstream input (path);
+  std::string word;
+  while (input >> word) {
+    words.push_back(word);
+  }
+  return words;
+}
+
 }
 
 void CPUState::init() {
-  // check online cpu
-  const std::filesystem::path cpu_path { CPU_PATH };
-  cpus = { {cpu_path / "cpu0" , true } };
-  for (size_t i = 1; i < 128; ++i) {
-    std::stringstream ss;
-    ss << "cpu" << i;
-    std::filesystem::path path = cpu_path / ss.str();
-    if (!std::filesystem::exists(path)) break;
-    std::filesystem::path online = path / "online";
-    if (!std::filesystem::exists(online)) break;
-    std::ifstream input (online);
-    int flag;
-    input >> flag;
-    cpus.emplace_back(path, flag == 1);
-    // std::cout << path << " online: " << flag << std::endl;
-  }
-
-  auto cpu0freq = std::get<0>(cpus[0]) / "cpufreq";
-  // get current scaling governor
-  if (auto scaling = cpu0freq / "scaling_governor"; std::filesystem::exists(scaling)) {
-    char governor[64];
-    std::ifstream input (scaling);
-    input.getline(governor, 64);
-    scaling_governor = governor;
-    std::cout << "scaling_governor: " << scaling_governor << std::endl;
-  }
-
-  // get scaling governors
-  if (auto scaling_governors = cpu0freq / "scaling_available_governors"; std::filesystem::exists(scaling_governors)) {
-    scaling_available_governors.clear();
-    std::ifstream input (scaling_governors);
-    while (input){
-      std::stringstream ss;
-      char c = input.get();
-      while (!isspace(c)) {
-        ss << c;
-        c = input.get();
+  TRACE_SPAN("cpu_init");
+  topology.load(sysfs_root);
+  cpus.clear();
+  cpus.reserve(topology.size());
+  for (size_t i = 0; i < topology.size(); ++i) {
+    cpus.emplace_back(sysfs_root / "devices" / "system" / "cpu" / ("cpu" + std::to_string(i)), topology.cpus[i].online);
+  }
+  readOptions();
+  std::cout << "scaling_governor: " << scaling_governor << ", epp: " << epp << std::endl;
+}
+
+void CPUState::initOnline() {
+  const auto cpu_path = sysfs_root / "devices" / "system" / "cpu";
+  const auto online = parseCpuList(read_line(cpu_path / "online"));
+  cpus.clear();
+  topology.cpus.clear();
+  if (!online.empty()) {
+    const int last = *std::max_element(online.begin(), online.end());
+    cpus.reserve(last + 1);
+    for (int i = 0; i <= last; ++i) {
+      cpus.emplace_back(cpu_path / ("cpu" + std::to_string(i)), false);
+    }
+    for (int cpu : online) {
+      std::get<1>(cpus[cpu]) = true;
+    }
+  } else {
+    // trees without the list, e.g. a hand made fake one
+    for (int i = 0; std::filesystem::exists(cpu_path / ("cpu" + std::to_string(i))); ++i) {
+      cpus.emplace_back(cpu_path / ("cpu" + std::to_string(i)), true);
+    }
+  }
+  readOptions();
+}
+
+bool CPUState::hotplug(int cpu) {
+  if (!topology.refresh(sysfs_root, cpu)) return false;
+  std::get<1>(cpus[cpu]) = topology.cpus[cpu].online;
+  readFreq(cpu);
+  return true;
+}
+
+int CPUState::firstOnline() const {
+  auto cpu = std::find_if(cpus.begin(), cpus.end(), [](const auto & c) { return std::get<1>(c); });
+  return cpu == cpus.end() ? -1 : cpu - cpus.begin();
+}
+
+std::filesystem::path CPUState::smtPath() const {
+  return sysfs_root / "devices" / "system" / "cpu" / "smt" / "control";
+}
+
+std::filesystem::path CPUState::pstatePath() const {
+  return sysfs_root / "devices" / "system" / "cpu" / "amd_pstate" / "status";
+}
+
+std::filesystem::path CPUState::boostPath() const {
+  // acpi-cpufreq and amd-pstate in passive or guided mode, then active mode
+  const auto cpu_path = sysfs_root / "devices" / "system" / "cpu";
+  if (auto path = cpu_path / "cpufreq" / "boost"; std::filesystem::exists(path)) return path;
+  return cpu_path / "amd_pstate" / "cpb_boost";
+}
+
+void CPUState::readOptions() {
+  TRACE_SPAN("cpu_read_options");
+  // forceoff and notsupported can't be changed
+  const std::string smt_control = read_line(smtPath());
+  smt = smt_control == "on" ? 1 : smt_control == "off" ? 0 : -1;
+  const std::string boost_value = read_line(boostPath());
+  boost = boost_value == "1" ? 1 : boost_value == "0" ? 0 : -1;
+
+  pstate_status = read_line(pstatePath());
+  if (pstate_status == "disable") pstate_status.clear();
+  // the driver takes these, it doesn't list them
+  pstate_statuses.clear();
+  if (!pstate_status.empty()) pstate_statuses = { "active", "passive", "guided" };
+  freq.assign(cpus.size(), {});
+  for (size_t i = 0; i < cpus.size(); ++i) {
+    readFreq(i);
+  }
+
+  // every CPU shares the same cpufreq driver, ask the first online one
+  const int cpu = firstOnline();
+  if (cpu < 0) return;
+  const auto cpufreq = std::get<0>(cpus[cpu]) / "cpufreq";
+  scaling_governor = read_line(cpufreq / "scaling_governor");
+  scaling_available_governors = read_words(cpufreq / "scaling_available_governors");
+  epp = read_line(cpufreq / "energy_performance_preference");
+  epp_available_options = read_words(cpufreq / "energy_performance_available_preferences");
+}
+
+void CPUState::readFreq(int cpu) {
+  if (static_cast<size_t>(cpu) >= freq.size()) freq.resize(cpus.size());
+  CpuFreq & f = freq[cpu];
+  f = {};
+  if (!std::get<1>(cpus[cpu])) return;
+  const auto cpufreq = std::get<0>(cpus[cpu]) / "cpufreq";
+  f.min_khz = read_int(cpufreq / "cpuinfo_min_freq");
+  f.max_khz = read_int(cpufreq / "cpuinfo_max_freq");
+  f.scaling_min_khz = read_int(cpufreq / "scaling_min_freq");
+  f.scaling_max_khz = read_int(cpufreq / "scaling_max_freq");
+  if (pstate_status.empty()) return;
+  f.highest_perf = read_int(cpufreq / "amd_pstate_highest_perf");
+  f.ranking = read_int(cpufreq / "amd_pstate_prefcore_ranking");
+}
+
+std::vector<SysfsWriter::Failure> CPUState::write(const std::string & attribute, const std::string & option, SysfsWriter & writer) const {
+  TRACE_SPAN("cpu_write");
+  std::vector<std::filesystem::path> paths;
+  std::vector<size_t> index;
+  for (size_t i = 0; i < cpus.size(); ++i) {
+    const auto & [path, online] = cpus[i];
+    if (!online) continue;
+    paths.push_back(path / "cpufreq" / attribute);
+    index.push_back(i);
+  }
+  auto failures = writer.apply(paths, option);
+  for (auto & failure : failures) {
+    failure.index = index[failure.index];
+  }
+  return failures;
+}
+
+std::vector<SysfsWriter::Failure> CPUState::setScalingGovernor(const std::string & option, SysfsWriter & writer) {
+  auto failures = write("scaling_governor", option, writer);
+  // read back by the writer, no need to scan again
+  if (!failed(failures, firstOnline())) scaling_governor = option;
+  return failures;
+}
+
+std::vector<SysfsWriter::Failure> CPUState::setEPP(const std::string & option, SysfsWriter & writer) {
+  auto failures = write("energy_performance_preference", option, writer);
+  if (!failed(failures, firstOnline())) epp = option;
+  return failures;
+}
+
+bool CPUState::setSmt(bool enabled, SysfsWriter & writer) {
+  const bool ok = writer.apply({ smtPath() }, enabled ? "on" : "off").empty();
+  if (ok) smt = enabled;
+  // the siblings are on or offline now, don't wait for the uevents
+  for (size_t i = 0; i < cpus.size(); ++i) {
+    hotplug(i);
+  }
+  return ok;
+}
+
+bool CPUState::setBoost(bool enabled, SysfsWriter & writer) {
+  const bool ok = writer.apply({ boostPath() }, enabled ? "1" : "0").empty();
+  if (ok) boost = enabled;
+  return ok;
+}
+
+bool CPUState::setPstateStatus(const std::string & status, SysfsWriter & writer) {
+  TRACE_SPAN("cpu_pstate_status");
+  if (pstate_status.empty()) return false;
+  const bool ok = writer.apply({ pstatePath() }, status).empty();
+  // the cpufreq files went away with the old policies
+  writer.reset();
+  readOptions();
+  return ok;
+}
+
+std::vector<SysfsWriter::Failure> CPUState::setFreqRange(const std::vector<int> & targets, int min_khz, int max_khz, SysfsWriter & writer) {
+  TRACE_SPAN("cpu_freq_range");
+  // the kernel refuses a minimum above the maximum, so the maximum goes
+  // first where the range moves up past it. Clamped per CPU, preferred
+  // cores go higher than the rest, so the values are grouped.
+  struct Step {
+    const char * attribute;
+    std::map<int, std::vector<int>> cpus_by_value;
+  };
+  Step steps[] = { { "scaling_max_freq", {} }, { "scaling_min_freq", {} }, { "scaling_max_freq", {} } };
+  for (int cpu : targets) {
+    if (cpu < 0 || static_cast<size_t>(cpu) >= cpus.size() || !std::get<1>(cpus[cpu])) continue;
+    const CpuFreq & f = freq[cpu];
+    if (f.min_khz < 0 || f.max_khz < 0) continue;
+    const int hi = std::clamp(max_khz, f.min_khz, f.max_khz);
+    const int lo = std::clamp(min_khz, f.min_khz, hi);
+    if (lo > f.scaling_max_khz) steps[0].cpus_by_value[hi].push_back(cpu);
+    steps[1].cpus_by_value[lo].push_back(cpu);
+    steps[2].cpus_by_value[hi].push_back(cpu);
+  }
+  std::vector<SysfsWriter::Failure> failures;
+  for (const auto & step : steps) {
+    for (const auto & [value, group] : step.cpus_by_value) {
+      std::vector<std::filesystem::path> paths;
+      for (int cpu : group) {
+        paths.push_back(std::get<0>(cpus[cpu]) / "cpufreq" / step.attribute);
       }
-      scaling_available_governors.push_back(ss.str());
-      std::cout << "governor: " << scaling_available_governors.back() << std::endl;
-      while (isspace(input.peek())) input.get();
-      if (input.eof()) break;
+      for (auto failure : writer.apply(paths, std::to_string(value))) {
+        failure.index = group[failure.index];
+        failures.push_back(failure);
+      }
+    }
+  }
+  for (int cpu : targets) {
+    if (cpu >= 0 && static_cast<size_t>(cpu) < cpus.size()) readFreq(cpu);
+  }
+  return failures;
+}
+
+std::vector<int> CPUState::physicalCores() const {
+  std::vector<std::pair<std::pair<int, int>, int>> cores;
+  for (size_t i = 0; i < cpus.size(); ++i) {
+    if (!std::get<1>(cpus[i])) continue;
+    const auto & topo = i < topology.size() ? topology.cpus[i] : CpuTopology::Cpu{};
+    const auto key = topo.core < 0 ? std::make_pair(-1, static_cast<int>(i)) : std::make_pair(topo.package, topo.core);
+    if (std::none_of(cores.begin(), cores.end(), [&](const auto & core) { return core.first == key; })) {
+      cores.push_back({ key, static_cast<int>(i) });
     }
   }
+  std::sort(cores.begin(), cores.end());
+  std::vector<int> result;
+  for (const auto & core : cores) result.push_back(core.second);
+  return result;
+}
 
-  // get current epp
-  if (auto epp_option = cpu0freq / "energy_performance_preference"; std::filesystem::exists(epp_option)) {
-    char option[64];
-    std::ifstream input (epp_option);
-    input.getline(option, 64);
-    epp = option;
-    std::cout << "epp: " << epp << std::endl;
-  }
-
-  // get epp options
-  if (auto epp_options = cpu0freq / "energy_performance_available_preferences"; std::filesystem::exists(epp_options)) {
-    epp_available_options.clear();
-    std::ifstream input (epp_options);
-    while (input){
-      std::stringstream ss;
-      char c = input.get();
-      while (!isspace(c)) {
-        ss << c;
-        c = input.get();
+std::vector<int> CPUState::curveCoreIds() const {
+  const auto cores = physicalCores();
+  std::vector<int> ccxs;
+  for (int cpu : cores) {
+    const int ccx = static_cast<size_t>(cpu) < topology.size() ? topology.cpus[cpu].ccx : -1;
+    if (std::find(ccxs.begin(), ccxs.end(), ccx) == ccxs.end()) ccxs.push_back(ccx);
+  }
+  if (ccxs.size() > 1) return {};
+  std::vector<int> result;
+  for (size_t i = 0; i < cores.size(); ++i) result.push_back(i);
+  return result;
+}
+
+std::vector<int> CPUState::preferredCpus(int cores) const {
+  std::vector<int> online;
+  for (size_t i = 0; i < cpus.size(); ++i) {
+    if (std::get<1>(cpus[i])) online.push_back(i);
+  }
+  auto rank = [&](int cpu) { return freq[cpu].ranking >= 0 ? freq[cpu].ranking : freq[cpu].highest_perf; };
+  // stable, equal ranks keep the CPU order
+  std::stable_sort(online.begin(), online.end(), [&](int a, int b) { return rank(a) > rank(b); });
+  std::vector<int> result;
+  std::vector<bool> taken (cpus.size(), false);
+  for (int cpu : online) {
+    if (taken[cpu]) continue;
+    if (cores-- <= 0) break;
+    for (int sibling : topology.siblings(cpu)) {
+      if (static_cast<size_t>(sibling) < cpus.size() && std::get<1>(cpus[sibling]) && !taken[sibling]) {
+        taken[sibling] = true;
+        result.push_back(sibling);
       }
-      epp_available_options.push_back(ss.str());
-      std::cout << "epp option: " << epp_available_options.back() << std::endl;
-      while (isspace(input.peek())) input.get();
-      if (input.eof()) break;
+    }
+    // the topology isn't read by initOnline()
+    if (!taken[cpu]) {
+      taken[cpu] = true;
+      result.push_back(cpu);
     }
   }
+  return result;
 }
 
-void CPUState::setScalingGovernor(const std::string & option) {
-  for (auto [path, online] : cpus) {
-    if (!online) continue;
-    std::ofstream output (path / "cpufreq" / "scaling_governor", std::ios::out | std::ios::trunc);
-    output << option << std::endl;
+RyzenState::RyzenState() : RyzenState(std::make_unique<RyzenAdjBackend>()) {}
+
+RyzenState::RyzenState(std::unique_ptr<PowerBackend> backend) : RyzenTelemetry{}, on_max_perf(false), _backend(std::move(backend)) {}
+
+RyzenState::~RyzenState() = default;
+
+void RyzenState::tick(MetricMask metrics) {
+  TRACE_SPAN("tick");
+  std::lock_guard<std::mutex> guard(_smu_lock);
+  // ticks are rate limited already
+  _limits.flush(*_backend, monotonicNs(), true);
+  _backend->read(*this, metrics | LimitCache::METRICS);
+  _limits.observe(*this);
+}
+
+bool RyzenState::setTdp(int tdp, bool now) {
+    std::lock_guard<std::mutex> guard(_smu_lock);
+    uint32_t mw = tdp * 1000;
+    uint32_t fast = (tdp + 2) * 1000;
+    _limits.request({ mw, fast, mw, mw });
+    return _limits.flush(*_backend, monotonicNs(), now);
+}
+
+LimitCache::Limits RyzenState::limits() {
+  // tick() writes them on the sampler's thread
+  std::lock_guard<std::mutex> guard(_smu_lock);
+  auto mw = [](int w) { return static_cast<uint32_t>(std::max(0, w)) * 1000; };
+  return { mw(stapm_limit), mw(stapm_fast_limit), mw(stapm_slow_limit), mw(apu_slow_limit) };
+}
+
+bool RyzenState::setLimits(const LimitCache::Limits & limits, bool now) {
+  std::lock_guard<std::mutex> guard(_smu_lock);
+  _limits.request(limits);
+  return _limits.flush(*_backend, monotonicNs(), now);
+}
+
+bool RyzenState::limitsHeld() {
+  std::lock_guard<std::mutex> guard(_smu_lock);
+  return _limits.held(*this);
+}
+
+bool RyzenState::restoreLimits() {
+  TRACE_SPAN("ryzen_restore_limits");
+  std::lock_guard<std::mutex> guard(_smu_lock);
+  return _limits.rewrite(*_backend, monotonicNs());
+}
+
+bool RyzenState::setCurve(const std::vector<int> & offsets, const std::vector<int> & ids) {
+  TRACE_SPAN("ryzen_set_curve");
+  if (offsets.empty()) return true;
+  std::lock_guard<std::mutex> guard(_smu_lock);
+  if (std::all_of(offsets.begin(), offsets.end(), [&](int offset) { return offset == offsets.front(); })) {
+    return _backend->setCurveAll(offsets.front()) == 0;
+  }
+  if (ids.size() < offsets.size()) return false;
+  bool ok = true;
+  for (size_t core = 0; core < offsets.size(); ++core) {
+    ok &= _backend->setCurveCore(ids[core], offsets[core]) == 0;
   }
+  return ok;
 }
 
-void CPUState::setEPP(const std::string & option) {
-  for (auto [path, online] : cpus) {
-    if (!online) continue;
-    std::ofstream output (path / "cpufreq" / "energy_performance_preference", std::ios::out | std::ios::trunc);
-    output << option << std::endl;
-  }
-}
-
-RyzenState::RyzenState() {
-  _ryzen = init_ryzenadj();
-  if(!_ryzen){
-    throw "Unable to init ryzenadj";
-  }
-  init_table(_ryzen);
-}
-
-RyzenState::~RyzenState() {
-  cleanup_ryzenadj(_ryzen);
-}
-
-void RyzenState::tick() {
-  refresh_table(_ryzen);
-  stapm_limit = get_stapm_limit(_ryzen);
-  stapm_fast_limit = get_fast_limit(_ryzen);
-  stapm_slow_limit = get_slow_limit(_ryzen);
-  apu_slow_limit = get_apu_slow_limit(_ryzen);
-  stapm_value = get_stapm_value(_ryzen);
-  stapm_fast_value = get_fast_value(_ryzen);
-  stapm_slow_value = get_slow_value(_ryzen);
-  apu_slow_value = get_apu_slow_value(_ryzen);
-  stapm_time = get_stapm_time(_ryzen);
-  stapm_slow_time = get_slow_time(_ryzen);
-  vrm_limit = get_vrm_current(_ryzen);
-  vrm_value = get_vrm_current_value(_ryzen);
-  vrm_soc_limit = get_vrmsoc_current(_ryzen);
-  vrm_soc_value = get_vrmsoc_current_value(_ryzen);
-  vrm_max_limit = get_vrmmax_current(_ryzen);
-  vrm_max_value = get_vrmmax_current_value(_ryzen);
-  vrm_soc_max_limit = get_vrmsocmax_current(_ryzen);
-  vrm_soc_max_value = get_vrmsocmax_current_value(_ryzen);
-  core_temp_limit = get_tctl_temp(_ryzen);
-  core_temp_value = get_tctl_temp_value(_ryzen);
-  apu_skin_temp_limit = get_apu_skin_temp_limit(_ryzen);
-  apu_skin_temp_value = get_apu_skin_temp_value(_ryzen);
-  dgpu_skin_temp_limit = get_dgpu_skin_temp_limit(_ryzen);
-  dgpu_skin_temp_value = get_dgpu_skin_temp_value(_ryzen);
-  cclk_setpoint = get_cclk_setpoint(_ryzen);
-  cclk_busy_value = get_cclk_busy_value(_ryzen);
-}
-
-void RyzenState::setTdp(int tdp) {
-    int fast = tdp + 2;
-    set_stapm_limit(_ryzen, tdp * 1000);
-    set_fast_limit(_ryzen, fast * 1000);
-    set_slow_limit(_ryzen, tdp * 1000);
-    set_apu_slow_limit(_ryzen, tdp * 1000);
+SmuStats RyzenState::smuStats() {
+  std::lock_guard<std::mutex> guard(_smu_lock);
+  return _limits.stats();
+}
+
+int RyzenState::getFamily() const {
+    return _backend->family();
 }
 
 const char * RyzenState::getFamilyName() const {
-    return family_name(get_cpu_family(_ryzen));
+    return familyName(getFamily());
 }
 
 void RyzenState::toggleMaxPerf() {
+  std::lock_guard<std::mutex> guard(_smu_lock);
   on_max_perf = !on_max_perf;
   if (on_max_perf) {
-    set_max_performance(_ryzen);
+    _backend->setMaxPerformance();
   } else {
-    set_power_saving(_ryzen);
+    _backend->setPowerSaving();
   }
 }
 
@@ -24,67 +24,141 @@
 #include <string>
 #include <cstdint>
 #include <cstddef>
+#include <memory>
+#include <mutex>
 
-#include "ryzenadj.h"
+#include "limit_cache.h"
+#include "metrics.h"
+#include "sysfs_writer.h"
+#include "topology.h"
 
 namespace cpu_utils {
 
+// family id reported by the simulated backend, outside ryzen_family
+constexpr int FAM_SIMULATED = 0x100;
+
+const char * familyName(int family);
+
+struct PowerBackend;
+
+// Frequency range of a CPU and the CPPC values amd-pstate ranks cores by,
+// -1 where the driver doesn't have them
+struct CpuFreq {
+  int min_khz = -1;          // cpuinfo_min_freq
+  int max_khz = -1;          // cpuinfo_max_freq
+  int scaling_min_khz = -1;
+  int scaling_max_khz = -1;
+  int highest_perf = -1;     // amd_pstate_highest_perf
+  int ranking = -1;          // amd_pstate_prefcore_ranking, higher is faster
+};
+
 struct CPUState {
 
+  // builds the topology and reads the cpufreq options, once
   void init();
-  void setScalingGovernor(const std::string &);
-  void setEPP(const std::string &);
+  // only the online CPUs and their options, without the topology, for
+  // one-shot use
+  void initOnline();
+  // re-reads one CPU after a hotplug event, returns true if it changed
+  bool hotplug(int cpu);
+  // write the option to every online CPU, failures are indexed by CPU number
+  std::vector<SysfsWriter::Failure> setScalingGovernor(const std::string &, SysfsWriter & writer);
+  std::vector<SysfsWriter::Failure> setEPP(const std::string &, SysfsWriter & writer);
+  // these also refresh the CPUs that went on or offline
+  bool setSmt(bool enabled, SysfsWriter & writer);
+  bool setBoost(bool enabled, SysfsWriter & writer);
+  // the cpufreq policies are rebuilt, so are the options and freq
+  bool setPstateStatus(const std::string & status, SysfsWriter & writer);
+  // of the given online CPUs, clamped to what each supports
+  std::vector<SysfsWriter::Failure> setFreqRange(const std::vector<int> & cpus, int min_khz, int max_khz, SysfsWriter & writer);
+  // the online CPUs of the best cores by prefcore ranking, or highest perf
+  // without it, SMT siblings included, best first
+  std::vector<int> preferredCpus(int cores) const;
+  // a logical CPU per physical core, the first online one, in core order as
+  // the Curve Optimizer counts them. Every CPU without the topology.
+  std::vector<int> physicalCores() const;
+  // the SMU's per-core Curve Optimizer ID for each of physicalCores(), the
+  // core's place within its CCX. Empty when there is more than one CCX, the
+  // IDs then also carry the CCD and CCX numbers the topology doesn't give.
+  std::vector<int> curveCoreIds() const;
 
+  // indexed by CPU number, path and online
   std::vector<std::tuple<std::filesystem::path, bool>> cpus;
+  CpuTopology topology;
   std::string scaling_governor;
   std::vector<std::string> scaling_available_governors;
   std::string epp;
   std::vector<std::string> epp_available_options;
-  
+  // 0 or 1, -1 if it can't be changed
+  int smt = -1;
+  int boost = -1;
+  // indexed by CPU number, kept for online CPUs
+  std::vector<CpuFreq> freq;
+  // active, passive or guided, empty without amd-pstate
+  std::string pstate_status;
+  std::vector<std::string> pstate_statuses;
+
+  // everything is read below here, point it at a fake tree for testing
+  std::filesystem::path sysfs_root { "/sys" };
+
+private:
+  int firstOnline() const;
+  void readOptions();
+  void readFreq(int cpu);
+  std::filesystem::path pstatePath() const;
+  std::filesystem::path smtPath() const;
+  std::filesystem::path boostPath() const;
+  std::vector<SysfsWriter::Failure> write(const std::string & attribute, const std::string & option, SysfsWriter & writer) const;
 };
 
-struct RyzenState {
+// Plain copy of everything RyzenState reads from the PM table, so it can be
+// handed across threads without touching the SMU.
+struct RyzenTelemetry {
+#define X(ID, field, type, ...) type field;
+  RYZEN_METRICS(X)
+#undef X
+};
+
+// tick() and the setters may be called from different threads, calls into
+// ryzenadj are serialised internally.
+struct RyzenState : RyzenTelemetry {
+  // talks to the hardware through ryzenadj
   RyzenState();
+  RyzenState(std::unique_ptr<PowerBackend> backend);
 
   ~RyzenState();
 
-  void tick();
+  // refreshes the metrics in the mask, and the limits LimitCache watches,
+  // the rest keep their last value
+  void tick(MetricMask metrics = ALL_METRICS);
 
-  void setTdp(int tdp);
+  // Queued in a LimitCache and written at most every
+  // LimitCache::MIN_INTERVAL_NS, or with the next tick() if that comes
+  // first. now skips the wait. False if the SMU refused a limit.
+  bool setTdp(int tdp, bool now = false);
+  // the four limits as read by the last tick(), and setting them as they
+  // are, e.g. to put back what was there before
+  LimitCache::Limits limits();
+  bool setLimits(const LimitCache::Limits & limits, bool now = false);
+  // For after a resume or a firmware reset: whether the limits read by
+  // the last tick() are still the ones set, and writing all of them again.
+  bool limitsHeld();
+  bool restoreLimits();
+  // Curve Optimizer offset per physical core, one message for all of them
+  // when they are equal. False if the SMU refused one.
+  // ids from CPUState::curveCoreIds(), differing offsets fail without them
+  bool setCurve(const std::vector<int> & offsets, const std::vector<int> & ids);
+  SmuStats smuStats();
   void toggleMaxPerf();
 
+  int getFamily() const;
   const char * getFamilyName() const;
 
-  int stapm_limit;
-  int stapm_fast_limit;
-  int stapm_slow_limit;
-  int apu_slow_limit;
-  float stapm_value;
-  float stapm_fast_value;
-  float stapm_slow_value;
-  float apu_slow_value;
-  float stapm_time;
-  float stapm_slow_time;
-  float vrm_limit;
-  float vrm_value;
-  float vrm_soc_limit;
-  float vrm_soc_value;
-  float vrm_max_limit;
-  float vrm_max_value;
-  float vrm_soc_max_limit;
-  float vrm_soc_max_value;
-  float core_temp_limit;
-  float core_temp_value;
-  float apu_skin_temp_limit;
-  float apu_skin_temp_value;
-  float dgpu_skin_temp_limit;
-  float dgpu_skin_temp_value;
-  float cclk_setpoint;
-  float cclk_busy_value;
-
   bool on_max_perf;
 
 private:
-  ryzen_access _ryzen;
+  std::unique_ptr<PowerBackend> _backend;
+  std::mutex _smu_lock;
+  LimitCache _limits;
 };
 }
@@ -0,0 +1,390 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "curve.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "tuner.h"
+
+// per chunk, 64 KB of vectors rotated this many times, a few hundred
+// microseconds
+#define STRESS_VECTORS 2048
+#define STRESS_ROUNDS 64
+
+namespace cpu_utils {
+
+namespace {
+
+typedef float v8f __attribute__((vector_size(32)));
+
+// aligned for the vector loads, a std::vector of v8f only gets the default
+// alignment
+struct StressBuffer {
+  alignas(64) v8f vectors[STRESS_VECTORS];
+};
+
+// Fills the buffer from its index, rotates each pair of vectors by a
+// fixed angle, and hashes the bits. The rotation keeps the values in
+// range, so the result only depends on the math being done right.
+#if defined(__x86_64__)
+__attribute__((target_clones("fma", "default")))
+#endif
+static uint64_t stress_chunk(StressBuffer & stress, int rounds)
+{
+  v8f * buffer = stress.vectors;
+  const size_t count = STRESS_VECTORS;
+  for (size_t i = 0; i < count; ++i) {
+    for (int lane = 0; lane < 8; ++lane) {
+      buffer[i][lane] = static_cast<float>((i * 8 + lane) % 997) * 0.001f + 0.5f;
+    }
+  }
+  const v8f c = v8f{} + 0.9998f;
+  const v8f s = v8f{} + 0.0199987f;
+  for (int r = 0; r < rounds; ++r) {
+    for (size_t i = 0; i + 1 < count; i += 2) {
+      const v8f x = buffer[i], y = buffer[i + 1];
+      buffer[i] = x * c - y * s;
+      buffer[i + 1] = x * s + y * c;
+    }
+  }
+  // FNV-1a over the bits
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < count; ++i) {
+    uint32_t bits[8];
+    memcpy(bits, &buffer[i], sizeof(bits));
+    for (uint32_t b : bits) {
+      hash = (hash ^ b) * 1099511628211ull;
+    }
+  }
+  return hash;
+}
+
+// how far below 0 a core of the simulated chip stays stable, -12 to -34
+static int simulated_limit(unsigned seed, size_t core)
+{
+  uint32_t x = seed * 2654435761u + core * 40503u + 1;
+  x ^= x >> 15;
+  x *= 2246822519u;
+  x ^= x >> 13;
+  return -12 - static_cast<int>(x % 23);
+}
+
+static std::string join(const std::vector<int> & values)
+{
+  std::string text;
+  for (int value : values) {
+    if (!text.empty()) text += ' ';
+    text += std::to_string(value);
+  }
+  return text;
+}
+
+static std::vector<int> split(std::istream & input)
+{
+  std::vector<int> values;
+  int value;
+  while (input >> value) values.push_back(value);
+  return values;
+}
+
+// runs the cleanup however the scope is left
+template <typename F>
+struct ScopeGuard {
+  explicit ScopeGuard(F cleanup) : _cleanup(cleanup) {}
+
+  ~ScopeGuard() {
+    _cleanup();
+  }
+
+  F _cleanup;
+};
+
+}
+
+KernelStress::KernelStress() {
+  auto buffer = std::make_unique<StressBuffer>();
+  _golden = stress_chunk(*buffer, STRESS_ROUNDS);
+}
+
+KernelStress::~KernelStress() {
+  stop();
+}
+
+void KernelStress::start(const std::vector<int> & cpus, const std::vector<int> &) {
+  if (_running.exchange(true)) return;
+  _cpus = cpus;
+  _workers = std::make_unique<Worker[]>(_cpus.size());
+  for (size_t i = 0; i < _cpus.size(); ++i) {
+    _threads.emplace_back(&KernelStress::run, this, i, _cpus[i]);
+  }
+}
+
+std::vector<bool> KernelStress::stop() {
+  _running = false;
+  for (auto & thread : _threads) {
+    thread.join();
+  }
+  _threads.clear();
+  std::vector<bool> failed (_cpus.size());
+  for (size_t i = 0; i < _cpus.size(); ++i) {
+    // a worker that never finished a chunk proves nothing either way
+    failed[i] = _workers[i].failed.load() || _workers[i].chunks.load() == 0;
+  }
+  return failed;
+}
+
+double KernelStress::wait(double dt) {
+  using clock = std::chrono::steady_clock;
+  const auto start = clock::now();
+  std::this_thread::sleep_for(std::chrono::duration<double>(dt));
+  return std::chrono::duration<double>(clock::now() - start).count();
+}
+
+void KernelStress::run(size_t index, int cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  auto buffer = std::make_unique<StressBuffer>();
+  while (_running.load(std::memory_order_relaxed)) {
+    if (stress_chunk(*buffer, STRESS_ROUNDS) != _golden) {
+      _workers[index].failed.store(true, std::memory_order_relaxed);
+    }
+    _workers[index].chunks.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+SimulatedStress::SimulatedStress(unsigned seed) : _seed(seed) {}
+
+void SimulatedStress::start(const std::vector<int> & cpus, const std::vector<int> & offsets) {
+  _failed.assign(cpus.size(), false);
+  for (size_t core = 0; core < cpus.size() && core < offsets.size(); ++core) {
+    _failed[core] = offsets[core] < simulated_limit(_seed, core);
+  }
+}
+
+std::vector<bool> SimulatedStress::stop() {
+  return _failed;
+}
+
+double SimulatedStress::wait(double dt) {
+  return dt;
+}
+
+void runCurveSearch(RyzenState & rs, CPUState & cs, StressLoad & stress, SysfsWriter & writer,
+                    const CurveSettings & settings, CurveProfile & profile,
+                    const std::function<void(const CurveProfile &)> & checkpoint,
+                    const std::function<void(const std::vector<int> &, const std::vector<bool> &)> & progress) {
+  constexpr MetricMask metrics = metricBit(CH_STAPM_FAST_VALUE);
+  const std::vector<int> cores = cs.physicalCores();
+  if (cores.empty()) throw "No online cores to search";
+  if (profile.offsets.size() != cores.size()) {
+    profile.offsets.assign(cores.size(), 0);
+    profile.testing.clear();
+  }
+
+  std::vector<bool> done (cores.size(), false);
+  // without per-core IDs the SMU takes one offset for all cores, so they
+  // step, fail and back off together
+  const std::vector<int> ids = cs.curveCoreIds();
+  auto together = [&] {
+    if (!ids.empty()) return;
+    const int offset = *std::max_element(profile.offsets.begin(), profile.offsets.end());
+    const bool stop = std::find(done.begin(), done.end(), true) != done.end();
+    profile.offsets.assign(cores.size(), offset);
+    done.assign(cores.size(), stop);
+  };
+  // the cores that moved in a step that never finished, any of them may
+  // have taken the machine down
+  if (profile.testing.size() == cores.size()) {
+    for (size_t core = 0; core < cores.size(); ++core) {
+      if (profile.testing[core] == profile.offsets[core]) continue;
+      profile.offsets[core] = std::min(0, profile.offsets[core] + settings.margin);
+      done[core] = true;
+    }
+  }
+  profile.testing.clear();
+  together();
+  checkpoint(profile);
+
+  // Both measurements hold every core at the same clock, low enough that
+  // the TDP limit doesn't pull it down, so only the voltage differs.
+  std::vector<int> online;
+  int clock = 0;
+  for (size_t cpu = 0; cpu < cs.cpus.size(); ++cpu) {
+    if (!std::get<1>(cs.cpus[cpu])) continue;
+    online.push_back(cpu);
+    const int max = cpu < cs.freq.size() ? cs.freq[cpu].max_khz : -1;
+    if (max > 0 && (clock == 0 || max < clock)) clock = max;
+  }
+  clock = clock / 4 * 3 / 1000 * 1000;
+  std::vector<CpuFreq> ranges = cs.freq;
+  auto restore_ranges = [&] {
+    if (clock <= 0) return;
+    for (int cpu : online) {
+      const auto & range = ranges[cpu];
+      if (range.scaling_min_khz > 0 && range.scaling_max_khz > 0) {
+        cs.setFreqRange({ cpu }, range.scaling_min_khz, range.scaling_max_khz, writer);
+      }
+    }
+  };
+  auto measure = [&](const std::vector<int> & offsets) {
+    if (!rs.setCurve(offsets, ids)) {
+      throw "The SMU refused a curve offset";
+    }
+    ScopeGuard unpin (restore_ranges);
+    if (clock > 0) cs.setFreqRange(online, clock, clock, writer);
+    stress.start(cores, offsets);
+    double waited = 0, power = 0;
+    int samples = 0;
+    while (waited < settings.settle_s + settings.measure_s) {
+      waited += stress.wait(settings.tick_s);
+      rs.tick(metrics);
+      if (waited < settings.settle_s) continue;
+      power += rs.stapm_fast_value;
+      ++samples;
+    }
+    const auto failed = stress.stop();
+    return std::make_pair(samples ? power / samples : 0.0, failed);
+  };
+
+  // any way out but the end leaves the last stable offsets in
+  try {
+    const auto base = measure(std::vector<int>(cores.size(), 0));
+    if (std::find(base.second.begin(), base.second.end(), true) != base.second.end()) {
+      throw "The stress check fails without any offset";
+    }
+    profile.base_w = base.first;
+    profile.freq_khz = clock;
+
+    for (size_t core = 0; core < cores.size(); ++core) {
+      if (profile.offsets[core] <= settings.limit) done[core] = true;
+    }
+    together();
+    while (std::find(done.begin(), done.end(), false) != done.end()) {
+      std::vector<int> next = profile.offsets;
+      for (size_t core = 0; core < cores.size(); ++core) {
+        if (!done[core]) next[core] = std::max(settings.limit, next[core] - settings.step);
+      }
+      profile.testing = next;
+      checkpoint(profile);
+      if (!rs.setCurve(next, ids)) {
+        throw "The SMU refused a curve offset";
+      }
+      stress.start(cores, next);
+      double waited = 0;
+      while (waited < settings.test_s) {
+        waited += stress.wait(settings.tick_s);
+        rs.tick(metrics);
+      }
+      const auto failed = stress.stop();
+      if (progress) progress(next, failed);
+      for (size_t core = 0; core < cores.size(); ++core) {
+        if (done[core]) continue;
+        if (failed[core]) {
+          profile.offsets[core] = std::min(0, profile.offsets[core] + settings.margin);
+          done[core] = true;
+        } else {
+          profile.offsets[core] = next[core];
+          done[core] = next[core] <= settings.limit;
+        }
+      }
+      together();
+      profile.testing.clear();
+      checkpoint(profile);
+    }
+
+    profile.tuned_w = measure(profile.offsets).first;
+    checkpoint(profile);
+  } catch (...) {
+    rs.setCurve(profile.offsets, ids);
+    throw;
+  }
+}
+
+std::filesystem::path curvePath(const std::string & device) {
+  return devicePath("curve", device);
+}
+
+bool loadCurve(const std::filesystem::path & path, CurveProfile & profile) {
+  std::ifstream input (path);
+  if (!input) return false;
+  CurveProfile loaded;
+  std::string line;
+  while (std::getline(input, line)) {
+    std::istringstream fields (line);
+    std::string key;
+    if (!(fields >> key) || key[0] == '#') continue;
+    if (key == "offsets") {
+      loaded.offsets = split(fields);
+    } else if (key == "testing") {
+      loaded.testing = split(fields);
+    } else if (key == "base_w") {
+      fields >> loaded.base_w;
+    } else if (key == "tuned_w") {
+      fields >> loaded.tuned_w;
+    } else if (key == "freq_khz") {
+      fields >> loaded.freq_khz;
+    }
+  }
+  if (loaded.offsets.empty()) return false;
+  for (int offset : loaded.offsets) {
+    if (offset < -30 || offset > 30) return false;
+  }
+  profile = loaded;
+  return true;
+}
+
+void saveCurve(const std::filesystem::path & path, const std::string & device, const CurveProfile & profile) {
+  std::error_code ec;
+  if (path.has_parent_path()) std::filesystem::create_directories(path.parent_path(), ec);
+  // written next to it, renamed and synced, the step being tested has to
+  // be on disk before it can hang the machine
+  auto temp = path;
+  temp += ".new";
+  {
+    std::ofstream out (temp);
+    out << "# " << device << '\n'
+        << "offsets " << join(profile.offsets) << '\n';
+    if (!profile.testing.empty()) out << "testing " << join(profile.testing) << '\n';
+    out << "base_w " << profile.base_w << '\n'
+        << "tuned_w " << profile.tuned_w << '\n'
+        << "freq_khz " << profile.freq_khz << '\n';
+    out.flush();
+    if (!out) {
+      throw "Unable to write the curve file";
+    }
+  }
+  std::filesystem::rename(temp, path, ec);
+  if (ec) {
+    throw "Unable to write the curve file";
+  }
+  sync();
+}
+
+}
@@ -0,0 +1,124 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cpu_utils.h"
+#include "sysfs_writer.h"
+
+namespace cpu_utils {
+
+// What a Curve Optimizer step is validated with, a worker on each of the
+// CPUs passed to start(), one per physical core.
+struct StressLoad {
+  virtual ~StressLoad() = default;
+
+  // offsets are the ones in effect, by core
+  virtual void start(const std::vector<int> & cpus, const std::vector<int> & offsets) = 0;
+  // true for the workers that got a wrong result since start()
+  virtual std::vector<bool> stop() = 0;
+  // lets about dt seconds of load pass, returns how many did
+  virtual double wait(double dt) = 0;
+};
+
+// Rotates a 64 KB buffer per thread with AVX-width float math, over and
+// over, and checks its hash against one computed before any offset went
+// in. An unstable core gets a bit wrong long before it hangs.
+struct KernelStress : StressLoad {
+  KernelStress();
+
+  ~KernelStress();
+
+  void start(const std::vector<int> & cpus, const std::vector<int> & offsets) override;
+  std::vector<bool> stop() override;
+  double wait(double dt) override;
+
+private:
+  struct alignas(64) Worker {
+    std::atomic<bool> failed { false };
+    std::atomic<uint64_t> chunks { 0 };
+  };
+
+  void run(size_t index, int cpu);
+
+  uint64_t _golden;
+  std::vector<int> _cpus;
+  std::unique_ptr<Worker[]> _workers;
+  std::atomic<bool> _running { false };
+  std::vector<std::thread> _threads;
+};
+
+// Every core has a hidden limit, made up from the seed, and fails below
+// it. For a SimulatedBackend stepping on its own clock.
+struct SimulatedStress : StressLoad {
+  SimulatedStress(unsigned seed = 1);
+
+  void start(const std::vector<int> & cpus, const std::vector<int> & offsets) override;
+  std::vector<bool> stop() override;
+  double wait(double dt) override;
+
+private:
+  unsigned _seed;
+  std::vector<bool> _failed;
+};
+
+struct CurveSettings {
+  int step = 5;             // offset counts per step
+  int limit = -30;          // deepest offset tried
+  int margin = 2;           // backed off past the last stable step on a failure
+  double test_s = 60;       // stress per step
+  double tick_s = 0.1;      // telemetry interval
+  double settle_s = 5;      // before the power is measured
+  double measure_s = 20;
+};
+
+struct CurveProfile {
+  std::vector<int> offsets;   // stable, by core
+  // written before a step is applied, so a search that took the machine
+  // down knows which step did
+  std::vector<int> testing;
+  double base_w = 0, tuned_w = 0;  // package power under the stress, at equal clocks
+  int freq_khz = 0;                // the clock both were measured at
+};
+
+// Walks the per-core offsets down by step from where profile leaves them,
+// stressing each step, and backs a core off to its last stable offset plus
+// margin once it fails. Cores that were being tested when a previous search
+// crashed are backed off the same way before anything runs. checkpoint gets
+// the profile each time it changes and should save it.
+void runCurveSearch(RyzenState & rs, CPUState & cs, StressLoad & stress, SysfsWriter & writer,
+                    const CurveSettings & settings, CurveProfile & profile,
+                    const std::function<void(const CurveProfile &)> & checkpoint,
+                    const std::function<void(const std::vector<int> &, const std::vector<bool> &)> & progress = {});
+
+// /var/lib/simpletdp/curve-<device>.txt
+std::filesystem::path curvePath(const std::string & device);
+// false if there is no profile or it doesn't parse
+bool loadCurve(const std::filesystem::path & path, CurveProfile & profile);
+// throws if the file can't be written
+void saveCurve(const std::filesystem::path & path, const std::string & device, const CurveProfile & profile);
+
+}
@@ -0,0 +1,166 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "energy.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace cpu_utils {
+
+RunningStats::RunningStats(float lo, float hi) : _lo(lo), _width((hi - lo) / BUCKETS) {}
+
+void RunningStats::push(double x) {
+  if (!std::isfinite(x)) return;
+  ++_n;
+  const double delta = x - _mean;
+  _mean += delta / _n;
+  _m2 += delta * (x - _mean);
+  _min = _n == 1 ? x : std::min(_min, x);
+  _max = _n == 1 ? x : std::max(_max, x);
+  const int bucket = static_cast<int>(std::floor((x - _lo) / _width));
+  ++_hist[std::clamp(bucket, 0, BUCKETS - 1)];
+}
+
+void RunningStats::reset() {
+  _n = 0;
+  _mean = 0;
+  _m2 = 0;
+  _min = 0;
+  _max = 0;
+  _hist.fill(0);
+}
+
+uint64_t RunningStats::count() const {
+  return _n;
+}
+
+double RunningStats::mean() const {
+  return _mean;
+}
+
+double RunningStats::stddev() const {
+  return _n > 1 ? std::sqrt(_m2 / (_n - 1)) : 0;
+}
+
+double RunningStats::min() const {
+  return _min;
+}
+
+double RunningStats::max() const {
+  return _max;
+}
+
+double RunningStats::quantile(double q) const {
+  if (!_n) return 0;
+  const double rank = std::clamp(q, 0.0, 1.0) * _n;
+  double seen = 0;
+  for (int i = 0; i < BUCKETS; ++i) {
+    if (!_hist[i]) continue;
+    if (seen + _hist[i] >= rank) {
+      // spread evenly over the bucket
+      const double x = _lo + _width * (i + (rank - seen) / _hist[i]);
+      return std::clamp(x, _min, _max);
+    }
+    seen += _hist[i];
+  }
+  return _max;
+}
+
+double EnergyAccount::Setting::watts() const {
+  return seconds > 0 ? joules / seconds : 0;
+}
+
+double EnergyAccount::Setting::busy() const {
+  return seconds > 0 ? busy_seconds / seconds : 0;
+}
+
+double EnergyAccount::Setting::busyPerWatt() const {
+  return joules > 0 ? busy_seconds / joules : 0;
+}
+
+EnergyAccount::EnergyAccount() : power(0, 128), busy(0, 100), core_temp(0, 128), skin_temp(0, 128) {}
+
+void EnergyAccount::push(const Snapshot & snap, const std::string & profile) {
+  const RyzenTelemetry & ry = snap.ryzen;
+  // nothing sampled yet
+  if (!snap.timestamp_ns) return;
+  if (_last_ns && snap.timestamp_ns > _last_ns && snap.timestamp_ns - _last_ns <= MAX_GAP_NS) {
+    // trapezoids between samples
+    const double dt = (snap.timestamp_ns - _last_ns) * 1e-9;
+    Setting & last = _settings[_last_setting];
+    last.seconds += dt;
+    last.joules += 0.5 * (_last_power + ry.stapm_fast_value) * dt;
+    last.busy_seconds += 0.5 * (_last_busy + ry.cclk_busy_value) * dt;
+  }
+  _last_ns = snap.timestamp_ns;
+  _last_power = ry.stapm_fast_value;
+  _last_busy = ry.cclk_busy_value;
+  _last_setting = setting(ry.stapm_limit, profile);
+
+  power.push(ry.stapm_fast_value);
+  busy.push(ry.cclk_busy_value);
+  core_temp.push(ry.core_temp_value);
+  skin_temp.push(ry.apu_skin_temp_value);
+}
+
+void EnergyAccount::reset() {
+  _settings.clear();
+  _last_ns = 0;
+  power.reset();
+  busy.reset();
+  core_temp.reset();
+  skin_temp.reset();
+}
+
+double EnergyAccount::seconds() const {
+  double total = 0;
+  for (const auto & s : _settings) total += s.seconds;
+  return total;
+}
+
+double EnergyAccount::joules() const {
+  double total = 0;
+  for (const auto & s : _settings) total += s.joules;
+  return total;
+}
+
+double EnergyAccount::busyPerWatt() const {
+  double busy_seconds = 0;
+  for (const auto & s : _settings) busy_seconds += s.busy_seconds;
+  const double total = joules();
+  return total > 0 ? busy_seconds / total : 0;
+}
+
+const std::vector<EnergyAccount::Setting> & EnergyAccount::settings() const {
+  return _settings;
+}
+
+size_t EnergyAccount::setting(int tdp, const std::string & profile) {
+  // the same as last time, almost always
+  if (_last_setting < _settings.size() && _settings[_last_setting].tdp == tdp && _settings[_last_setting].profile == profile) {
+    return _last_setting;
+  }
+  for (size_t i = 0; i < _settings.size(); ++i) {
+    if (_settings[i].tdp == tdp && _settings[i].profile == profile) return i;
+  }
+  _settings.push_back({ tdp, profile });
+  return _settings.size() - 1;
+}
+
+}
@@ -0,0 +1,116 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "metrics.h"
+#include "sampler.h"
+
+namespace cpu_utils {
+
+// Mean and variance (Welford) plus quantiles of a stream, in constant
+// space. Quantiles come from a fixed histogram over [lo, hi), good to half
+// a bucket, values outside land in the end buckets.
+struct RunningStats {
+  static constexpr int BUCKETS = 256;
+
+  RunningStats(float lo, float hi);
+
+  void push(double x);
+  void reset();
+
+  uint64_t count() const;
+  double mean() const;
+  double stddev() const;
+  double min() const;
+  double max() const;
+  // q in [0, 1]
+  double quantile(double q) const;
+
+private:
+  float _lo;
+  float _width;
+  uint64_t _n = 0;
+  double _mean = 0;
+  double _m2 = 0;
+  double _min = 0;
+  double _max = 0;
+  std::array<uint32_t, BUCKETS> _hist {};
+};
+
+// Energy used over a session: package power integrated over the sample
+// timestamps, split by TDP limit and profile, with running stats of power,
+// clock and temperatures. push() only allocates for a TDP/profile pair it
+// hasn't seen.
+struct EnergyAccount {
+  // what push() reads
+  static constexpr MetricMask METRICS = metricBit(CH_STAPM_LIMIT) | metricBit(CH_STAPM_FAST_VALUE) |
+                                        metricBit(CH_CCLK_BUSY_VALUE) | metricBit(CH_CORE_TEMP_VALUE) |
+                                        metricBit(CH_APU_SKIN_TEMP_VALUE);
+  // longer gaps between samples, a stalled sampler or a fast replay, are
+  // left out of the integral
+  static constexpr uint64_t MAX_GAP_NS = 10000000000ull;
+
+  struct Setting {
+    int tdp;
+    std::string profile;  // empty for manual settings
+    double seconds = 0;
+    double joules = 0;
+    // integral of CCLK busy, for its time weighted mean
+    double busy_seconds = 0;
+
+    double watts() const;
+    double busy() const;
+    // what a setting is tuned for, CCLK busy % per W
+    double busyPerWatt() const;
+  };
+
+  EnergyAccount();
+
+  void push(const Snapshot & snap, const std::string & profile);
+  void reset();
+
+  double seconds() const;
+  double joules() const;
+  double busyPerWatt() const;
+  // in order of first use
+  const std::vector<Setting> & settings() const;
+
+  // per sample, PPT FAST is the package power with the least averaging
+  RunningStats power;
+  RunningStats busy;
+  RunningStats core_temp;
+  RunningStats skin_temp;
+
+private:
+  size_t setting(int tdp, const std::string & profile);
+
+  std::vector<Setting> _settings;
+  // the interval up to the next sample belongs to the previous one's setting
+  uint64_t _last_ns = 0;
+  float _last_power = 0;
+  float _last_busy = 0;
+  size_t _last_setting = 0;
+};
+
+}
@@ -0,0 +1,292 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "exporter.h"
+#include "trace.h"
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace cpu_utils {
+
+namespace {
+
+static const char * unit_name(const char * unit)
+{
+  if (!strcmp(unit, "W")) return "watts";
+  if (!strcmp(unit, "A")) return "amperes";
+  if (!strcmp(unit, "C")) return "celsius";
+  if (!strcmp(unit, "s")) return "seconds";
+  if (!strcmp(unit, "%")) return "percent";
+  return "";
+}
+
+static std::string label_value(const std::string & value)
+{
+  std::string out;
+  for (char c : value) {
+    if (c == '\\' || c == '"') out += '\\';
+    if (c == '\n') {
+      out += "\\n";
+      continue;
+    }
+    out += c;
+  }
+  return out;
+}
+
+}
+
+bool ExporterInfo::operator==(const ExporterInfo & other) const {
+  return rate == other.rate && scaling_governor == other.scaling_governor && epp == other.epp &&
+         tdp_governor.mode == other.tdp_governor.mode && tdp_governor.target == other.tdp_governor.target &&
+         tdp_governor.min_tdp == other.tdp_governor.min_tdp && tdp_governor.max_tdp == other.tdp_governor.max_tdp;
+}
+
+MetricsText::MetricsText(Format format) : _format(format) {
+  layout();
+}
+
+void MetricsText::setInfo(const ExporterInfo & info) {
+  if (info == _info) return;
+  _info = info;
+  layout();
+}
+
+void MetricsText::update(const Snapshot & snap) {
+  for (int ch = 0; ch < CHANNEL_COUNT; ++ch) {
+    put(ch, channelValue(snap.ryzen, ch));
+  }
+  put(SLOT_SEQ, snap.seq);
+  put(SLOT_SMU_REQUESTS, snap.smu.requests);
+  put(SLOT_SMU_COALESCED, snap.smu.coalesced);
+  put(SLOT_SMU_SKIPPED, snap.smu.skipped);
+  put(SLOT_SMU_CALLS, snap.smu.calls);
+}
+
+const char * MetricsText::data() const {
+  return _text.data();
+}
+
+size_t MetricsText::size() const {
+  return _text.size();
+}
+
+void MetricsText::layout() {
+  const bool om = _format == OPENMETRICS;
+  std::string & out = _text;
+  out.clear();
+  // the family header, OpenMetrics names a counter or info family without
+  // the suffix its sample carries
+  auto family = [&](const std::string & name, const char * type, const char * suffix, const char * unit, const char * help) {
+    const std::string family = om ? name : name + suffix;
+    out += "# TYPE " + family + ' ' + (om || strcmp(type, "info") ? type : "gauge") + '\n';
+    if (om && *unit) out += "# UNIT " + family + ' ' + unit + '\n';
+    out += "# HELP " + family + ' ' + help + '\n';
+  };
+  auto sample = [&](int slot, const std::string & name) {
+    out += name + ' ';
+    _offsets[slot] = out.size();
+    out.append(VALUE_WIDTH, '0');
+    out += '\n';
+  };
+
+  for (int ch = 0; ch < CHANNEL_COUNT; ++ch) {
+    const ChannelInfo & info = CHANNELS[ch];
+    const char * unit = unit_name(info.unit);
+    std::string name = std::string("simpletdp_") + info.name;
+    if (*unit) name = name + '_' + unit;
+    const char * kind = info.kind == METRIC_LIMIT ? " limit" : info.kind == METRIC_VALUE ? " value" : "";
+    family(name, "gauge", "", unit, (std::string(info.label) + kind).c_str());
+    sample(ch, name);
+  }
+
+  family("simpletdp_samples", "counter", "_total", "", "Telemetry samples taken");
+  sample(SLOT_SEQ, "simpletdp_samples_total");
+  family("simpletdp_smu_limit_requests", "counter", "_total", "", "Limit sets asked for");
+  sample(SLOT_SMU_REQUESTS, "simpletdp_smu_limit_requests_total");
+  family("simpletdp_smu_limit_coalesced", "counter", "_total", "", "Limit sets replaced before they were written");
+  sample(SLOT_SMU_COALESCED, "simpletdp_smu_limit_coalesced_total");
+  family("simpletdp_smu_limit_skipped", "counter", "_total", "", "Limit writes the SMU already had");
+  sample(SLOT_SMU_SKIPPED, "simpletdp_smu_limit_skipped_total");
+  family("simpletdp_smu_limit_writes", "counter", "_total", "", "Limit writes issued");
+  sample(SLOT_SMU_CALLS, "simpletdp_smu_limit_writes_total");
+
+  // these only change with the layout
+  family("simpletdp_sample_rate_hertz", "gauge", "", "hertz", "Telemetry sample rate");
+  out += "simpletdp_sample_rate_hertz " + std::to_string(_info.rate) + '\n';
+  family("simpletdp_cpu", "info", "_info", "", "Scaling governor and energy performance preference");
+  out += "simpletdp_cpu_info{scaling_governor=\"" + label_value(_info.scaling_governor) + "\",epp=\"" +
+         label_value(_info.epp) + "\"} 1\n";
+  const auto & tdp = _info.tdp_governor;
+  family("simpletdp_tdp_governor", "info", "_info", "", "TDP governor mode");
+  out += std::string("simpletdp_tdp_governor_info{mode=\"") + TdpGovernor::modeName(tdp.mode) + "\",unit=\"" +
+         TdpGovernor::modeUnit(tdp.mode) + "\"} 1\n";
+  family("simpletdp_tdp_governor_target", "gauge", "", "", "TDP governor target, in the unit of its mode");
+  out += "simpletdp_tdp_governor_target " + std::to_string(tdp.mode == TdpGovernor::OFF ? 0 : tdp.target) + '\n';
+  if (om) out += "# EOF\n";
+
+  // everything is written again on the next update
+  for (double & value : _values) value = NAN;
+}
+
+void MetricsText::put(int slot, double value) {
+  // NaN never compares equal, a fresh layout is always filled in
+  if (value == _values[slot] || !std::isfinite(value)) return;
+  char buf[VALUE_WIDTH + 1];
+  if (snprintf(buf, sizeof(buf), "%0*.3f", VALUE_WIDTH, value) != VALUE_WIDTH) return;
+  memcpy(&_text[_offsets[slot]], buf, VALUE_WIDTH);
+  _values[slot] = value;
+}
+
+MetricsExporter::MetricsExporter(int port, const std::string & textfile)
+  : _port(port), _path(textfile), _tmp_path(textfile + ".tmp") {
+  if (!_port) return;
+  _socket = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  int one = 1;
+  setsockopt(_socket, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in addr {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(_port);
+  // local only, a fleet agent on the device does the scraping
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (_socket < 0 || bind(_socket, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 || listen(_socket, 8) < 0) {
+    if (_socket >= 0) close(_socket);
+    throw "Unable to listen for metrics";
+  }
+  _stop = eventfd(0, EFD_CLOEXEC);
+  _thread = std::thread(&MetricsExporter::run, this);
+}
+
+MetricsExporter::~MetricsExporter() {
+  if (_thread.joinable()) {
+    uint64_t one = 1;
+    [[maybe_unused]] auto n = write(_stop, &one, sizeof(one));
+    _thread.join();
+  }
+  if (_socket >= 0) close(_socket);
+  if (_stop >= 0) close(_stop);
+}
+
+void MetricsExporter::publish(const Snapshot & snap, const ExporterInfo & info) {
+  TRACE_SPAN("metrics_publish");
+  if (_port) {
+    std::lock_guard<std::mutex> guard(_lock);
+    _http.setInfo(info);
+    _http.update(snap);
+  }
+  if (!_path.empty() && snap.timestamp_ns - _written_ns >= TEXTFILE_INTERVAL_NS) {
+    _written_ns = snap.timestamp_ns;
+    _file.setInfo(info);
+    _file.update(snap);
+    writeTextfile();
+  }
+}
+
+void MetricsExporter::writeTextfile() {
+  // renamed into place so the collector never sees half a file
+  int fd = open(_tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  bool ok = fd >= 0 && write(fd, _file.data(), _file.size()) == static_cast<ssize_t>(_file.size());
+  if (fd >= 0) ok &= close(fd) == 0;
+  ok = ok && rename(_tmp_path.c_str(), _path.c_str()) == 0;
+  if (!ok && !_write_failed) {
+    std::cerr << "Unable to write " << _path << ": " << strerror(errno) << std::endl;
+  }
+  _write_failed = !ok;
+}
+
+void MetricsExporter::run() {
+  trace::setThreadName("metrics");
+  pollfd fds[] = { { _socket, POLLIN, 0 }, { _stop, POLLIN, 0 } };
+  while (true) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) continue;
+      return;
+    }
+    if (fds[1].revents) return;
+    int fd = accept4(_socket, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) continue;
+    // one scrape at a time, a client that stalls only holds up the next one
+    timeval timeout { 0, 200000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    respond(fd);
+    close(fd);
+  }
+}
+
+void MetricsExporter::respond(int fd) {
+  char request[2048];
+  size_t len = 0;
+  while (len < sizeof(request) - 1) {
+    ssize_t n = recv(fd, request + len, sizeof(request) - 1 - len, 0);
+    if (n <= 0) return;
+    len += n;
+    request[len] = '\0';
+    if (strstr(request, "\r\n\r\n")) break;
+  }
+  request[len] = '\0';
+  TRACE_SPAN("metrics_scrape");
+
+  char header[256];
+  iovec iov[2];
+  int count = 1;
+  int header_len;
+  if (!strncmp(request, "GET /metrics ", 13) || !strncmp(request, "GET / ", 6)) {
+    size_t size;
+    {
+      std::lock_guard<std::mutex> guard(_lock);
+      size = _http.size();
+      // only grows when the layout did
+      if (_response.size() < size) _response.resize(size);
+      memcpy(_response.data(), _http.data(), size);
+    }
+    header_len = snprintf(header, sizeof(header),
+                          "HTTP/1.1 200 OK\r\n"
+                          "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+                          "Content-Length: %zu\r\n"
+                          "Connection: close\r\n\r\n", size);
+    iov[1] = { _response.data(), size };
+    count = 2;
+  } else {
+    header_len = snprintf(header, sizeof(header),
+                          "HTTP/1.1 404 Not Found\r\n"
+                          "Content-Length: 0\r\n"
+                          "Connection: close\r\n\r\n");
+  }
+  iov[0] = { header, static_cast<size_t>(header_len) };
+  msghdr msg {};
+  msg.msg_iov = iov;
+  msg.msg_iovlen = count;
+  [[maybe_unused]] auto n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+}
+
+}
@@ -0,0 +1,122 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "channels.h"
+#include "governor.h"
+#include "sampler.h"
+
+namespace cpu_utils {
+
+// What the exporter publishes besides the telemetry
+struct ExporterInfo {
+  int rate = 0;
+  std::string scaling_governor;
+  std::string epp;
+  TdpGovernor::Settings tdp_governor;
+
+  bool operator==(const ExporterInfo & other) const;
+};
+
+// The exposition text of every metric. Laid out once per ExporterInfo, each
+// sample only rewrites the values that changed, in place: values are zero
+// padded to VALUE_WIDTH so their offsets never move.
+struct MetricsText {
+  enum Format {
+    OPENMETRICS,  // for the HTTP endpoint
+    PROMETHEUS,   // text format 0.0.4, what the node exporter textfile collector reads
+  };
+
+  static constexpr int VALUE_WIDTH = 16;
+
+  explicit MetricsText(Format format);
+
+  // lays the text out again if anything changed
+  void setInfo(const ExporterInfo & info);
+  void update(const Snapshot & snap);
+
+  const char * data() const;
+  size_t size() const;
+
+private:
+  // one per sample value, after the channels
+  enum Slot {
+    SLOT_SEQ = CHANNEL_COUNT,
+    SLOT_SMU_REQUESTS,
+    SLOT_SMU_COALESCED,
+    SLOT_SMU_SKIPPED,
+    SLOT_SMU_CALLS,
+    SLOT_COUNT
+  };
+
+  void layout();
+  void put(int slot, double value);
+
+  Format _format;
+  ExporterInfo _info;
+  std::string _text;
+  size_t _offsets[SLOT_COUNT] {};
+  double _values[SLOT_COUNT] {};
+};
+
+// Serves MetricsText over HTTP on localhost and/or writes it to a node
+// exporter textfile, renamed into place at most once a second. Scrapes
+// are answered from a copy of the text, never from the SMU.
+struct MetricsExporter {
+  static constexpr uint64_t TEXTFILE_INTERVAL_NS = 1000000000;
+
+  // port 0 or an empty path turns that side off. Throws if the port can't
+  // be bound.
+  MetricsExporter(int port, const std::string & textfile);
+
+  ~MetricsExporter();
+
+  // from the sampling side, after every sample
+  void publish(const Snapshot & snap, const ExporterInfo & info);
+
+private:
+  void run();
+  void respond(int fd);
+  void writeTextfile();
+
+  MetricsText _http { MetricsText::OPENMETRICS };
+  MetricsText _file { MetricsText::PROMETHEUS };
+  int _port;
+  std::string _path;
+  std::string _tmp_path;
+  uint64_t _written_ns = 0;
+  bool _write_failed = false;
+
+  // guards _http, the server copies it out into _response
+  std::mutex _lock;
+  std::vector<char> _response;
+
+  int _socket = -1;
+  int _stop = -1;
+  std::thread _thread;
+};
+
+}
@@ -0,0 +1,237 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "governor.h"
+#include "sim_backend.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <memory>
+
+namespace cpu_utils {
+
+namespace {
+
+static bool read_number(const std::filesystem::path & path, double & value)
+{
+  std::ifstream input (path);
+  return static_cast<bool>(input >> value);
+}
+
+// sum of the discharge power of all batteries, false while none is
+// discharging: on AC the drain says nothing about the TDP
+static bool battery_drain(const std::filesystem::path & sysfs_root, double & watts)
+{
+  std::error_code ec;
+  const auto supplies = sysfs_root / "class" / "power_supply";
+  bool found = false;
+  watts = 0;
+  for (const auto & entry : std::filesystem::directory_iterator(supplies, ec)) {
+    std::ifstream type_file (entry.path() / "type");
+    std::string type, status;
+    if (!(type_file >> type) || type != "Battery") continue;
+    std::ifstream status_file (entry.path() / "status");
+    status_file >> status;
+    double power, current, voltage;
+    if (read_number(entry.path() / "power_now", power)) {
+      // uW
+    } else if (read_number(entry.path() / "current_now", current) && read_number(entry.path() / "voltage_now", voltage)) {
+      // uA * uV
+      power = current * voltage * 1e-6;
+    } else {
+      continue;
+    }
+    if (status != "Discharging") continue;
+    found = true;
+    watts += power * 1e-6;
+  }
+  return found;
+}
+
+}
+
+const char * TdpGovernor::modeName(int mode) {
+  switch (mode) {
+    case OFF: return "Manual";
+    case SKIN_TEMP: return "Skin temperature";
+    case PACKAGE_POWER: return "Package power";
+    case BATTERY_DRAIN: return "Battery drain";
+    default:
+      break;
+  }
+  return "Unknown";
+}
+
+const char * TdpGovernor::modeUnit(int mode) {
+  return mode == SKIN_TEMP ? "C" : "W";
+}
+
+TdpGovernor::Tuning TdpGovernor::defaultTuning(int mode) {
+  switch (mode) {
+    // skin temperature lags package power by minutes, keep it gentle
+    case SKIN_TEMP: return { 0.8, 0.01, 0, 0.5 };
+    case PACKAGE_POWER: return { 0.2, 0.1, 0, 0.3 };
+    case BATTERY_DRAIN: return { 0.2, 0.05, 0, 0.5 };
+    default:
+      break;
+  }
+  return { 0, 0, 0, 0 };
+}
+
+void TdpGovernor::configure(const Settings & settings, const Tuning & tuning) {
+  _settings = settings;
+  _tuning = tuning;
+  _started = false;
+}
+
+void TdpGovernor::hold() {
+  _started = false;
+}
+
+const TdpGovernor::Settings & TdpGovernor::settings() const {
+  return _settings;
+}
+
+MetricMask TdpGovernor::metrics(int mode) {
+  switch (mode) {
+    case OFF:
+      return 0;
+    case SKIN_TEMP:
+      return metricBit(CH_STAPM_LIMIT) | metricBit(CH_APU_SKIN_TEMP_VALUE);
+    case PACKAGE_POWER:
+      return metricBit(CH_STAPM_LIMIT) | metricBit(CH_STAPM_SLOW_VALUE);
+    default:
+      break;
+  }
+  return metricBit(CH_STAPM_LIMIT);
+}
+
+bool TdpGovernor::measure(int mode, const RyzenTelemetry & ry, const std::filesystem::path & sysfs_root, double & value) {
+  switch (mode) {
+    case SKIN_TEMP:
+      value = ry.apu_skin_temp_value;
+      return true;
+    case PACKAGE_POWER:
+      value = ry.stapm_slow_value;
+      return true;
+    case BATTERY_DRAIN:
+      return battery_drain(sysfs_root, value);
+    default:
+      break;
+  }
+  return false;
+}
+
+int TdpGovernor::update(double measured, int current_tdp, double now_s) {
+  if (_settings.mode == OFF) return -1;
+  const Tuning & t = _tuning;
+
+  if (!_started) {
+    // take over bumplessly from whatever limit is set now
+    _started = true;
+    _settled = false;
+    _bias = std::clamp(current_tdp, _settings.min_tdp, _settings.max_tdp);
+    _integral = 0;
+    _last_measured = measured;
+    _last_time = now_s;
+    _last_write = now_s - t.min_interval_s;
+    return -1;
+  }
+
+  const double dt = now_s - _last_time;
+  if (dt <= 0) return -1;
+
+  // positive error means there is room to raise the TDP
+  double error = _settings.target - measured;
+  if (_settled ? std::fabs(error) < 2 * t.band : std::fabs(error) < t.band) {
+    _settled = true;
+    error = 0;
+  } else {
+    _settled = false;
+  }
+
+  const double derivative = -(measured - _last_measured) / dt;
+  _last_measured = measured;
+  _last_time = now_s;
+
+  const double integral = _integral + t.ki * error * dt;
+  const double raw = _bias + t.kp * error + integral + t.kd * derivative;
+  const double output = std::clamp(raw, static_cast<double>(_settings.min_tdp), static_cast<double>(_settings.max_tdp));
+  // only integrate while that doesn't push further into saturation
+  if (raw == output || (raw > output) != (error > 0)) {
+    _integral = integral;
+  }
+
+  if (now_s - _last_write < t.min_interval_s) return -1;
+  const int step = std::clamp(static_cast<int>(std::lround(output)) - current_tdp, -t.max_step, t.max_step);
+  if (step == 0) return -1;
+  _last_write = now_s;
+  return current_tdp + step;
+}
+
+GovernorSimResult simulateGovernor(const TdpGovernor::Settings & settings, double seconds, int rate_hz, int start_tdp) {
+  SimulatedBackend::Config config;
+  config.step_s = 1.0 / rate_hz;
+  // constant demand so the loop is judged on its own
+  config.burst_w = 0;
+  config.noise_w = 0.5;
+  RyzenState rs { std::make_unique<SimulatedBackend>(config) };
+  rs.setTdp(start_tdp);
+  // settle at the starting TDP first, so this measures a step response
+  for (int i = 0; i < 900 * rate_hz; ++i) {
+    rs.tick();
+  }
+
+  TdpGovernor governor;
+  const TdpGovernor::Tuning tuning = TdpGovernor::defaultTuning(settings.mode);
+  governor.configure(settings, tuning);
+
+  GovernorSimResult result { -1, 0, 0, 0 };
+  const int steps = static_cast<int>(seconds * rate_hz);
+  double first_error = 0;
+  double settled_since = -1;
+  for (int i = 0; i < steps; ++i) {
+    const double now = static_cast<double>(i) / rate_hz;
+    rs.tick(TdpGovernor::metrics(settings.mode));
+    double measured;
+    if (!TdpGovernor::measure(settings.mode, rs, "/nonexistent", measured)) break;
+    const double error = settings.target - measured;
+    if (i == 0) first_error = error;
+    // overshoot is an excursion past the target, away from where we started
+    if ((first_error > 0) == (error < 0)) {
+      result.overshoot = std::max(result.overshoot, std::fabs(error));
+    }
+    if (std::fabs(error) <= 2 * tuning.band) {
+      if (settled_since < 0) settled_since = now;
+    } else {
+      settled_since = -1;
+    }
+    result.final_error = error;
+
+    int tdp = governor.update(measured, rs.stapm_limit, now);
+    if (tdp > 0) {
+      rs.setTdp(tdp);
+      ++result.writes;
+    }
+  }
+  result.convergence_s = settled_since;
+  return result;
+}
+
+}
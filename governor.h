@@ -0,0 +1,95 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <filesystem>
+
+#include "cpu_utils.h"
+
+namespace cpu_utils {
+
+// Adjusts the TDP to hold a target instead of a fixed wattage. A PID loop
+// on the chosen measurement, with conditional integration against windup,
+// a settle band for hysteresis and rate limited limit writes.
+struct TdpGovernor {
+  enum Mode {
+    OFF,
+    SKIN_TEMP,      // target in C, against apu_skin_temp_value
+    PACKAGE_POWER,  // target in W, against the slow PPT average
+    BATTERY_DRAIN,  // target in W, against the battery discharge rate
+    MODE_COUNT
+  };
+
+  struct Settings {
+    int mode = OFF;
+    float target = 0;
+    int min_tdp = 4;
+    int max_tdp = 30;
+  };
+
+  struct Tuning {
+    double kp, ki, kd;
+    double band;              // error treated as zero once settled inside it
+    int max_step = 2;         // W per write
+    double min_interval_s = 1; // between writes
+  };
+
+  static const char * modeName(int mode);
+  static const char * modeUnit(int mode);
+  static Tuning defaultTuning(int mode);
+
+  void configure(const Settings & settings, const Tuning & tuning);
+  const Settings & settings() const;
+  // while there is no measurement, the next update() takes over bumplessly
+  void hold();
+
+  // measured value of the current mode, from the telemetry or the battery.
+  // False for the battery while it isn't discharging.
+  static bool measure(int mode, const RyzenTelemetry & ry, const std::filesystem::path & sysfs_root, double & value);
+  // what measure() and update() read from the telemetry
+  static MetricMask metrics(int mode);
+
+  // feeds one measurement, returns the TDP to apply or -1 to leave the
+  // limits alone
+  int update(double measured, int current_tdp, double now_s);
+
+private:
+  Settings _settings;
+  Tuning _tuning {};
+  bool _started = false;
+  bool _settled = false;
+  double _bias = 0;
+  double _integral = 0;
+  double _last_measured = 0;
+  double _last_time = 0;
+  double _last_write = -1e9;
+};
+
+// Settles SimulatedBackend at start_tdp, then hands it to the governor for
+// the given simulated time and reports how the closed loop behaved.
+struct GovernorSimResult {
+  double convergence_s; // until the measurement stays within the settle band
+  double overshoot;     // worst excursion past the target, in target units
+  double final_error;
+  int writes;           // setTdp calls
+};
+
+GovernorSimResult simulateGovernor(const TdpGovernor::Settings & settings, double seconds, int rate_hz, int start_tdp);
+
+}
@@ -0,0 +1,197 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "history.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#define NS_PER_SEC 1000000000ull
+
+namespace cpu_utils {
+
+namespace {
+
+// index i of the oldest-first view over a ring ending at head
+struct RingView {
+  const float * data;
+  size_t capacity;
+  size_t first;
+  size_t count;
+
+  float operator[](size_t i) const {
+    size_t idx = first + i;
+    return data[idx < capacity ? idx : idx - capacity];
+  }
+};
+
+// Largest-triangle-three-buckets: keeps the first and last points and, from
+// each bucket in between, the point forming the largest triangle with the
+// previously kept point and the average of the next bucket. Samples are
+// treated as evenly spaced.
+static int lttb(const RingView & in, float * out, int width)
+{
+  const size_t n = in.count;
+  if (n <= static_cast<size_t>(width) || width < 3) {
+    const size_t count = std::min(n, static_cast<size_t>(width));
+    for (size_t i = 0; i < count; ++i) {
+      out[i] = in[n - count + i];
+    }
+    return static_cast<int>(count);
+  }
+
+  const double every = static_cast<double>(n - 2) / (width - 2);
+  size_t a = 0;
+  out[0] = in[0];
+  for (int i = 0; i < width - 2; ++i) {
+    size_t next_start = static_cast<size_t>((i + 1) * every) + 1;
+    size_t next_end = std::min(static_cast<size_t>((i + 2) * every) + 1, n);
+    double avg_x = 0, avg_y = 0;
+    for (size_t j = next_start; j < next_end; ++j) {
+      avg_x += j;
+      avg_y += in[j];
+    }
+    const size_t next_n = next_end - next_start;
+    if (next_n) {
+      avg_x /= next_n;
+      avg_y /= next_n;
+    } else {
+      avg_x = n - 1;
+      avg_y = in[n - 1];
+    }
+
+    const size_t start = static_cast<size_t>(i * every) + 1;
+    const size_t end = next_start;
+    const double ax = a, ay = in[a];
+    double best = -1;
+    size_t pick = start;
+    for (size_t j = start; j < end; ++j) {
+      double area = std::fabs((ax - avg_x) * (in[j] - ay) - (ax - j) * (avg_y - ay));
+      if (area > best) {
+        best = area;
+        pick = j;
+      }
+    }
+    out[i + 1] = in[pick];
+    a = pick;
+  }
+  out[width - 1] = in[n - 1];
+  return width;
+}
+
+}
+
+History::Tier::Tier(const char * label, uint64_t period_ns, size_t capacity)
+  : label(label), period_ns(period_ns), capacity(capacity),
+    time(capacity), avg(capacity * CHANNEL_COUNT),
+    min(period_ns ? capacity * CHANNEL_COUNT : 0),
+    max(period_ns ? capacity * CHANNEL_COUNT : 0) {}
+
+const float * History::Tier::column(Stat stat, int ch) const {
+  if (!period_ns || stat == AVG) return &avg[ch * capacity];
+  return stat == MIN ? &min[ch * capacity] : &max[ch * capacity];
+}
+
+void History::Tier::flush() {
+  time[head] = bucket_start;
+  for (int ch = 0; ch < CHANNEL_COUNT; ++ch) {
+    avg[ch * capacity + head] = static_cast<float>(acc_sum[ch] / bucket_n);
+    min[ch * capacity + head] = acc_min[ch];
+    max[ch * capacity + head] = acc_max[ch];
+  }
+  head = (head + 1) % capacity;
+  count = std::min(count + 1, capacity);
+  bucket_n = 0;
+}
+
+History::History() {
+  // 1024 raw samples is ~4 minutes at 4 Hz, the buckets cover 1 and 8 hours
+  _tiers.reserve(3);
+  _tiers.emplace_back("Recent", 0, 1024);
+  _tiers.emplace_back("1 hour", 10 * NS_PER_SEC, 360);
+  _tiers.emplace_back("8 hours", 60 * NS_PER_SEC, 480);
+}
+
+void History::push(const Snapshot & snap) {
+  float values[CHANNEL_COUNT];
+  for (int ch = 0; ch < CHANNEL_COUNT; ++ch) {
+    values[ch] = channelValue(snap.ryzen, ch);
+  }
+
+  for (auto & tier : _tiers) {
+    if (!tier.period_ns) {
+      tier.time[tier.head] = snap.timestamp_ns;
+      for (int ch = 0; ch < CHANNEL_COUNT; ++ch) {
+        tier.avg[ch * tier.capacity + tier.head] = values[ch];
+      }
+      tier.head = (tier.head + 1) % tier.capacity;
+      tier.count = std::min(tier.count + 1, tier.capacity);
+      continue;
+    }
+
+    if (tier.bucket_n && snap.timestamp_ns >= tier.bucket_start + tier.period_ns) {
+      tier.flush();
+    }
+    if (!tier.bucket_n) {
+      tier.bucket_start = snap.timestamp_ns - snap.timestamp_ns % tier.period_ns;
+      tier.acc_sum.fill(0);
+      tier.acc_min.fill(std::numeric_limits<float>::max());
+      tier.acc_max.fill(std::numeric_limits<float>::lowest());
+    }
+    for (int ch = 0; ch < CHANNEL_COUNT; ++ch) {
+      tier.acc_sum[ch] += values[ch];
+      tier.acc_min[ch] = std::min(tier.acc_min[ch], values[ch]);
+      tier.acc_max[ch] = std::max(tier.acc_max[ch], values[ch]);
+    }
+    ++tier.bucket_n;
+  }
+}
+
+size_t History::tierCount() const {
+  return _tiers.size();
+}
+
+const char * History::tierLabel(size_t tier) const {
+  return _tiers[tier].label;
+}
+
+size_t History::size(size_t tier) const {
+  return _tiers[tier].count;
+}
+
+int History::plot(size_t tier, int ch, Stat stat, float * out, int width) const {
+  const Tier & t = _tiers[tier];
+  RingView view { t.column(stat, ch), t.capacity, (t.head + t.capacity - t.count) % t.capacity, t.count };
+  return lttb(view, out, width);
+}
+
+void History::range(size_t tier, int ch, float & lo, float & hi) const {
+  const Tier & t = _tiers[tier];
+  lo = hi = 0;
+  if (!t.count) return;
+  // the filled part of a ring is at most two contiguous runs
+  const float * mins = t.column(MIN, ch);
+  const float * maxs = t.column(MAX, ch);
+  const size_t first = (t.head + t.capacity - t.count) % t.capacity;
+  const size_t run = std::min(t.count, t.capacity - first);
+  lo = std::min(*std::min_element(mins + first, mins + first + run), run < t.count ? *std::min_element(mins, mins + t.count - run) : std::numeric_limits<float>::max());
+  hi = std::max(*std::max_element(maxs + first, maxs + first + run), run < t.count ? *std::max_element(maxs, maxs + t.count - run) : std::numeric_limits<float>::lowest());
+}
+
+}
@@ -0,0 +1,83 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "channels.h"
+#include "sampler.h"
+
+namespace cpu_utils {
+
+// Telemetry history for every channel, in fixed size rings allocated up
+// front. Besides the raw samples it keeps coarser tiers of min/max/avg
+// buckets so hours of data fit in a few hundred KB.
+struct History {
+  enum Stat { AVG, MIN, MAX };
+
+  History();
+
+  // no allocation
+  void push(const Snapshot & snap);
+
+  size_t tierCount() const;
+  const char * tierLabel(size_t tier) const;
+  size_t size(size_t tier) const;
+
+  // Writes at most width points of the tier to out, oldest first, reduced
+  // with largest-triangle-three-buckets when the tier holds more than that.
+  // Returns the number of points written.
+  int plot(size_t tier, int ch, Stat stat, float * out, int width) const;
+
+  // min of MIN and max of MAX over the whole tier
+  void range(size_t tier, int ch, float & lo, float & hi) const;
+
+private:
+  struct Tier {
+    const char * label;
+    uint64_t period_ns; // 0 keeps every sample
+    size_t capacity;
+    size_t head = 0; // next slot to write
+    size_t count = 0;
+
+    // channel major, capacity entries per channel. Raw tiers only fill avg.
+    std::vector<uint64_t> time;
+    std::vector<float> avg;
+    std::vector<float> min;
+    std::vector<float> max;
+
+    uint64_t bucket_start = 0;
+    uint32_t bucket_n = 0;
+    std::array<double, CHANNEL_COUNT> acc_sum;
+    std::array<float, CHANNEL_COUNT> acc_min;
+    std::array<float, CHANNEL_COUNT> acc_max;
+
+    Tier(const char * label, uint64_t period_ns, size_t capacity);
+
+    const float * column(Stat stat, int ch) const;
+    void flush();
+  };
+
+  std::vector<Tier> _tiers;
+};
+
+}
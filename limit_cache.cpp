@@ -0,0 +1,110 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "limit_cache.h"
+#include "backend.h"
+#include "cpu_utils.h"
+#include "trace.h"
+
+namespace cpu_utils {
+
+void LimitCache::request(const Limits & limits) {
+  ++_stats.requests;
+  if (_has_pending) ++_stats.coalesced;
+  _pending = limits;
+  _has_pending = true;
+  _last = limits;
+}
+
+bool LimitCache::flush(PowerBackend & backend, uint64_t now_ns, bool now) {
+  if (!_has_pending) return true;
+  if (!now && now_ns - _last_flush_ns < MIN_INTERVAL_NS) return true;
+  TRACE_SPAN("smu_write");
+  _has_pending = false;
+  _last_flush_ns = now_ns;
+
+  bool ok = true;
+  for (int limit = 0; limit < LIMIT_COUNT; ++limit) {
+    const uint32_t mw = _pending[limit];
+    if (mw == _applied[limit]) {
+      ++_stats.skipped;
+      continue;
+    }
+    int err = 0;
+    switch (limit) {
+      case STAPM: err = backend.setStapmLimit(mw); break;
+      case FAST: err = backend.setFastLimit(mw); break;
+      case SLOW: err = backend.setSlowLimit(mw); break;
+      case APU_SLOW: err = backend.setApuSlowLimit(mw); break;
+    }
+    ++_stats.calls;
+    // don't trust the cache for a limit that was refused
+    _applied[limit] = err ? 0 : mw;
+    _settled[limit] = -1;
+    _unsettled[limit] = 0;
+    ok &= err == 0;
+  }
+  return ok;
+}
+
+bool LimitCache::pending() const {
+  return _has_pending;
+}
+
+bool LimitCache::rewrite(PowerBackend & backend, uint64_t now_ns) {
+  if (!_last[STAPM]) return true;
+  _applied.fill(0);
+  _settled.fill(-1);
+  _unsettled.fill(0);
+  // the newest request, whether it went out or not
+  _pending = _last;
+  _has_pending = true;
+  return flush(backend, now_ns, true);
+}
+
+bool LimitCache::held(const RyzenTelemetry & ry) const {
+  if (!_last[STAPM]) return true;
+  return ry.stapm_limit * 1000 == static_cast<int>(_last[STAPM]) &&
+         ry.stapm_fast_limit * 1000 == static_cast<int>(_last[FAST]);
+}
+
+void LimitCache::observe(const RyzenTelemetry & ry) {
+  const int read[LIMIT_COUNT] = { ry.stapm_limit, ry.stapm_fast_limit, ry.stapm_slow_limit, ry.apu_slow_limit };
+  for (int limit = 0; limit < LIMIT_COUNT; ++limit) {
+    if (!_applied[limit]) continue;
+    if (_settled[limit] < 0) {
+      // the PM table can lag a write by a read, after that take whatever
+      // the firmware clamped it to
+      if (read[limit] * 1000 == static_cast<int>(_applied[limit]) || ++_unsettled[limit] >= 2) {
+        _settled[limit] = read[limit];
+        _unsettled[limit] = 0;
+      }
+    } else if (read[limit] != _settled[limit]) {
+      // changed behind our back, write it again next time
+      _applied[limit] = 0;
+      _settled[limit] = -1;
+      _unsettled[limit] = 0;
+    }
+  }
+}
+
+SmuStats LimitCache::stats() const {
+  return _stats;
+}
+
+}
@@ -0,0 +1,86 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "metrics.h"
+
+namespace cpu_utils {
+
+struct PowerBackend;
+struct RyzenTelemetry;
+
+struct SmuStats {
+  uint64_t requests;   // limit sets asked for
+  uint64_t coalesced;  // replaced by a newer one before they went out
+  uint64_t skipped;    // single limit writes the SMU already had
+  uint64_t calls;      // single limit writes issued
+};
+
+// Write-back cache of the STAPM/fast/slow/APU slow limits in front of the
+// SMU. Requests are coalesced and go out at most every MIN_INTERVAL_NS, and
+// only the limits that differ from what was last applied are written. A
+// limit the firmware clamped isn't written again, one that somebody else
+// changed is. Not thread safe, RyzenState serialises it with the SMU.
+struct LimitCache {
+  enum Limit { STAPM, FAST, SLOW, APU_SLOW, LIMIT_COUNT };
+  using Limits = std::array<uint32_t, LIMIT_COUNT>; // mW
+
+  static constexpr uint64_t MIN_INTERVAL_NS = 100000000;
+  // what observe() reads
+  static constexpr MetricMask METRICS = metricBit(CH_STAPM_LIMIT) | metricBit(CH_STAPM_FAST_LIMIT) |
+                                        metricBit(CH_STAPM_SLOW_LIMIT) | metricBit(CH_APU_SLOW_LIMIT);
+
+  // replaces any request that hasn't gone out yet
+  void request(const Limits & limits);
+  // writes the pending request if the interval has passed or now is set,
+  // returns false if the SMU refused a limit
+  bool flush(PowerBackend & backend, uint64_t now_ns, bool now = false);
+  bool pending() const;
+  // writes every limit of the last request again, whatever the cache
+  // thinks the SMU has, for after the firmware reset them
+  bool rewrite(PowerBackend & backend, uint64_t now_ns);
+
+  // whether the STAPM and fast limits read are the ones last requested,
+  // true before any request
+  bool held(const RyzenTelemetry & ry) const;
+
+  // what the firmware reports after a read
+  void observe(const RyzenTelemetry & ry);
+
+  SmuStats stats() const;
+
+private:
+  Limits _pending {};
+  bool _has_pending = false;
+  // 0 before the first request
+  Limits _last {};
+  uint64_t _last_flush_ns = 0;
+
+  // 0 when unknown, always written
+  Limits _applied {};
+  // what the firmware made of _applied, in W, -1 until read back
+  std::array<int, LIMIT_COUNT> _settled { -1, -1, -1, -1 };
+  std::array<int, LIMIT_COUNT> _unsettled {};
+  SmuStats _stats {};
+};
+
+}
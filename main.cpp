@@ -30,17 +30,145 @@
 #define NDEBUG 1
 #include "ryzenadj.h"
 #include "cpu_utils.h"
-
-#include <deque>
+#include "controller.h"
+#include "client.h"
+#include "protocol.h"
+#include "channels.h"
+#include "cli.h"
+#include "history.h"
+#include "energy.h"
+#include "core_sampler.h"
+#include "process_sampler.h"
+#include "replay.h"
+#include "sim_backend.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <vector>
+#include <ctime>
+
+// widest plot in points, plots are decimated to their pixel width
+#define PLOT_POINTS 1024
+// frames to keep drawing after input so ImGui can settle hover/nav state
+#define INPUT_FRAMES 3
+// upper bound on how long the loop sleeps without any event
+#define IDLE_TIMEOUT_MS 1000
+// spans the profiler overlay summarises
+#define PROFILER_WINDOW_NS 5000000000ull
+
+static double clock_seconds(clockid_t clock)
+{
+  timespec ts;
+  clock_gettime(clock, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char ** argv){
+  int sampleRate = 0;
+  const char * socketPath = SOCKET_PATH;
+  bool local = false;
+  int maxFps = 30;
+  const char * recordPath = nullptr;
+  const char * replayPath = nullptr;
+  double replaySpeed = 1.0;
+  bool simulate = false;
+  const char * sysfsRoot = "/sys";
+  const char * tracePath = nullptr;
+  std::vector<cpu_utils::Profile> profiles = cpu_utils::builtinProfiles();
+  cpu_utils::CliOptions cli;
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--rate") && i + 1 < argc) {
+      sampleRate = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--socket") && i + 1 < argc) {
+      socketPath = argv[++i];
+    } else if (!strcmp(argv[i], "--local")) {
+      local = true;
+    } else if (!strcmp(argv[i], "--record") && i + 1 < argc) {
+      recordPath = argv[++i];
+    } else if (!strcmp(argv[i], "--replay") && i + 1 < argc) {
+      replayPath = argv[++i];
+    } else if (!strcmp(argv[i], "--speed") && i + 1 < argc) {
+      replaySpeed = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--simulate")) {
+      simulate = true;
+    } else if (!strcmp(argv[i], "--sysfs-root") && i + 1 < argc) {
+      sysfsRoot = argv[++i];
+    } else if (!strcmp(argv[i], "--profiles") && i + 1 < argc) {
+      try {
+        profiles = cpu_utils::loadProfiles(argv[++i]);
+      } catch (const char * err) {
+        printf("Error: %s: %s\n", argv[i], err);
+        return -1;
+      }
+    } else if (!strcmp(argv[i], "--trace") && i + 1 < argc) {
+      tracePath = argv[++i];
+    } else if (!strcmp(argv[i], "--max-fps") && i + 1 < argc) {
+      maxFps = std::max(1, atoi(argv[++i]));
+    } else if (!strcmp(argv[i], "--set-tdp") && i + 1 < argc) {
+      cli.tdp = std::max(0, atoi(argv[++i]));
+    } else if (!strcmp(argv[i], "--governor") && i + 1 < argc) {
+      cli.governor = argv[++i];
+    } else if (!strcmp(argv[i], "--epp") && i + 1 < argc) {
+      cli.epp = argv[++i];
+    } else if (!strcmp(argv[i], "--get")) {
+      cli.get = true;
+    } else if (!strcmp(argv[i], "--json")) {
+      cli.json = true;
+    } else {
+      printf("Usage: %s [--rate <%d-%d Hz>] [--max-fps <fps>] [--profiles <file>] [--trace <file>] [--socket <path> | --local [--record <file>] [--simulate] [--sysfs-root <dir>]]\n"
+             "       %s --replay <file> [--speed <factor>]\n"
+             "       %s [--set-tdp <W>] [--governor <name>] [--epp <preference>] [--get [--json]] [--socket <path> | --local [--simulate] [--sysfs-root <dir>]]\n",
+             argv[0], cpu_utils::Sampler::MIN_RATE, cpu_utils::Sampler::MAX_RATE, argv[0], argv[0]);
+      return -1;
+    }
+  }
+
+  // scripts get in and out without a window
+  if (cli.any()) {
+    return cpu_utils::runCli(cli, socketPath, local, simulate, sysfsRoot);
+  }
 
-#define REC_COUNT 120
-#define BOOST_PATH "/sys/devices/system/cpu/cpufreq/boost"
-#define PSTATE_BOOST_PATH "/sys/devices/system/cpu/amd_pstate/cpb_boost"
-#define AMD_PSTATE_PATH "/sys/devices/system/cpu/amd_pstate/status"
-#define AMD_SMT_PATH "/sys/devices/system/cpu/smt/control"
+  // Prefer a running simpletdpd, only touch the hardware ourselves without one
+  std::unique_ptr<cpu_utils::Controller> ctrl;
+  if (replayPath) {
+    try {
+      ctrl = std::make_unique<cpu_utils::ReplayController>(replayPath, replaySpeed);
+    } catch (const char * err) {
+      printf("Error: %s: %s\n", replayPath, err);
+      return -1;
+    }
+  } else if (!local && !recordPath && !simulate) {
+    try {
+      ctrl = std::make_unique<cpu_utils::RemoteController>(socketPath);
+      std::cout << "Connected to simpletdpd at " << socketPath << std::endl;
+    } catch (const char * err) {
+      std::cout << err << ", accessing hardware directly" << std::endl;
+    }
+  }
+  if (!ctrl) {
+    std::unique_ptr<cpu_utils::PowerBackend> backend;
+    if (simulate) {
+      backend = std::make_unique<cpu_utils::SimulatedBackend>();
+    } else {
+      backend = std::make_unique<cpu_utils::RyzenAdjBackend>();
+    }
+    auto localCtrl = std::make_unique<cpu_utils::LocalController>(sampleRate ? sampleRate : 4, std::move(backend), sysfsRoot);
+    if (recordPath) {
+      try {
+        localCtrl->record(recordPath);
+      } catch (const char * err) {
+        printf("Error: %s: %s\n", recordPath, err);
+        return -1;
+      }
+    }
+    ctrl = std::move(localCtrl);
+  }
 
-int main(){
   // Setup SDL
   if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER | SDL_INIT_GAMECONTROLLER) != 0)
   {
@@ -80,73 +208,197 @@ int main(){
   ImGui_ImplSDL2_InitForOpenGL(window, gl_context);
   ImGui_ImplOpenGL3_Init(glsl_version);
 
+  // New telemetry wakes the event loop, at most one wake up is queued at a time
+  const Uint32 telemetryEvent = SDL_RegisterEvents(1);
+  static std::atomic<bool> telemetryQueued { false };
+  ctrl->setListener([telemetryEvent] {
+    if (telemetryQueued.exchange(true)) return;
+    SDL_Event event {};
+    event.type = telemetryEvent;
+    SDL_PushEvent(&event);
+  });
+  // the overview plots these against their limits, the details read everything
+  struct OverviewPlot {
+    const char * label;
+    int ch;
+  };
+  static constexpr OverviewPlot overviewPlots[] = {
+    { "STAPM", cpu_utils::CH_STAPM_VALUE },
+    { "STAPM FAST", cpu_utils::CH_STAPM_FAST_VALUE },
+    { "STAPM SLOW", cpu_utils::CH_STAPM_SLOW_VALUE },
+  };
+  cpu_utils::MetricMask overviewMetrics = 0;
+  for (const auto & p : overviewPlots) {
+    overviewMetrics |= cpu_utils::metricBit(p.ch) | cpu_utils::metricBit(cpu_utils::CHANNELS[p.ch].pair);
+  }
+  // the session stats take every sample
+  overviewMetrics |= cpu_utils::EnergyAccount::METRICS;
+  ctrl->subscribe(overviewMetrics);
+  ctrl->start();
+  if (sampleRate) {
+    ctrl->setRate(sampleRate);
+  }
+
   bool done = false;
   bool show_demo_window = false;
 
-  cpu_utils::RyzenState rs{};
-
-  std::deque<float> stapm_rec;
-  std::deque<float> stapm_fast_rec;
-  std::deque<float> stapm_slow_rec;
-  std::deque<float> apu_slow_rec;
-
-  auto getter = [](void * data, int idx) -> float {
-    auto dp = reinterpret_cast<std::deque<float>*> (data);
-    if (idx < dp->size()){
-      return (*dp)[idx];
-    }
-    return 0;
+  uint64_t lastSeq = 0;
+
+  cpu_utils::History history;
+  int historyTier = 0;
+  static float plotPoints[PLOT_POINTS];
+  auto plot = [&](const char * label, int ch) {
+    const int width = std::clamp(static_cast<int>(ImGui::CalcItemWidth()), 2, PLOT_POINTS);
+    const int count = history.plot(historyTier, ch, cpu_utils::History::AVG, plotPoints, width);
+    float lo, hi;
+    history.range(historyTier, ch, lo, hi);
+    char overlay[32];
+    snprintf(overlay, sizeof(overlay), "%.1f - %.1f", lo, hi);
+    ImGui::PlotLines(label, plotPoints, count, 0, overlay);
   };
 
-  cpu_utils::CPUState cs;
-  cs.init();
+  cpu_utils::EnergyAccount energy;
+
+  // per-core data is read in this process, only while its panel is open
+  cpu_utils::CoreSampler cores;
+  bool coresOpen = false;
+  // the daemon doesn't send its CPU list, read our own when connected to one
+  cpu_utils::CPUState coreCpus;
+  static float coreHistory[cpu_utils::CoreSampler::HISTORY];
+  static ImVec2 coreLine[cpu_utils::CoreSampler::HISTORY];
+  // so are processes, while their panel is open
+  cpu_utils::ProcessSampler processes;
+  bool processesOpen = false;
+  static cpu_utils::ProcessPower topProcesses[15];
+  // GPU telemetry is read here as well, the settings come from the controller
+  cpu_utils::GpuSampler gpu;
+  static float gpuHistory[cpu_utils::GpuSampler::HISTORY];
 
-  bool smtEnabled = true;
-  bool boostEnabled = true;
 
   bool showDetailOverview = false;
 
+  // spans are only recorded while the profiler is open or --trace is given
+  bool showProfiler = false;
+  std::vector<cpu_utils::trace::SpanStats> spanStats;
+  double spanStatsTime = 0;
+  const std::string dumpPath = tracePath ? tracePath : "/tmp/simpletdp-trace.json";
+  std::string dumpStatus;
+  cpu_utils::trace::setThreadName("ui");
+  cpu_utils::trace::setEnabled(tracePath != nullptr);
+
+  const Uint64 frameInterval = 1000 / maxFps;
+  Uint64 lastFrame = 0;
+  int pendingFrames = 1;
+  bool minimised = false;
+
+  // rendering cost, reported in the UI and on exit
+  const double startTime = clock_seconds(CLOCK_MONOTONIC);
+  const double startCpu = clock_seconds(CLOCK_PROCESS_CPUTIME_ID);
+  uint64_t frameCount = 0;
+  uint64_t statFrames = 0;
+  double statTime = startTime;
+  double statCpu = startCpu;
+  float uiFps = 0;
+  float uiCpu = 0;
+
   while(!done){
 
+    // Sleep until something happens, but don't draw faster than maxFps
+    int timeout = IDLE_TIMEOUT_MS;
+    if (pendingFrames > 0 && !minimised) {
+      Uint64 elapsed = SDL_GetTicks64() - lastFrame;
+      timeout = elapsed >= frameInterval ? 0 : static_cast<int>(frameInterval - elapsed);
+    }
     SDL_Event event;
-    while (SDL_PollEvent(&event))
+    bool hasEvent = timeout ? SDL_WaitEventTimeout(&event, timeout) : SDL_PollEvent(&event);
+    while (hasEvent)
     {
       ImGui_ImplSDL2_ProcessEvent(&event);
+      if (event.type == telemetryEvent) {
+        telemetryQueued = false;
+        pendingFrames = std::max(pendingFrames, 1);
+      } else if (event.type == SDL_WINDOWEVENT) {
+        switch (event.window.event) {
+          case SDL_WINDOWEVENT_MINIMIZED:
+          case SDL_WINDOWEVENT_HIDDEN:
+            minimised = true;
+            break;
+          case SDL_WINDOWEVENT_RESTORED:
+          case SDL_WINDOWEVENT_MAXIMIZED:
+          case SDL_WINDOWEVENT_SHOWN:
+          case SDL_WINDOWEVENT_EXPOSED:
+            minimised = false;
+            break;
+          default:
+            break;
+        }
+        pendingFrames = INPUT_FRAMES;
+      } else {
+        pendingFrames = INPUT_FRAMES;
+      }
       if (event.type == SDL_QUIT)
         done = true;
       if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_CLOSE && event.window.windowID == SDL_GetWindowID(window))
         done = true;
+      hasEvent = SDL_PollEvent(&event);
+    }
+
+    // History keeps recording while nothing is drawn
+    cpu_utils::trace::Span updateSpan ("ui_update");
+    ctrl->update();
+    const cpu_utils::CPUState & cs = ctrl->cpuState();
+    const cpu_utils::Snapshot snap = ctrl->latest();
+    const cpu_utils::RyzenTelemetry & ry = snap.ryzen;
+    const bool freshSample = snap.seq != lastSeq;
+    lastSeq = snap.seq;
+
+    if (freshSample) {
+      TRACE_SPAN("history_push");
+      history.push(snap);
+      energy.push(snap, ctrl->profile());
+      if (coresOpen) {
+        cores.sync(cs.cpus.empty() ? coreCpus : cs);
+        cores.sample();
+      }
+      if (processesOpen) {
+        processes.sample(ry.stapm_fast_value);
+      }
+      gpu.sync(ctrl->gpuState());
+      gpu.sample();
+    }
+
+    updateSpan.end();
+
+    if (done || minimised || pendingFrames == 0 || SDL_GetTicks64() - lastFrame < frameInterval) {
+      continue;
+    }
+    TRACE_SPAN("frame");
+    --pendingFrames;
+    lastFrame = SDL_GetTicks64();
+    ++frameCount;
+    ++statFrames;
+    if (double now = clock_seconds(CLOCK_MONOTONIC); now - statTime >= 1.0) {
+      double cpu = clock_seconds(CLOCK_PROCESS_CPUTIME_ID);
+      uiFps = statFrames / (now - statTime);
+      uiCpu = 100.0 * (cpu - statCpu) / (now - statTime);
+      statFrames = 0;
+      statTime = now;
+      statCpu = cpu;
     }
 
     // Start the Dear ImGui frame
+    cpu_utils::trace::Span layoutSpan ("imgui_layout");
     ImGui_ImplOpenGL3_NewFrame();
     ImGui_ImplSDL2_NewFrame();
     ImGui::NewFrame();
 
-    static ImGuiWindowFlags flags = ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoSavedSettings | ImGuiWindowFlags_NoTitleBar | ImGuiWindowFlags_NoCollapse;
+    // kept behind the profiler
+    static ImGuiWindowFlags flags = ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoSavedSettings | ImGuiWindowFlags_NoTitleBar | ImGuiWindowFlags_NoCollapse | ImGuiWindowFlags_NoBringToFrontOnFocus;
 
     const ImGuiViewport* viewport = ImGui::GetMainViewport();
     ImGui::SetNextWindowPos(viewport->Pos);
     ImGui::SetNextWindowSize(viewport->Size);
 
-    rs.tick();
-    if (stapm_rec.size() > REC_COUNT) {
-      stapm_rec.pop_front();
-    }
-    if (stapm_fast_rec.size() > REC_COUNT) {
-      stapm_fast_rec.pop_front();
-    }
-    if (stapm_slow_rec.size() > REC_COUNT) {
-      stapm_slow_rec.pop_front();
-    }
-    if (apu_slow_rec.size() > REC_COUNT) {
-      apu_slow_rec.pop_front();
-    }
-    stapm_rec.push_back(rs.stapm_value);
-    stapm_fast_rec.push_back(rs.stapm_fast_value);
-    stapm_slow_rec.push_back(rs.stapm_slow_value);
-    apu_slow_rec.push_back(rs.apu_slow_value);
-
     ImGui::Begin("SimpleTDP", &done, flags);
 
     // ImGui::Checkbox("Show Demo", &show_demo_window);
@@ -158,177 +410,373 @@ int main(){
     ImGui::SeparatorText("Overview");
 
     if (!showDetailOverview){
-      ImGui::Text("CPU Family: %s", rs.getFamilyName());
-
-      ImGui::Text("STAPM Limit: %d W", rs.stapm_limit);
-      ImGui::PlotLines("STAPM", getter, static_cast<void *>(&stapm_rec), 120);
-      ImGui::Text("STAPM FAST Limit: %d W", rs.stapm_fast_limit);
-      ImGui::PlotLines("STAPM FAST", getter, static_cast<void *>(&stapm_fast_rec), 120);
-      ImGui::Text("STAPM SLOW Limit: %d W", rs.stapm_slow_limit);
-      ImGui::PlotLines("STAPM SLOW", getter, static_cast<void *>(&stapm_slow_rec), 120);
+      ImGui::Text("CPU Family: %s", ctrl->getFamilyName());
+
+      for (const auto & p : overviewPlots) {
+        const int limit = cpu_utils::CHANNELS[p.ch].pair;
+        ImGui::Text("%s Limit: %.0f %s", p.label, cpu_utils::channelValue(ry, limit), cpu_utils::CHANNELS[limit].unit);
+        plot(p.label, p.ch);
+      }
+      for (size_t tier = 0; tier < history.tierCount(); ++tier) {
+        if (tier) ImGui::SameLine();
+        ImGui::RadioButton(history.tierLabel(tier), &historyTier, static_cast<int>(tier));
+      }
     }else{
-      if(ImGui::BeginTable("Detail Overview", 2, ImGuiTableFlags_SizingFixedFit | ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders)){
+      // a row per value with its limit beside it
+      if(ImGui::BeginTable("Detail Overview", 4, ImGuiTableFlags_SizingFixedFit | ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders)){
         ImGui::TableSetupColumn("Name", ImGuiTableColumnFlags_WidthFixed);
         ImGui::TableSetupColumn("Value", ImGuiTableColumnFlags_WidthFixed);
+        ImGui::TableSetupColumn("Limit", ImGuiTableColumnFlags_WidthFixed);
+        ImGui::TableSetupColumn("Unit", ImGuiTableColumnFlags_WidthFixed);
         ImGui::TableHeadersRow();
-        ImGui::TableNextRow();
-        ImGui::TableSetColumnIndex(0);
-        ImGui::Text("STAPM LIMIT");
-        ImGui::TableSetColumnIndex(1);
-        ImGui::Text("%d", rs.stapm_limit);
-        ImGui::TableNextRow();
-        ImGui::TableSetColumnIndex(0);
-        ImGui::Text("STAPM VALUE");
-        ImGui::TableSetColumnIndex(1);
-        ImGui::Text("%.2f", rs.stapm_value);
-        ImGui::TableNextRow();
-        ImGui::TableSetColumnIndex(0);
-        ImGui::Text("PPT LIMIT FAST");
-        ImGui::TableSetColumnIndex(1);
-        ImGui::Text("%d", rs.stapm_fast_limit);
-        ImGui::TableNextRow();
-        ImGui::TableSetColumnIndex(0);
-        ImGui::Text("PPT VALUE FAST");
-        ImGui::TableSetColumnIndex(1);
-        ImGui::Text("%.2f", rs.stapm_fast_value);
-        ImGui::TableNextRow();
-        ImGui::TableSetColumnIndex(0);
-        ImGui::Text("PPT LIMIT SLOW");
-        ImGui::TableSetColumnIndex(1);
-        ImGui::Text("%d", rs.stapm_slow_limit);
-        ImGui::TableNextRow();
-        ImGui::TableSetColumnIndex(0);
-        ImGui::Text("PPT VALUE SLOW");
-        ImGui::TableSetColumnIndex(1);
-        ImGui::Text("%.2f", rs.apu_slow_value);
-        ImGui::TableNextRow();
-        ImGui::TableSetColumnIndex(0);
-        ImGui::Text("StapmTimeConst");
-        ImGui::TableSetColumnIndex(1);
-        ImGui::Text("%.2f", rs.stapm_time);
-        ImGui::TableNextRow();
-        ImGui::TableSetColumnIndex(0);
-        ImGui::Text("SlowPPTTimeConst");
-        ImGui::TableSetColumnIndex(1);
-        ImGui::Text("%.2f", rs.stapm_slow_time);
-        ImGui::TableNextRow();
-        ImGui::TableSetColumnIndex(0);
-        ImGui::Text("PPT LIMIT APU");
-        ImGui::TableSetColumnIndex(1);
-        ImGui::Text("%d", rs.apu_slow_limit);
-        ImGui::TableNextRow();
-        ImGui::TableSetColumnIndex(0);
-        ImGui::Text("PPT VALUE APU");
-        ImGui::TableSetColumnIndex(1);
-        ImGui::Text("%.2f", rs.apu_slow_value);
-        ImGui::TableNextRow();
-        ImGui::TableSetColumnIndex(0);
-        ImGui::Text("TDC LIMIT VDD");
-        ImGui::TableSetColumnIndex(1);
-        ImGui::Text("%.2f", rs.vrm_limit);
-        ImGui::TableNextRow();
-        ImGui::TableSetColumnIndex(0);
-        ImGui::Text("TDC VALUE VDD");
-        ImGui::TableSetColumnIndex(1);
-        ImGui::Text("%.2f", rs.vrm_value);
-        ImGui::TableNextRow();
-        ImGui::TableSetColumnIndex(0);
-        ImGui::Text("TDC LIMIT SOC");
-        ImGui::TableSetColumnIndex(1);
-        ImGui::Text("%.2f", rs.vrm_soc_limit);
-        ImGui::TableNextRow();
-        ImGui::TableSetColumnIndex(0);
-        ImGui::Text("TDC VALUE SOC");
-        ImGui::TableSetColumnIndex(1);
-        ImGui::Text("%.2f", rs.vrm_soc_value);
-        ImGui::TableNextRow();
-        ImGui::TableSetColumnIndex(0);
-        ImGui::Text("EDC LIMIT VDD");
-        ImGui::TableSetColumnIndex(1);
-        ImGui::Text("%.2f", rs.vrm_max_limit);
-        ImGui::TableNextRow();
-        ImGui::TableSetColumnIndex(0);
-        ImGui::Text("EDC VALUE VDD");
-        ImGui::TableSetColumnIndex(1);
-        ImGui::Text("%.2f", rs.vrm_max_value);
-        ImGui::TableNextRow();
-        ImGui::TableSetColumnIndex(0);
-        ImGui::Text("EDC LIMIT SOC");
-        ImGui::TableSetColumnIndex(1);
-        ImGui::Text("%.2f", rs.vrm_soc_max_limit);
-        ImGui::TableNextRow();
-        ImGui::TableSetColumnIndex(0);
-        ImGui::Text("EDC VALUE SOC");
-        ImGui::TableSetColumnIndex(1);
-        ImGui::Text("%.2f", rs.vrm_soc_max_value);
-        ImGui::TableNextRow();
-        ImGui::TableSetColumnIndex(0);
-        ImGui::Text("THM LIMIT CORE");
-        ImGui::TableSetColumnIndex(1);
-        ImGui::Text("%.2f", rs.core_temp_limit);
-        ImGui::TableNextRow();
-        ImGui::TableSetColumnIndex(0);
-        ImGui::Text("THM VALUE CORE");
-        ImGui::TableSetColumnIndex(1);
-        ImGui::Text("%.2f", rs.core_temp_value);
-        ImGui::TableNextRow();
-        ImGui::TableSetColumnIndex(0);
-        ImGui::Text("STT LIMIT APU");
-        ImGui::TableSetColumnIndex(1);
-        ImGui::Text("%.2f", rs.apu_skin_temp_limit);
-        ImGui::TableNextRow();
-        ImGui::TableSetColumnIndex(0);
-        ImGui::Text("STT VALUE APU");
-        ImGui::TableSetColumnIndex(1);
-        ImGui::Text("%.2f", rs.apu_skin_temp_value);
-        ImGui::TableNextRow();
-        ImGui::TableSetColumnIndex(0);
-        ImGui::Text("STT LIMIT dGPU");
-        ImGui::TableSetColumnIndex(1);
-        ImGui::Text("%.2f", rs.dgpu_skin_temp_limit);
-        ImGui::TableNextRow();
-        ImGui::TableSetColumnIndex(0);
-        ImGui::Text("STT VALUE dGPU");
-        ImGui::TableSetColumnIndex(1);
-        ImGui::Text("%.2f", rs.dgpu_skin_temp_value);
-        ImGui::TableNextRow();
-        ImGui::TableSetColumnIndex(0);
-        ImGui::Text("CCLK Boost SETPOINT");
-        ImGui::TableSetColumnIndex(1);
-        ImGui::Text("%.2f", rs.cclk_setpoint);
-        ImGui::TableNextRow();
-        ImGui::TableSetColumnIndex(0);
-        ImGui::Text("CCLK BUSY VALUE");
-        ImGui::TableSetColumnIndex(1);
-        ImGui::Text("%.2f", rs.cclk_busy_value);
+        for (int ch = 0; ch < cpu_utils::CHANNEL_COUNT; ++ch) {
+          const cpu_utils::ChannelInfo & info = cpu_utils::CHANNELS[ch];
+          if (info.kind == cpu_utils::METRIC_LIMIT && info.pair != cpu_utils::CH_NONE) continue;
+          ImGui::TableNextRow();
+          ImGui::TableSetColumnIndex(0);
+          ImGui::TextUnformatted(info.label);
+          ImGui::TableSetColumnIndex(info.kind == cpu_utils::METRIC_LIMIT ? 2 : 1);
+          ImGui::Text(info.format, cpu_utils::channelValue(ry, ch));
+          if (info.pair != cpu_utils::CH_NONE) {
+            ImGui::TableSetColumnIndex(2);
+            ImGui::Text(cpu_utils::CHANNELS[info.pair].format, cpu_utils::channelValue(ry, info.pair));
+          }
+          ImGui::TableSetColumnIndex(3);
+          ImGui::TextUnformatted(info.unit);
+        }
         ImGui::EndTable();
       }
     }
 
-    ImGui::Checkbox("Show Details", &showDetailOverview);
+    if (ImGui::Checkbox("Show Details", &showDetailOverview)) {
+      ctrl->subscribe(showDetailOverview ? cpu_utils::ALL_METRICS : overviewMetrics);
+    }
+    int rate = ctrl->rate();
+    if (ImGui::SliderInt("Sample Rate (Hz)", &rate, cpu_utils::Sampler::MIN_RATE, cpu_utils::Sampler::MAX_RATE)) {
+      ctrl->setRate(rate);
+    }
 
-    static int tdp = rs.stapm_limit;
+    static int tdp = ry.stapm_limit;
+    // the limit only refreshes at the sample rate, so don't resend it every frame
+    static int requestedTdp = ry.stapm_limit;
     static int minTdp = 4;
     static int maxTdp = 20;
+    const auto governor = ctrl->tdpGovernor();
+    const bool governed = governor.mode != cpu_utils::TdpGovernor::OFF;
+    if (governed) {
+      // the governor owns the limit, follow it
+      tdp = ry.stapm_limit;
+      requestedTdp = tdp;
+    }
     if (minTdp > tdp) {
       tdp = minTdp;
     }
     if (maxTdp < tdp) {
       tdp = maxTdp;
     }
+    ImGui::SeparatorText("Profiles");
+    static size_t profileIndex = 0;
+    if (!profiles.empty()) {
+      profileIndex = std::min(profileIndex, profiles.size() - 1);
+      if (ImGui::BeginCombo("##profile", profiles[profileIndex].name.c_str())) {
+        for (size_t p = 0; p < profiles.size(); ++p) {
+          if (ImGui::Selectable(profiles[p].name.c_str(), p == profileIndex)) {
+            profileIndex = p;
+          }
+        }
+        ImGui::EndCombo();
+      }
+      ImGui::SameLine();
+      if (ImGui::Button("Apply")) {
+        ctrl->applyProfile(profiles[profileIndex]);
+      }
+    }
+
     ImGui::SeparatorText("TDP Controls");
 
     // ImGui::Checkbox("Demo Window", &show_demo_window);
 
+    int mode = governor.mode;
+    bool governorChanged = false;
+    if (ImGui::BeginCombo("Mode", cpu_utils::TdpGovernor::modeName(mode))) {
+      for (int m = 0; m < cpu_utils::TdpGovernor::MODE_COUNT; ++m) {
+        if (ImGui::Selectable(cpu_utils::TdpGovernor::modeName(m), m == mode)) {
+          governorChanged = m != mode;
+          mode = m;
+        }
+      }
+      ImGui::EndCombo();
+    }
+    static float targets[cpu_utils::TdpGovernor::MODE_COUNT] = { 0, 40, 12, 10 };
+    if (governed && !governorChanged) {
+      targets[mode] = governor.target;
+    }
+    if (mode != cpu_utils::TdpGovernor::OFF) {
+      const float lo = mode == cpu_utils::TdpGovernor::SKIN_TEMP ? 30 : minTdp;
+      const float hi = mode == cpu_utils::TdpGovernor::SKIN_TEMP ? 60 : maxTdp;
+      char label[32];
+      snprintf(label, sizeof(label), "Target (%s)", cpu_utils::TdpGovernor::modeUnit(mode));
+      governorChanged |= ImGui::SliderFloat(label, &targets[mode], lo, hi, "%.1f");
+    }
+
+    ImGui::BeginDisabled(governed);
     ImGui::SliderInt("TDP (Watt)", &tdp, minTdp, maxTdp);
-    ImGui::SliderInt("Min TDP (Watt)", &minTdp, 4, 10);
-    ImGui::SliderInt("Max TDP (Watt)", &maxTdp, 15, 60);
+    ImGui::EndDisabled();
+    governorChanged |= ImGui::SliderInt("Min TDP (Watt)", &minTdp, 4, 10) && governed;
+    governorChanged |= ImGui::SliderInt("Max TDP (Watt)", &maxTdp, 15, 60) && governed;
+    if (governorChanged) {
+      ctrl->setTdpGovernor({ mode, targets[mode], minTdp, maxTdp });
+    }
+
+    if (ImGui::CollapsingHeader("Session")) {
+      const double seconds = energy.seconds();
+      ImGui::Text("%.1f min, %.2f Wh, %.2f W average", seconds / 60, energy.joules() / 3600, seconds > 0 ? energy.joules() / seconds : 0);
+      ImGui::Text("CCLK busy per watt: %.2f %%/W", energy.busyPerWatt());
+      ImGui::SameLine();
+      if (ImGui::SmallButton("Reset")) {
+        energy.reset();
+      }
+      struct SessionRow {
+        int ch;
+        const cpu_utils::RunningStats & stats;
+      };
+      const SessionRow sessionRows[] = {
+        { cpu_utils::CH_STAPM_FAST_VALUE, energy.power },
+        { cpu_utils::CH_CCLK_BUSY_VALUE, energy.busy },
+        { cpu_utils::CH_CORE_TEMP_VALUE, energy.core_temp },
+        { cpu_utils::CH_APU_SKIN_TEMP_VALUE, energy.skin_temp },
+      };
+      if (ImGui::BeginTable("Session Stats", 6, ImGuiTableFlags_SizingFixedFit | ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders)) {
+        ImGui::TableSetupColumn("Name");
+        ImGui::TableSetupColumn("Mean");
+        ImGui::TableSetupColumn("SD");
+        ImGui::TableSetupColumn("p50");
+        ImGui::TableSetupColumn("p95");
+        ImGui::TableSetupColumn("Max");
+        ImGui::TableHeadersRow();
+        for (const auto & row : sessionRows) {
+          const cpu_utils::ChannelInfo & info = cpu_utils::CHANNELS[row.ch];
+          ImGui::TableNextRow();
+          ImGui::TableSetColumnIndex(0);
+          ImGui::Text("%s (%s)", info.label, info.unit);
+          const double values[] = { row.stats.mean(), row.stats.stddev(), row.stats.quantile(0.5), row.stats.quantile(0.95), row.stats.max() };
+          for (int c = 0; c < 5; ++c) {
+            ImGui::TableSetColumnIndex(c + 1);
+            ImGui::Text("%.1f", values[c]);
+          }
+        }
+        ImGui::EndTable();
+      }
+      // what each setting cost and got done
+      if (ImGui::BeginTable("Session Settings", 6, ImGuiTableFlags_SizingFixedFit | ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders)) {
+        ImGui::TableSetupColumn("TDP");
+        ImGui::TableSetupColumn("Profile");
+        ImGui::TableSetupColumn("Min");
+        ImGui::TableSetupColumn("Wh");
+        ImGui::TableSetupColumn("W");
+        ImGui::TableSetupColumn("%/W");
+        ImGui::TableHeadersRow();
+        for (const auto & setting : energy.settings()) {
+          ImGui::TableNextRow();
+          ImGui::TableSetColumnIndex(0);
+          ImGui::Text("%d", setting.tdp);
+          ImGui::TableSetColumnIndex(1);
+          ImGui::TextUnformatted(setting.profile.empty() ? "-" : setting.profile.c_str());
+          ImGui::TableSetColumnIndex(2);
+          ImGui::Text("%.1f", setting.seconds / 60);
+          ImGui::TableSetColumnIndex(3);
+          ImGui::Text("%.2f", setting.joules / 3600);
+          ImGui::TableSetColumnIndex(4);
+          ImGui::Text("%.2f", setting.watts());
+          ImGui::TableSetColumnIndex(5);
+          ImGui::Text("%.2f", setting.busyPerWatt());
+        }
+        ImGui::EndTable();
+      }
+    }
+
+    // not part of the recording, so nothing to show in a replay
+    coresOpen = !replayPath && ImGui::CollapsingHeader("Cores");
+    if (coresOpen && cores.size() == 0) {
+      if (cs.cpus.empty() && coreCpus.cpus.empty()) {
+        coreCpus.sysfs_root = sysfsRoot;
+        coreCpus.init();
+      }
+      cores.sync(cs.cpus.empty() ? coreCpus : cs);
+      cores.sample();
+    }
+    if (coresOpen) {
+      const cpu_utils::CPUState & cpus = cs.cpus.empty() ? coreCpus : cs;
+      const float cell = ImGui::GetFrameHeight() * 1.5f;
+      const float spacing = ImGui::GetStyle().ItemSpacing.x;
+      const int columns = std::max(1, static_cast<int>((ImGui::GetContentRegionAvail().x + spacing) / (cell + spacing)));
+      ImDrawList * draw = ImGui::GetWindowDrawList();
+      const size_t count = std::min(cpus.cpus.size(), cores.size());
+      for (size_t i = 0; i < count; ++i) {
+        if (i % columns) ImGui::SameLine();
+        ImGui::PushID(static_cast<int>(i));
+        ImGui::InvisibleButton("core", ImVec2(cell, cell));
+        const ImVec2 lo = ImGui::GetItemRectMin();
+        const ImVec2 hi = ImGui::GetItemRectMax();
+        const bool online = std::get<1>(cpus.cpus[i]);
+        const float util = cores.utilization()[i];
+        // green when idle, red when busy
+        draw->AddRectFilled(lo, hi, online ? ImColor::HSV(0.33f * (1 - util), 0.7f, 0.5f) : ImColor(0.2f, 0.2f, 0.2f));
+        if (online) {
+          const int points = cores.history(i, coreHistory);
+          for (int p = 0; p < points; ++p) {
+            coreLine[p] = ImVec2(lo.x + (hi.x - lo.x) * p / (cpu_utils::CoreSampler::HISTORY - 1), hi.y - (hi.y - lo.y) * coreHistory[p]);
+          }
+          draw->AddPolyline(coreLine, points, IM_COL32(255, 255, 255, 128), 0, 1.0f);
+          char freq[8];
+          snprintf(freq, sizeof(freq), "%.1f", cores.freqMhz()[i] * 1e-3f);
+          draw->AddText(ImVec2(lo.x + 2, lo.y + 1), IM_COL32_WHITE, freq);
+        }
+        if (ImGui::IsItemHovered()) {
+          const auto & topo = i < cpus.topology.size() ? cpus.topology.cpus[i] : cpu_utils::CpuTopology::Cpu{};
+          const auto & f = i < cpus.freq.size() ? cpus.freq[i] : cpu_utils::CpuFreq{};
+          if (online && f.ranking >= 0) {
+            ImGui::SetTooltip("CPU %zu: %.0f MHz, %.0f%% busy\nCore %d, CCX %d\nRange %d-%d MHz, ranking %d, highest perf %d", i,
+                              cores.freqMhz()[i], util * 100, topo.core, topo.ccx, f.scaling_min_khz / 1000, f.scaling_max_khz / 1000,
+                              f.ranking, f.highest_perf);
+          } else if (online) {
+            ImGui::SetTooltip("CPU %zu: %.0f MHz, %.0f%% busy\nCore %d, CCX %d", i, cores.freqMhz()[i], util * 100, topo.core, topo.ccx);
+          } else {
+            ImGui::SetTooltip("CPU %zu: offline", i);
+          }
+        }
+        ImGui::PopID();
+      }
+    }
+
+    // the power is split by CPU time, the GPU's share included
+    processesOpen = !replayPath && ImGui::CollapsingHeader("Processes");
+    if (processesOpen && ImGui::BeginTable("processes_table", 4, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+      ImGui::TableSetupColumn("PID");
+      ImGui::TableSetupColumn("Name");
+      ImGui::TableSetupColumn("CPU %");
+      ImGui::TableSetupColumn("W");
+      ImGui::TableHeadersRow();
+      const int count = processes.top(topProcesses, IM_ARRAYSIZE(topProcesses));
+      for (int i = 0; i < count; ++i) {
+        const auto & p = topProcesses[i];
+        ImGui::TableNextRow();
+        ImGui::TableSetColumnIndex(0);
+        ImGui::Text("%d", p.pid);
+        ImGui::TableSetColumnIndex(1);
+        ImGui::TextUnformatted(p.comm);
+        ImGui::TableSetColumnIndex(2);
+        ImGui::Text("%.1f", p.cpu * 100);
+        ImGui::TableSetColumnIndex(3);
+        ImGui::Text("%.2f", p.watts);
+      }
+      ImGui::EndTable();
+    }
 
-    static bool smt = true;
-    static bool boost = true;
     ImGui::SeparatorText("CPU Options");
-    ImGui::Checkbox("Enable SMT", &smt);
-    ImGui::Checkbox("Enable Boost", &boost);
+    bool smt = cs.smt == 1;
+    ImGui::BeginDisabled(cs.smt < 0);
+    if (ImGui::Checkbox("Enable SMT", &smt)) {
+      ctrl->setSmt(smt);
+    }
+    ImGui::EndDisabled();
+    bool boost = cs.boost == 1;
+    ImGui::BeginDisabled(cs.boost < 0);
+    if (ImGui::Checkbox("Enable Boost", &boost)) {
+      ctrl->setBoost(boost);
+    }
+    ImGui::EndDisabled();
+
+    if (!cs.pstate_status.empty() && ImGui::BeginCombo("amd-pstate", cs.pstate_status.c_str())) {
+      for (const auto & status : cs.pstate_statuses) {
+        if (ImGui::Selectable(status.c_str(), status == cs.pstate_status)) {
+          ctrl->setPstateStatus(status);
+        }
+      }
+      ImGui::EndCombo();
+    }
+
+    // the range every online CPU can do, preferred cores may go higher
+    int freqLo = 0, freqHi = 0;
+    for (size_t i = 0; i < cs.freq.size(); ++i) {
+      if (cs.freq[i].max_khz < 0) continue;
+      freqLo = freqLo ? std::min(freqLo, cs.freq[i].min_khz / 1000) : cs.freq[i].min_khz / 1000;
+      freqHi = std::max(freqHi, cs.freq[i].max_khz / 1000);
+    }
+    if (freqHi > freqLo && ImGui::TreeNode("Frequency")) {
+      static char freqCpus[64] = "";
+      static int freqRange[2] = { 0, 0 };
+      if (freqRange[1] == 0) {
+        freqRange[0] = freqLo;
+        freqRange[1] = freqHi;
+      }
+      ImGui::InputTextWithHint("CPUs", "all, or e.g. 0-3,8", freqCpus, sizeof(freqCpus));
+      ImGui::SliderInt("Min (MHz)", &freqRange[0], freqLo, freqHi);
+      ImGui::SliderInt("Max (MHz)", &freqRange[1], freqLo, freqHi);
+      if (ImGui::Button("Apply##freq")) {
+        std::vector<int> targets = cpu_utils::parseCpuList(freqCpus);
+        // the daemon sends freq but not the CPU list
+        if (!freqCpus[0]) {
+          for (size_t i = 0; i < cs.freq.size(); ++i) targets.push_back(i);
+        }
+        if (!targets.empty()) {
+          ctrl->setFreqRange(targets, std::min(freqRange[0], freqRange[1]) * 1000, std::max(freqRange[0], freqRange[1]) * 1000);
+        }
+      }
+
+      // steer a game onto the best cores, cap the others
+      const cpu_utils::CoreSteering::Settings & steering = ctrl->steering();
+      static cpu_utils::CoreSteering::Settings steer;
+      ImGui::SeparatorText("Preferred Cores");
+      ImGui::InputInt("PID", &steer.pid, 0);
+      ImGui::SliderInt("Cores", &steer.cores, 1, std::max(1, static_cast<int>(cs.freq.size())));
+      int capMhz = steer.cap_khz / 1000;
+      if (ImGui::SliderInt("Cap the rest (MHz)", &capMhz, 0, freqHi, capMhz ? "%d" : "off")) {
+        steer.cap_khz = capMhz < freqLo ? 0 : capMhz * 1000;
+      }
+      ImGui::BeginDisabled(steer.pid <= 0);
+      if (ImGui::Button("Steer")) {
+        ctrl->steer(steer);
+      }
+      ImGui::EndDisabled();
+      ImGui::BeginDisabled(steering.pid == 0);
+      ImGui::SameLine();
+      if (ImGui::Button("Release")) {
+        ctrl->steer({ 0, steering.cores, 0 });
+      }
+      ImGui::EndDisabled();
+      if (steering.pid) {
+        ImGui::Text("PID %d on its %d best cores", steering.pid, steering.cores);
+      }
+      ImGui::TreePop();
+    }
+
+    // edits stay local until applied, the search itself runs in the daemon
+    const std::vector<int> & curve = ctrl->curve();
+    if (!curve.empty() && ImGui::TreeNode("Curve Optimizer")) {
+      static std::vector<int> curveEdit;
+      static int curveAll = 0;
+      if (curveEdit.size() != curve.size()) curveEdit = curve;
+      if (ImGui::SliderInt("All cores", &curveAll, -30, 0)) {
+        std::fill(curveEdit.begin(), curveEdit.end(), curveAll);
+      }
+      for (size_t i = 0; i < curveEdit.size(); ++i) {
+        char label[16];
+        snprintf(label, sizeof(label), "Core %zu", i);
+        ImGui::SliderInt(label, &curveEdit[i], -30, 0);
+      }
+      ImGui::BeginDisabled(curveEdit == curve);
+      if (ImGui::Button("Apply##curve")) {
+        ctrl->setCurve(curveEdit);
+      }
+      ImGui::SameLine();
+      if (ImGui::Button("Revert##curve")) {
+        curveEdit = curve;
+      }
+      ImGui::EndDisabled();
+      ImGui::TextDisabled("Untested offsets can hang the machine,\nsimpletdpd --curve-search finds stable ones");
+      ImGui::TreePop();
+    }
 
     ImGui::SeparatorText("Power Options");
     if (!cs.scaling_available_governors.empty()){
@@ -338,8 +786,8 @@ int main(){
           ImGui::TableNextRow();
           ImGui::TableSetColumnIndex(0);
           if(ImGui::Selectable(option.c_str(), option == cs.scaling_governor)) {
-            cs.setScalingGovernor(option);
-            cs.init();
+            ctrl->setScalingGovernor(option);
+            break;
           }
         }
         ImGui::EndTable();
@@ -353,8 +801,8 @@ int main(){
           ImGui::TableNextRow();
           ImGui::TableSetColumnIndex(0);
           if(ImGui::Selectable(option.c_str(), option == cs.epp)) {
-            cs.setEPP(option);
-            cs.init();
+            ctrl->setEPP(option);
+            break;
           }
         }
         ImGui::EndTable();
@@ -362,32 +810,145 @@ int main(){
     }
 
     ImGui::SeparatorText("GPU Options");
-    ImGui::Text("todo");
+    const cpu_utils::GpuState & gs = ctrl->gpuState();
+    if (!gpu.ready()) {
+      ImGui::TextDisabled("No amdgpu card");
+    } else {
+      const cpu_utils::GpuTelemetry & gt = gpu.latest();
+      char overlay[32];
+      snprintf(overlay, sizeof(overlay), "%.0f%% busy", gt.busy);
+      ImGui::PlotLines("GPU", gpuHistory, gpu.history(gpuHistory), 0, overlay, 0, 100);
+      ImGui::Text("SCLK %.0f MHz, MCLK %.0f MHz", gt.sclk_mhz, gt.mclk_mhz);
+      if (gt.power_w >= 0) {
+        ImGui::SameLine();
+        ImGui::Text(", %.1f W", gt.power_w);
+      }
+      ImGui::Text("VRAM %.0f / %.0f MB, GTT %.0f / %.0f MB", gt.vram_used_mb, gt.vram_total_mb, gt.gtt_used_mb, gt.gtt_total_mb);
 
-    ImGui::End();
-    ImGui::Render();
+      if (ImGui::BeginCombo("Performance Level", gs.performance_level.c_str())) {
+        for (const auto & level : gs.performance_levels) {
+          if (ImGui::Selectable(level.c_str(), level == gs.performance_level)) {
+            ctrl->setGpuPerformanceLevel(level);
+          }
+        }
+        ImGui::EndCombo();
+      }
+      // the sliders only send once let go, each write is a round of SMU messages
+      static int sclk[2] = { -1, -1 };
+      if (gs.sclk_lo >= 0) {
+        if (!ImGui::IsAnyItemActive()) {
+          sclk[0] = gs.sclk_min;
+          sclk[1] = gs.sclk_max;
+        }
+        ImGui::SliderInt("Min SCLK (MHz)", &sclk[0], gs.sclk_lo, gs.sclk_hi);
+        bool release = ImGui::IsItemDeactivatedAfterEdit();
+        ImGui::SliderInt("Max SCLK (MHz)", &sclk[1], gs.sclk_lo, gs.sclk_hi);
+        release |= ImGui::IsItemDeactivatedAfterEdit();
+        if (release) {
+          ctrl->setGpuSclk(std::min(sclk[0], sclk[1]), std::max(sclk[0], sclk[1]));
+        }
+      }
+      if (!gs.power_profiles.empty()) {
+        const char * current = gs.power_profile >= 0 ? gs.power_profiles[gs.power_profile].c_str() : "";
+        if (ImGui::BeginCombo("Power Profile", current)) {
+          for (size_t p = 0; p < gs.power_profiles.size(); ++p) {
+            if (ImGui::Selectable(gs.power_profiles[p].c_str(), static_cast<int>(p) == gs.power_profile)) {
+              ctrl->setGpuPowerProfile(p);
+            }
+          }
+          ImGui::EndCombo();
+        }
+      }
+    }
 
-    // Update states
-    if(tdp != rs.stapm_limit) {
-      rs.setTdp(tdp);
+    ImGui::Separator();
+    ImGui::TextDisabled("UI: %.1f fps, %.1f%% CPU, %llu frames", uiFps, uiCpu, static_cast<unsigned long long>(frameCount));
+    ImGui::SameLine();
+    if (ImGui::Checkbox("Profiler", &showProfiler)) {
+      cpu_utils::trace::setEnabled(showProfiler || tracePath);
     }
-    if(smt != smtEnabled){
-      // TODO: smt
-      printf("toggling smt\n");
-      smtEnabled = smt;
+    ImGui::TextDisabled("SMU: %llu limit writes, %llu skipped, %llu requests coalesced",
+                        static_cast<unsigned long long>(snap.smu.calls), static_cast<unsigned long long>(snap.smu.skipped),
+                        static_cast<unsigned long long>(snap.smu.coalesced));
+
+    ImGui::End();
+
+    if (showProfiler) {
+      // refreshed twice a second, it allocates
+      if (double now = clock_seconds(CLOCK_MONOTONIC); now - spanStatsTime >= 0.5) {
+        spanStats = cpu_utils::trace::stats(PROFILER_WINDOW_NS);
+        spanStatsTime = now;
+      }
+      ImGui::SetNextWindowPos(ImVec2(viewport->Pos.x + 20, viewport->Pos.y + 20), ImGuiCond_FirstUseEver);
+      if (ImGui::Begin("Profiler", &showProfiler, ImGuiWindowFlags_AlwaysAutoResize)) {
+        ImGui::TextDisabled("last %d s", static_cast<int>(PROFILER_WINDOW_NS / 1000000000));
+        if (ImGui::BeginTable("Spans", 5, ImGuiTableFlags_SizingFixedFit | ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders)) {
+          ImGui::TableSetupColumn("Span");
+          ImGui::TableSetupColumn("Count");
+          ImGui::TableSetupColumn("p50 (us)");
+          ImGui::TableSetupColumn("p99 (us)");
+          ImGui::TableSetupColumn("Max (us)");
+          ImGui::TableHeadersRow();
+          for (const auto & span : spanStats) {
+            ImGui::TableNextRow();
+            ImGui::TableSetColumnIndex(0);
+            ImGui::TextUnformatted(span.name.c_str());
+            ImGui::TableSetColumnIndex(1);
+            ImGui::Text("%zu", span.count);
+            ImGui::TableSetColumnIndex(2);
+            ImGui::Text("%.1f", span.p50_us);
+            ImGui::TableSetColumnIndex(3);
+            ImGui::Text("%.1f", span.p99_us);
+            ImGui::TableSetColumnIndex(4);
+            ImGui::Text("%.1f", span.max_us);
+          }
+          ImGui::EndTable();
+        }
+        if (ImGui::Button("Dump Trace")) {
+          dumpStatus = cpu_utils::trace::dump(dumpPath) ? "Wrote " + dumpPath : "Unable to write " + dumpPath;
+        }
+        if (!dumpStatus.empty()) {
+          ImGui::SameLine();
+          ImGui::TextUnformatted(dumpStatus.c_str());
+        }
+      }
+      ImGui::End();
+      if (!showProfiler) {
+        cpu_utils::trace::setEnabled(tracePath != nullptr);
+      }
     }
-    if(boost != boostEnabled){
-      // TODO: boost
-      printf("toggling boost\n");
-      boostEnabled = boost;
+
+    ImGui::Render();
+    layoutSpan.end();
+
+    // Update states, the SMU side only passes on real changes
+    if(!governed && tdp != requestedTdp) {
+      ctrl->setTdp(tdp);
+      requestedTdp = tdp;
     }
 
     // glViewport(0, 0, (int)io.DisplaySize.x, (int)io.DisplaySize.y);
     // glClear(GL_COLOR_BUFFER_BIT);
-    ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
-    SDL_GL_SwapWindow(window);
+    {
+      TRACE_SPAN("render");
+      ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+    }
+    {
+      TRACE_SPAN("swap");
+      SDL_GL_SwapWindow(window);
+    }
+  }
+  if (tracePath && !cpu_utils::trace::dump(tracePath)) {
+    printf("Error: cannot write %s\n", tracePath);
   }
   // Cleanup
+  ctrl.reset();
+  const double runTime = clock_seconds(CLOCK_MONOTONIC) - startTime;
+  printf("Rendered %llu frames in %.1f s, %.2f s CPU time\n", static_cast<unsigned long long>(frameCount), runTime, clock_seconds(CLOCK_PROCESS_CPUTIME_ID) - startCpu);
+  if (energy.seconds() > 0) {
+    printf("Session: %.1f min, %.2f Wh, %.2f W average, %.2f %%/W CCLK busy\n",
+           energy.seconds() / 60, energy.joules() / 3600, energy.joules() / energy.seconds(), energy.busyPerWatt());
+  }
   ImGui_ImplOpenGL3_Shutdown();
   ImGui_ImplSDL2_Shutdown();
   ImGui::DestroyContext();
@@ -0,0 +1,82 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+// Every metric read from the PM table, in RyzenTelemetry and channel order.
+// Appending is fine, older recorded logs replay the new ones as NaN (0 for
+// an int). Reordering breaks them.
+//
+// X(ID, field, type, kind, pair, label, unit, format, getter)
+//   kind    LIMIT, VALUE or PARAM
+//   pair    the limit of a VALUE and the value of a LIMIT, NONE if it has none
+//   label   what the detail view calls it, shared by a limit and its value
+//   getter  the libryzenadj call that reads it
+#define RYZEN_METRICS(X) \
+  X(STAPM_LIMIT,          stapm_limit,          int,   LIMIT, STAPM_VALUE,          "STAPM",            "W", "%.0f", get_stapm_limit) \
+  X(STAPM_FAST_LIMIT,     stapm_fast_limit,     int,   LIMIT, STAPM_FAST_VALUE,     "PPT FAST",         "W", "%.0f", get_fast_limit) \
+  X(STAPM_SLOW_LIMIT,     stapm_slow_limit,     int,   LIMIT, STAPM_SLOW_VALUE,     "PPT SLOW",         "W", "%.0f", get_slow_limit) \
+  X(APU_SLOW_LIMIT,       apu_slow_limit,       int,   LIMIT, APU_SLOW_VALUE,       "PPT APU",          "W", "%.0f", get_apu_slow_limit) \
+  X(STAPM_VALUE,          stapm_value,          float, VALUE, STAPM_LIMIT,          "STAPM",            "W", "%.2f", get_stapm_value) \
+  X(STAPM_FAST_VALUE,     stapm_fast_value,     float, VALUE, STAPM_FAST_LIMIT,     "PPT FAST",         "W", "%.2f", get_fast_value) \
+  X(STAPM_SLOW_VALUE,     stapm_slow_value,     float, VALUE, STAPM_SLOW_LIMIT,     "PPT SLOW",         "W", "%.2f", get_slow_value) \
+  X(APU_SLOW_VALUE,       apu_slow_value,       float, VALUE, APU_SLOW_LIMIT,       "PPT APU",          "W", "%.2f", get_apu_slow_value) \
+  X(STAPM_TIME,           stapm_time,           float, PARAM, NONE,                 "StapmTimeConst",   "s", "%.2f", get_stapm_time) \
+  X(STAPM_SLOW_TIME,      stapm_slow_time,      float, PARAM, NONE,                 "SlowPPTTimeConst", "s", "%.2f", get_slow_time) \
+  X(VRM_LIMIT,            vrm_limit,            float, LIMIT, VRM_VALUE,            "TDC VDD",          "A", "%.2f", get_vrm_current) \
+  X(VRM_VALUE,            vrm_value,            float, VALUE, VRM_LIMIT,            "TDC VDD",          "A", "%.2f", get_vrm_current_value) \
+  X(VRM_SOC_LIMIT,        vrm_soc_limit,        float, LIMIT, VRM_SOC_VALUE,        "TDC SOC",          "A", "%.2f", get_vrmsoc_current) \
+  X(VRM_SOC_VALUE,        vrm_soc_value,        float, VALUE, VRM_SOC_LIMIT,        "TDC SOC",          "A", "%.2f", get_vrmsoc_current_value) \
+  X(VRM_MAX_LIMIT,        vrm_max_limit,        float, LIMIT, VRM_MAX_VALUE,        "EDC VDD",          "A", "%.2f", get_vrmmax_current) \
+  X(VRM_MAX_VALUE,        vrm_max_value,        float, VALUE, VRM_MAX_LIMIT,        "EDC VDD",          "A", "%.2f", get_vrmmax_current_value) \
+  X(VRM_SOC_MAX_LIMIT,    vrm_soc_max_limit,    float, LIMIT, VRM_SOC_MAX_VALUE,    "EDC SOC",          "A", "%.2f", get_vrmsocmax_current) \
+  X(VRM_SOC_MAX_VALUE,    vrm_soc_max_value,    float, VALUE, VRM_SOC_MAX_LIMIT,    "EDC SOC",          "A", "%.2f", get_vrmsocmax_current_value) \
+  X(CORE_TEMP_LIMIT,      core_temp_limit,      float, LIMIT, CORE_TEMP_VALUE,      "THM CORE",         "C", "%.2f", get_tctl_temp) \
+  X(CORE_TEMP_VALUE,      core_temp_value,      float, VALUE, CORE_TEMP_LIMIT,      "THM CORE",         "C", "%.2f", get_tctl_temp_value) \
+  X(APU_SKIN_TEMP_LIMIT,  apu_skin_temp_limit,  float, LIMIT, APU_SKIN_TEMP_VALUE,  "STT APU",          "C", "%.2f", get_apu_skin_temp_limit) \
+  X(APU_SKIN_TEMP_VALUE,  apu_skin_temp_value,  float, VALUE, APU_SKIN_TEMP_LIMIT,  "STT APU",          "C", "%.2f", get_apu_skin_temp_value) \
+  X(DGPU_SKIN_TEMP_LIMIT, dgpu_skin_temp_limit, float, LIMIT, DGPU_SKIN_TEMP_VALUE, "STT dGPU",         "C", "%.2f", get_dgpu_skin_temp_limit) \
+  X(DGPU_SKIN_TEMP_VALUE, dgpu_skin_temp_value, float, VALUE, DGPU_SKIN_TEMP_LIMIT, "STT dGPU",         "C", "%.2f", get_dgpu_skin_temp_value) \
+  X(CCLK_SETPOINT,        cclk_setpoint,        float, PARAM, NONE,                 "CCLK Boost SETPOINT", "", "%.2f", get_cclk_setpoint) \
+  X(CCLK_BUSY_VALUE,      cclk_busy_value,      float, VALUE, NONE,                 "CCLK BUSY",        "%", "%.2f", get_cclk_busy_value)
+
+#include <cstdint>
+
+namespace cpu_utils {
+
+// One channel per metric
+enum Channel {
+  CH_NONE = -1,
+#define X(ID, ...) CH_##ID,
+  RYZEN_METRICS(X)
+#undef X
+  CHANNEL_COUNT
+};
+
+// a bit per channel, what a consumer reads
+using MetricMask = uint64_t;
+
+constexpr MetricMask metricBit(int ch) {
+  return MetricMask(1) << ch;
+}
+
+constexpr MetricMask ALL_METRICS = metricBit(CHANNEL_COUNT) - 1;
+
+static_assert(CHANNEL_COUNT <= 64, "MetricMask is out of bits");
+
+}
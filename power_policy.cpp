@@ -0,0 +1,130 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "power_policy.h"
+#include "clock.h"
+
+#include <algorithm>
+#include <charconv>
+#include <ctime>
+#include <fstream>
+
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace cpu_utils {
+
+namespace {
+
+static std::string read_line(const std::filesystem::path & path)
+{
+  std::ifstream input (path);
+  std::string line;
+  std::getline(input, line);
+  return line;
+}
+
+static int read_int(const std::filesystem::path & path, int fallback)
+{
+  const std::string line = read_line(path);
+  int value;
+  auto [end, ec] = std::from_chars(line.data(), line.data() + line.size(), value);
+  return ec == std::errc() ? value : fallback;
+}
+
+}
+
+PowerSource readPowerSource(const std::filesystem::path & sysfs_root) {
+  PowerSource source;
+  bool online = false;
+  int batteries = 0;
+  int capacity = 0;
+  std::error_code ec;
+  for (const auto & entry : std::filesystem::directory_iterator(sysfs_root / "class" / "power_supply", ec)) {
+    const auto & dir = entry.path();
+    const std::string type = read_line(dir / "type");
+    if (type == "Mains" || type == "USB") {
+      online |= read_int(dir / "online", 0) == 1;
+    } else if (type == "Battery" && read_line(dir / "scope") != "Device") {
+      // scope Device is a controller or mouse, not what powers us
+      const int percent = read_int(dir / "capacity", -1);
+      if (percent < 0) continue;
+      capacity += percent;
+      ++batteries;
+    }
+  }
+  source.ac = online || batteries == 0;
+  source.capacity = batteries ? capacity / batteries : -1;
+  return source;
+}
+
+bool PowerPolicy::empty() const {
+  return ac.empty() && battery.empty() && low_battery.empty();
+}
+
+const std::string & PowerPolicy::select(const PowerSource & source) const {
+  if (source.ac) return ac;
+  const Rule * match = nullptr;
+  for (const auto & rule : low_battery) {
+    if (source.capacity >= 0 && source.capacity <= rule.percent && (!match || rule.percent < match->percent)) {
+      match = &rule;
+    }
+  }
+  return match ? match->profile : battery;
+}
+
+PowerMonitor::PowerMonitor(const std::filesystem::path & sysfs_root, int debounce_ms)
+  : _sysfs_root(sysfs_root), _debounce_ms(debounce_ms) {
+  _timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (_timer < 0) {
+    throw "Unable to create the power source timer";
+  }
+}
+
+PowerMonitor::~PowerMonitor() {
+  // the monitor arms the timer, stop it first
+  _monitor.stop();
+  close(_timer);
+}
+
+bool PowerMonitor::start() {
+  return _monitor.start("power_supply", [this](const Uevent &) {
+    uint64_t none = 0;
+    _first_ns.compare_exchange_strong(none, monotonicNs(), std::memory_order_relaxed);
+    // every event pushes the deadline back, a zero value would disarm it
+    itimerspec deadline {};
+    const long ns = std::max<long>(_debounce_ms * 1000000l, 1);
+    deadline.it_value.tv_sec = ns / 1000000000l;
+    deadline.it_value.tv_nsec = ns % 1000000000l;
+    timerfd_settime(_timer, 0, &deadline, nullptr);
+  });
+}
+
+int PowerMonitor::fd() const {
+  return _timer;
+}
+
+PowerSource PowerMonitor::settle(double & waited_ms) {
+  uint64_t expirations;
+  [[maybe_unused]] auto n = read(_timer, &expirations, sizeof(expirations));
+  const uint64_t first_ns = _first_ns.exchange(0, std::memory_order_relaxed);
+  waited_ms = first_ns ? (monotonicNs() - first_ns) * 1e-6 : 0;
+  return readPowerSource(_sysfs_root);
+}
+
+}
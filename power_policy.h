@@ -0,0 +1,81 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "uevent.h"
+
+namespace cpu_utils {
+
+// What the machine runs on, from class/power_supply.
+struct PowerSource {
+  // any mains or USB supply online, or no battery at all
+  bool ac = true;
+  // mean charge of the system batteries in percent, -1 without one
+  int capacity = -1;
+};
+
+PowerSource readPowerSource(const std::filesystem::path & sysfs_root);
+
+// Which profile to run on AC, on battery, and below battery thresholds.
+// Empty names leave the settings alone.
+struct PowerPolicy {
+  struct Rule {
+    int percent;  // at or below
+    std::string profile;
+  };
+
+  std::string ac;
+  std::string battery;
+  // the lowest matching threshold wins
+  std::vector<Rule> low_battery;
+  int debounce_ms = 1000;
+
+  bool empty() const;
+  const std::string & select(const PowerSource & source) const;
+};
+
+// Turns power_supply uevents into one wakeup once they stopped for the
+// debounce time: fd() becomes readable, then call settle().
+struct PowerMonitor {
+  PowerMonitor(const std::filesystem::path & sysfs_root, int debounce_ms);
+
+  ~PowerMonitor();
+
+  // false if the uevent socket can't be opened
+  bool start();
+  int fd() const;
+  // the source now, and how long ago the first uevent since the last call
+  // arrived
+  PowerSource settle(double & waited_ms);
+
+private:
+  std::filesystem::path _sysfs_root;
+  int _debounce_ms;
+  int _timer;
+  std::atomic<uint64_t> _first_ns { 0 };
+  UeventMonitor _monitor;
+};
+
+}
@@ -0,0 +1,244 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "process_sampler.h"
+#include "clock.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace cpu_utils {
+
+namespace {
+
+static uint64_t parse_uint(const char *& p, const char * end)
+{
+  while (p < end && *p == ' ') ++p;
+  uint64_t value = 0;
+  while (p < end && *p >= '0' && *p <= '9') {
+    value = value * 10 + (*p++ - '0');
+  }
+  return value;
+}
+
+static void skip_field(const char *& p, const char * end)
+{
+  while (p < end && *p == ' ') ++p;
+  while (p < end && *p != ' ') ++p;
+}
+
+// 0 unless the whole name is a pid
+static int parse_pid(const char * name)
+{
+  int pid = 0;
+  for (; *name; ++name) {
+    if (*name < '0' || *name > '9') return 0;
+    pid = pid * 10 + (*name - '0');
+  }
+  return pid;
+}
+
+static size_t hash(int pid)
+{
+  // Fibonacci hashing, pids are mostly sequential
+  return static_cast<size_t>(static_cast<uint32_t>(pid) * 2654435769u);
+}
+
+}
+
+ProcessSampler::ProcessSampler(const std::filesystem::path & proc_root)
+  : _proc_fd(open(proc_root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)), _dents(32768), _stat_buf(1024),
+    _tick_s(1.0 / sysconf(_SC_CLK_TCK)), _table(1024) {}
+
+ProcessSampler::~ProcessSampler() {
+  if (_proc_fd >= 0) close(_proc_fd);
+}
+
+uint64_t ProcessSampler::sample(float package_w) {
+  TRACE_SPAN("process_sample");
+  const uint64_t start = monotonicNs();
+  _package_w = package_w;
+  if (_proc_fd < 0) return 0;
+  for (int done = 0;; ++done) {
+    if (done % 16 == 15 && monotonicNs() - start > BUDGET_NS) break;
+    if (_dent_pos >= _dent_len) {
+      const ssize_t len = getdents64(_proc_fd, _dents.data(), _dents.size());
+      if (len <= 0) {
+        // the end of /proc, or a failed read: the next walk starts over
+        lseek(_proc_fd, 0, SEEK_SET);
+        _dent_pos = _dent_len = 0;
+        if (len == 0) sweep();
+        break;
+      }
+      _dent_pos = 0;
+      _dent_len = len;
+    }
+    const auto * dent = reinterpret_cast<const dirent64 *>(_dents.data() + _dent_pos);
+    _dent_pos += dent->d_reclen;
+    if (const int pid = parse_pid(dent->d_name)) {
+      read(pid, monotonicNs());
+    }
+  }
+  return monotonicNs() - start;
+}
+
+void ProcessSampler::read(int pid, uint64_t now) {
+  char path[32];
+  snprintf(path, sizeof(path), "%d/stat", pid);
+  const int fd = openat(_proc_fd, path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return;
+  const ssize_t len = pread(fd, _stat_buf.data(), _stat_buf.size(), 0);
+  close(fd);
+  if (len <= 0) return;
+  const char * buf = _stat_buf.data();
+  const char * end = buf + len;
+  // comm may hold spaces and parentheses, it ends at the last ')'
+  const char * open = static_cast<const char *>(memchr(buf, '(', len));
+  const char * close = open;
+  for (const char * p = end - 1; p > open; --p) {
+    if (*p == ')') {
+      close = p;
+      break;
+    }
+  }
+  if (!open || close == open) return;
+  // state is field 3, utime and stime 14 and 15, starttime 22
+  const char * p = close + 1;
+  for (int field = 3; field < 14; ++field) skip_field(p, end);
+  const uint64_t ticks = parse_uint(p, end) + parse_uint(p, end);
+  for (int field = 16; field < 22; ++field) skip_field(p, end);
+  const uint64_t started = parse_uint(p, end);
+
+  Entry * entry = find(pid);
+  if (entry && entry->start != started) {
+    // the pid was reused
+    _cpu_total -= entry->cpu;
+    erase(entry - _table.data());
+    entry = nullptr;
+  }
+  if (!entry) {
+    entry = insert(pid);
+    if (!entry) return;
+    entry->start = started;
+    entry->ticks = ticks;
+    entry->read_ns = now;
+    entry->cpu = 0;
+    const size_t n = std::min<size_t>(close - open - 1, sizeof(entry->comm) - 1);
+    memcpy(entry->comm, open + 1, n);
+    entry->comm[n] = 0;
+  } else if (now > entry->read_ns) {
+    const float cpu = (ticks - entry->ticks) * _tick_s / ((now - entry->read_ns) * 1e-9);
+    _cpu_total += cpu - entry->cpu;
+    entry->cpu = cpu;
+    entry->ticks = ticks;
+    entry->read_ns = now;
+  }
+  entry->pass = _pass;
+}
+
+ProcessSampler::Entry * ProcessSampler::find(int pid) {
+  const size_t mask = _table.size() - 1;
+  for (size_t slot = hash(pid) & mask;; slot = (slot + 1) & mask) {
+    if (_table[slot].pid == pid) return &_table[slot];
+    if (_table[slot].pid == 0) return nullptr;
+  }
+}
+
+ProcessSampler::Entry * ProcessSampler::insert(int pid) {
+  // at most half full, probes stay short
+  if ((_used + 1) * 2 > _table.size()) grow();
+  const size_t mask = _table.size() - 1;
+  size_t slot = hash(pid) & mask;
+  while (_table[slot].pid != 0) slot = (slot + 1) & mask;
+  _table[slot] = Entry {};
+  _table[slot].pid = pid;
+  ++_used;
+  return &_table[slot];
+}
+
+void ProcessSampler::erase(size_t slot) {
+  // backward shift, so lookups never need tombstones
+  const size_t mask = _table.size() - 1;
+  size_t hole = slot;
+  for (size_t next = (slot + 1) & mask; _table[next].pid != 0; next = (next + 1) & mask) {
+    const size_t home = hash(_table[next].pid) & mask;
+    // moves back unless its home lies in (hole, next]
+    if (((next - home) & mask) >= ((next - hole) & mask)) {
+      _table[hole] = _table[next];
+      hole = next;
+    }
+  }
+  _table[hole].pid = 0;
+  --_used;
+}
+
+void ProcessSampler::grow() {
+  std::vector<Entry> old (_table.size() * 2);
+  old.swap(_table);
+  _used = 0;
+  for (const auto & entry : old) {
+    if (entry.pid) *insert(entry.pid) = entry;
+  }
+}
+
+void ProcessSampler::sweep() {
+  for (size_t slot = 0; slot < _table.size();) {
+    if (_table[slot].pid && _table[slot].pass != _pass) {
+      // the next entry may have shifted into this slot
+      erase(slot);
+    } else {
+      ++slot;
+    }
+  }
+  // drifts with every update otherwise
+  _cpu_total = 0;
+  for (const auto & entry : _table) {
+    if (entry.pid) _cpu_total += entry.cpu;
+  }
+  ++_pass;
+}
+
+int ProcessSampler::top(ProcessPower * out, int count) const {
+  int n = 0;
+  for (const auto & entry : _table) {
+    if (!entry.pid) continue;
+    // insertion into the few slots asked for
+    int at = n;
+    while (at > 0 && out[at - 1].cpu < entry.cpu) --at;
+    if (at >= count) continue;
+    std::copy_backward(out + at, out + std::min(n, count - 1), out + std::min(n + 1, count));
+    ProcessPower & p = out[at];
+    p.pid = entry.pid;
+    memcpy(p.comm, entry.comm, sizeof(p.comm));
+    p.cpu = entry.cpu;
+    p.watts = _cpu_total > 0 ? _package_w * entry.cpu / _cpu_total : 0;
+    n = std::min(n + 1, count);
+  }
+  return n;
+}
+
+size_t ProcessSampler::size() const {
+  return _used;
+}
+
+}
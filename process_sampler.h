@@ -0,0 +1,96 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+namespace cpu_utils {
+
+struct ProcessPower {
+  int pid;
+  char comm[16];
+  float cpu;      // CPUs worth of time, 1 is one CPU busy
+  float watts;
+};
+
+// Splits package power between processes by their share of the CPU time
+// used since the last sample, like top does for CPU time. /proc is walked
+// with getdents64 and each stat is read with openat and pread, into
+// buffers that are reused, and processes are kept in a table keyed by pid,
+// so once it has grown a scan allocates nothing. Needs no privileges.
+struct ProcessSampler {
+  // a sample() stops walking /proc once it took this long and carries on
+  // from there next time, a process is attributed once per full walk
+  static constexpr uint64_t BUDGET_NS = 1000000;
+
+  explicit ProcessSampler(const std::filesystem::path & proc_root = "/proc");
+
+  ~ProcessSampler();
+
+  ProcessSampler(const ProcessSampler &) = delete;
+  ProcessSampler & operator=(const ProcessSampler &) = delete;
+
+  // package_w is split by the latest CPU time of each process, returns
+  // how long it took, in ns
+  uint64_t sample(float package_w);
+
+  // processes with the most watts first, returns how many were written
+  int top(ProcessPower * out, int count) const;
+  // processes in the table
+  size_t size() const;
+
+private:
+  struct Entry {
+    int pid;             // 0 for a free slot
+    uint32_t pass;       // last walk that saw it
+    uint64_t start;      // starttime, a reused pid starts over
+    uint64_t ticks;      // utime + stime
+    uint64_t read_ns;
+    float cpu;
+    char comm[16];
+  };
+
+  // both return nullptr once the table is full
+  Entry * find(int pid);
+  Entry * insert(int pid);
+  void erase(size_t slot);
+  void grow();
+  // removes what the walk that just ended didn't see
+  void sweep();
+  void read(int pid, uint64_t now);
+
+  int _proc_fd = -1;
+  std::vector<char> _dents;
+  size_t _dent_pos = 0;
+  size_t _dent_len = 0;
+  std::vector<char> _stat_buf;
+  double _tick_s;
+
+  // open addressing with linear probing, the size a power of two
+  std::vector<Entry> _table;
+  size_t _used = 0;
+  uint32_t _pass = 1;
+  // sum of Entry::cpu
+  double _cpu_total = 0;
+  float _package_w = 0;
+};
+
+}
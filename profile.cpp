@@ -0,0 +1,139 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "profile.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+namespace cpu_utils {
+
+namespace {
+
+static std::string field(const std::string & value)
+{
+  return value.empty() ? "-" : value;
+}
+
+static std::string field(int value)
+{
+  return value < 0 ? "-" : std::to_string(value);
+}
+
+static bool parse_field(const std::string & text, std::string & value)
+{
+  value = text == "-" ? "" : text;
+  return true;
+}
+
+static bool parse_field(const std::string & text, int & value)
+{
+  if (text == "-") {
+    value = -1;
+    return true;
+  }
+  char * end;
+  value = strtol(text.c_str(), &end, 10);
+  return *end == '\0' && value >= 0;
+}
+
+}
+
+const std::vector<Profile> & builtinProfiles() {
+  static const std::vector<Profile> profiles = {
+    { "battery", 8, "powersave", "power", 0, 0 },
+    { "balanced", 15, "powersave", "balance_performance", 1, 1 },
+    { "docked", 28, "performance", "", 1, 1 },
+  };
+  return profiles;
+}
+
+std::string formatProfile(const Profile & profile) {
+  std::ostringstream out;
+  out << profile.name << ' ' << field(profile.tdp) << ' ' << field(profile.governor) << ' '
+      << field(profile.epp) << ' ' << field(profile.smt) << ' ' << field(profile.boost);
+  return out.str();
+}
+
+bool parseProfile(const std::string & line, Profile & profile) {
+  std::istringstream input (line);
+  std::string tdp, governor, epp, smt, boost, rest;
+  if (!(input >> profile.name >> tdp >> governor >> epp >> smt >> boost) || input >> rest) return false;
+  return parse_field(tdp, profile.tdp) && parse_field(governor, profile.governor) && parse_field(epp, profile.epp) &&
+         parse_field(smt, profile.smt) && profile.smt <= 1 && parse_field(boost, profile.boost) && profile.boost <= 1;
+}
+
+std::vector<Profile> loadProfiles(const std::string & path) {
+  std::ifstream input (path);
+  if (!input) {
+    throw "Unable to open profile file";
+  }
+  std::vector<Profile> profiles;
+  std::string line;
+  while (std::getline(input, line)) {
+    line = line.substr(0, line.find('#'));
+    if (line.find_first_not_of(" \t") == std::string::npos) continue;
+    Profile profile;
+    if (!parseProfile(line, profile)) {
+      throw "Malformed profile";
+    }
+    profiles.push_back(profile);
+  }
+  return profiles;
+}
+
+ApplyReport applyTransaction(const std::vector<ProfileStep> & steps) {
+  using clock = std::chrono::steady_clock;
+  auto us_since = [](clock::time_point start) {
+    return std::chrono::duration<double, std::micro>(clock::now() - start).count();
+  };
+  const auto begin = clock::now();
+  ApplyReport report;
+  // what each applied step held before, for the rollback
+  std::vector<std::pair<const ProfileStep *, std::string>> undo;
+  for (const auto & step : steps) {
+    const auto start = clock::now();
+    std::string previous = step.read();
+    if (previous == step.target) {
+      report.steps.push_back({ step.name, true, us_since(start) });
+      continue;
+    }
+    // restored even if refused, it may have taken effect on some CPUs
+    undo.emplace_back(&step, previous);
+    const bool ok = step.write(step.target);
+    report.steps.push_back({ step.name, false, us_since(start) });
+    if (!ok) {
+      report.ok = false;
+      report.failed = step.name;
+      break;
+    }
+  }
+  if (!report.ok) {
+    for (auto it = undo.rbegin(); it != undo.rend(); ++it) {
+      // nothing known to go back to
+      if (it->second.empty()) continue;
+      report.rolled_back &= it->first->write(it->second);
+    }
+  }
+  report.total_us = us_since(begin);
+  return report;
+}
+
+}
@@ -0,0 +1,74 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace cpu_utils {
+
+// A named set of settings applied together. Empty strings and -1 leave the
+// setting as it is.
+struct Profile {
+  std::string name;
+  int tdp = -1;
+  std::string governor;
+  std::string epp;
+  int smt = -1;
+  int boost = -1;
+};
+
+const std::vector<Profile> & builtinProfiles();
+
+// one line, "<name> <tdp> <governor> <epp> <smt> <boost>" with "-" for
+// settings left alone, as used on the wire and in profile files
+std::string formatProfile(const Profile & profile);
+bool parseProfile(const std::string & line, Profile & profile);
+// one profile per line, # starts a comment. Throws if the file can't be read.
+std::vector<Profile> loadProfiles(const std::string & path);
+
+// One setting of a transaction. read() returns the current value as text,
+// write() returns false if the value was refused.
+struct ProfileStep {
+  const char * name;
+  std::string target;
+  std::function<std::string()> read;
+  std::function<bool(const std::string &)> write;
+};
+
+struct ApplyReport {
+  struct Step {
+    const char * name;
+    bool skipped;  // already in place
+    double us;
+  };
+
+  bool ok = true;
+  const char * failed = nullptr;  // step that was refused
+  bool rolled_back = true;        // false if a rollback write failed too
+  std::vector<Step> steps;
+  double total_us = 0;
+};
+
+// Applies the steps in order, skipping those already at their target. If
+// one fails, the ones applied so far are restored in reverse order.
+ApplyReport applyTransaction(const std::vector<ProfileStep> & steps);
+
+}
@@ -0,0 +1,247 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "protocol.h"
+#include "cpu_utils.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace cpu_utils {
+
+namespace protocol {
+
+namespace {
+
+static bool make_address(const char * path, sockaddr_un & addr)
+{
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) return false;
+  strcpy(addr.sun_path, path);
+  return true;
+}
+
+static std::string join(const std::vector<std::string> & items)
+{
+  std::string out;
+  for (const auto & item : items) {
+    if (!out.empty()) out += ' ';
+    out += item;
+  }
+  return out;
+}
+
+static std::vector<std::string> split(const std::string & line)
+{
+  std::vector<std::string> items;
+  std::istringstream input (line);
+  std::string item;
+  while (input >> item) items.push_back(item);
+  return items;
+}
+
+}
+
+int listenSocket(const char * path) {
+  sockaddr_un addr;
+  if (!make_address(path, addr)) return -1;
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  if (fd < 0) return -1;
+  unlink(path);
+  if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int connectSocket(const char * path) {
+  sockaddr_un addr;
+  if (!make_address(path, addr)) return -1;
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+  if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+bool send(int fd, uint16_t type, const void * payload, size_t size) {
+  if (size > MAX_MESSAGE - sizeof(Header)) return false;
+  Header header { type, static_cast<uint16_t>(VERSION), static_cast<uint32_t>(size) };
+  iovec iov[2] = {
+    { &header, sizeof(header) },
+    { const_cast<void *>(payload), size },
+  };
+  msghdr msg {};
+  msg.msg_iov = iov;
+  msg.msg_iovlen = size ? 2 : 1;
+  ssize_t n;
+  do {
+    n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+  } while (n < 0 && errno == EINTR);
+  return n == static_cast<ssize_t>(sizeof(header) + size);
+}
+
+bool recv(int fd, Message & msg) {
+  ssize_t n;
+  do {
+    n = ::recv(fd, &msg, sizeof(msg), 0);
+  } while (n < 0 && errno == EINTR);
+  if (n < static_cast<ssize_t>(sizeof(Header))) return false;
+  if (msg.header.version != VERSION) return false;
+  return msg.header.size == n - sizeof(Header);
+}
+
+std::string formatInfo(const Info & info) {
+  std::ostringstream out;
+  out << info.family << '\n'
+      << info.rate << '\n'
+      << info.tdp_governor.mode << ' ' << info.tdp_governor.target << ' '
+      << info.tdp_governor.min_tdp << ' ' << info.tdp_governor.max_tdp << '\n'
+      << info.cpu.smt << ' ' << info.cpu.boost << '\n'
+      << info.cpu.scaling_governor << '\n'
+      << join(info.cpu.scaling_available_governors) << '\n'
+      << info.cpu.epp << '\n'
+      << join(info.cpu.epp_available_options) << '\n'
+      << info.profile << '\n'
+      << info.gpu.device.string() << '\n'
+      << info.gpu.hwmon.string() << '\n'
+      << info.gpu.performance_level << '\n'
+      << join(info.gpu.performance_levels) << '\n'
+      << info.gpu.sclk_min << ' ' << info.gpu.sclk_max << ' ' << info.gpu.sclk_lo << ' ' << info.gpu.sclk_hi << ' '
+      << info.gpu.power_profile << '\n'
+      << join(info.gpu.power_profiles) << '\n'
+      << info.cpu.pstate_status << '\n'
+      << join(info.cpu.pstate_statuses) << '\n';
+  // per CPU, the offline ones as -1, runs of equal CPUs as "<count>*"
+  const auto & freq = info.cpu.freq;
+  for (size_t i = 0, run; i < freq.size(); i += run) {
+    const auto & f = freq[i];
+    for (run = 1; i + run < freq.size(); ++run) {
+      const auto & g = freq[i + run];
+      if (g.min_khz != f.min_khz || g.max_khz != f.max_khz || g.scaling_min_khz != f.scaling_min_khz ||
+          g.scaling_max_khz != f.scaling_max_khz || g.highest_perf != f.highest_perf || g.ranking != f.ranking) break;
+    }
+    if (run > 1) out << run << '*';
+    out << f.min_khz << ',' << f.max_khz << ',' << f.scaling_min_khz << ',' << f.scaling_max_khz << ','
+        << f.highest_perf << ',' << f.ranking << ' ';
+  }
+  out << '\n'
+      << info.steering.pid << ' ' << info.steering.cores << ' ' << info.steering.cap_khz << '\n'
+      << formatCurve(info.curve) << '\n';
+  return out.str();
+}
+
+bool parseInfo(const std::string & text, Info & info) {
+  std::istringstream input (text);
+  std::string line;
+  if (!std::getline(input, line)) return false;
+  info.family = atoi(line.c_str());
+  if (!std::getline(input, line)) return false;
+  info.rate = atoi(line.c_str());
+  if (!std::getline(input, line)) return false;
+  std::istringstream governor (line);
+  if (!(governor >> info.tdp_governor.mode >> info.tdp_governor.target >> info.tdp_governor.min_tdp >> info.tdp_governor.max_tdp)) return false;
+  if (!std::getline(input, line)) return false;
+  std::istringstream toggles (line);
+  if (!(toggles >> info.cpu.smt >> info.cpu.boost)) return false;
+  if (!std::getline(input, info.cpu.scaling_governor)) return false;
+  if (!std::getline(input, line)) return false;
+  info.cpu.scaling_available_governors = split(line);
+  if (!std::getline(input, info.cpu.epp)) return false;
+  if (!std::getline(input, line)) return false;
+  info.cpu.epp_available_options = split(line);
+  if (!std::getline(input, info.profile)) return false;
+  if (!std::getline(input, line)) return false;
+  info.gpu.device = line;
+  if (!std::getline(input, line)) return false;
+  info.gpu.hwmon = line;
+  if (!std::getline(input, info.gpu.performance_level)) return false;
+  if (!std::getline(input, line)) return false;
+  info.gpu.performance_levels = split(line);
+  if (!std::getline(input, line)) return false;
+  std::istringstream gpu (line);
+  if (!(gpu >> info.gpu.sclk_min >> info.gpu.sclk_max >> info.gpu.sclk_lo >> info.gpu.sclk_hi >> info.gpu.power_profile)) return false;
+  if (!std::getline(input, line)) return false;
+  info.gpu.power_profiles = split(line);
+  if (!std::getline(input, info.cpu.pstate_status)) return false;
+  if (!std::getline(input, line)) return false;
+  info.cpu.pstate_statuses = split(line);
+  if (!std::getline(input, line)) return false;
+  info.cpu.freq.clear();
+  for (const auto & item : split(line)) {
+    CpuFreq f;
+    const char * text = item.c_str();
+    int run = 1;
+    if (const char * star = strchr(text, '*')) {
+      run = atoi(text);
+      text = star + 1;
+    }
+    if (run < 1 || run > 65536 || sscanf(text, "%d,%d,%d,%d,%d,%d", &f.min_khz, &f.max_khz, &f.scaling_min_khz, &f.scaling_max_khz,
+                                         &f.highest_perf, &f.ranking) != 6) return false;
+    info.cpu.freq.insert(info.cpu.freq.end(), run, f);
+  }
+  if (!std::getline(input, line)) return false;
+  std::istringstream steering (line);
+  if (!(steering >> info.steering.pid >> info.steering.cores >> info.steering.cap_khz)) return false;
+  if (!std::getline(input, line)) return false;
+  info.curve.clear();
+  return line.empty() || parseCurve(line, info.curve);
+}
+
+std::string formatFreqRange(const std::vector<int> & cpus, int min_khz, int max_khz) {
+  return std::to_string(min_khz) + ' ' + std::to_string(max_khz) + ' ' + formatCpuList(cpus);
+}
+
+bool parseFreqRange(const std::string & text, std::vector<int> & cpus, int & min_khz, int & max_khz) {
+  std::istringstream input (text);
+  std::string list;
+  if (!(input >> min_khz >> max_khz >> list)) return false;
+  cpus = parseCpuList(list);
+  return !cpus.empty() && min_khz > 0 && min_khz <= max_khz;
+}
+
+std::string formatCurve(const std::vector<int> & offsets) {
+  std::string text;
+  for (int offset : offsets) {
+    if (!text.empty()) text += ' ';
+    text += std::to_string(offset);
+  }
+  return text;
+}
+
+bool parseCurve(const std::string & text, std::vector<int> & offsets) {
+  std::istringstream input (text);
+  offsets.clear();
+  int offset;
+  while (input >> offset) offsets.push_back(offset);
+  return input.eof() && !offsets.empty();
+}
+}
+
+}
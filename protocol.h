@@ -0,0 +1,137 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "amdgpu.h"
+#include "cpu_utils.h"
+#include "governor.h"
+#include "steering.h"
+
+#define SOCKET_PATH "/run/simpletdp.sock"
+
+namespace cpu_utils {
+
+// simpletdpd speaks fixed-layout messages over a SOCK_SEQPACKET unix socket,
+// one message per packet, so there is no framing to get wrong. Both ends are
+// on the same machine, structs go over the wire as they are laid out in memory.
+namespace protocol {
+
+constexpr uint32_t VERSION = 10;
+// Info takes up to about 40 bytes per CPU, this fits well over a thousand
+constexpr size_t MAX_MESSAGE = 65536;
+
+enum MessageType : uint16_t {
+  // client -> daemon
+  MSG_GET_SNAPSHOT = 1,  // -> MSG_SNAPSHOT
+  MSG_GET_INFO,          // -> MSG_INFO
+  MSG_SET_TDP,           // int32 watts -> MSG_ACK
+  MSG_SET_GOVERNOR,      // string -> MSG_ACK
+  MSG_SET_EPP,           // string -> MSG_ACK
+  MSG_SET_RATE,          // int32 Hz -> MSG_ACK
+  MSG_SUBSCRIBE,         // optional MetricMask, all by default -> MSG_ACK, then a
+                         // MSG_SNAPSHOT per sample. Again to change the metrics.
+  MSG_UNSUBSCRIBE,       // -> MSG_ACK
+  MSG_SET_TDP_GOVERNOR,  // TdpGovernor::Settings -> MSG_ACK
+  MSG_SET_SMT,           // int32 0 or 1 -> MSG_ACK
+  MSG_SET_BOOST,         // int32 0 or 1 -> MSG_ACK
+  MSG_APPLY_PROFILE,     // text, see formatProfile() -> MSG_ACK
+  MSG_SET_GPU_LEVEL,     // string -> MSG_ACK
+  MSG_SET_GPU_SCLK,      // int32 min and max MHz -> MSG_ACK
+  MSG_SET_GPU_POWER_PROFILE, // int32 mode -> MSG_ACK
+  MSG_SET_PSTATE,        // string -> MSG_ACK
+  MSG_SET_FREQ_RANGE,    // text, see formatFreqRange() -> MSG_ACK
+  MSG_STEER,             // CoreSteering::Settings -> MSG_ACK with an errno
+  MSG_SET_CURVE,         // text, see formatCurve() -> MSG_ACK with an errno
+
+  // daemon -> client
+  MSG_SNAPSHOT = 0x100,  // Snapshot
+  MSG_INFO,              // text, see formatInfo(), also pushed to subscribers on change
+  MSG_ACK,               // int32 status, 0 on success
+};
+
+struct Header {
+  uint16_t type;
+  uint16_t version;
+  uint32_t size; // payload bytes following the header
+};
+
+struct Message {
+  Header header;
+  char payload[MAX_MESSAGE - sizeof(Header)];
+
+  template <typename T>
+  bool as(T & out) const {
+    if (header.size != sizeof(T)) return false;
+    std::memcpy(&out, payload, sizeof(T));
+    return true;
+  }
+
+  std::string text() const {
+    return std::string(payload, header.size);
+  }
+};
+
+int listenSocket(const char * path);
+int connectSocket(const char * path);
+
+// both return false on a closed or broken socket
+bool send(int fd, uint16_t type, const void * payload = nullptr, size_t size = 0);
+bool recv(int fd, Message & msg);
+
+template <typename T>
+bool sendValue(int fd, uint16_t type, const T & value) {
+  return send(fd, type, &value, sizeof(T));
+}
+
+inline bool sendText(int fd, uint16_t type, const std::string & text) {
+  return send(fd, type, text.data(), text.size());
+}
+
+// State that changes rarely, sent as newline separated text. Option lists
+// are space separated.
+struct Info {
+  int family = -1;
+  int rate = 0;
+  TdpGovernor::Settings tdp_governor;
+  CPUState cpu;
+  std::string profile;
+  GpuState gpu;
+  CoreSteering::Settings steering;
+  std::vector<int> curve;
+};
+
+std::string formatInfo(const Info & info);
+bool parseInfo(const std::string & text, Info & info);
+
+// "<min kHz> <max kHz> <cpu list>", the list as the kernel writes them
+std::string formatFreqRange(const std::vector<int> & cpus, int min_khz, int max_khz);
+bool parseFreqRange(const std::string & text, std::vector<int> & cpus, int & min_khz, int & max_khz);
+
+// the offsets by physical core, space separated
+std::string formatCurve(const std::vector<int> & offsets);
+bool parseCurve(const std::string & text, std::vector<int> & offsets);
+
+}
+
+}
@@ -0,0 +1,298 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "recorder.h"
+#include "clock.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace cpu_utils {
+
+using namespace flight_log;
+
+namespace {
+
+static uint64_t * time_column(BlockHeader * block)
+{
+  return reinterpret_cast<uint64_t *>(block + 1);
+}
+
+static float * channel_column(BlockHeader * block, int ch, size_t rows = TELEMETRY_ROWS)
+{
+  return reinterpret_cast<float *>(time_column(block) + rows) + ch * rows;
+}
+
+static LogEvent * event_rows(BlockHeader * block)
+{
+  return reinterpret_cast<LogEvent *>(block + 1);
+}
+
+}
+
+Recorder::Recorder(const std::string & path, int family, size_t file_size, int keep)
+  : _path(path), _family(family), _blocks(std::max<size_t>(1, (file_size - HEADER_SIZE) / BLOCK_SIZE)), _keep(std::max(1, keep)) {
+  std::lock_guard<std::mutex> guard(_lock);
+  // never append to a file we didn't write, move any previous log aside
+  rotate();
+  if (!_map) {
+    throw "Unable to open flight recorder log";
+  }
+}
+
+Recorder::~Recorder() {
+  std::lock_guard<std::mutex> guard(_lock);
+  close();
+}
+
+void Recorder::open() {
+  const size_t size = HEADER_SIZE + _blocks * BLOCK_SIZE;
+  _fd = ::open(_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (_fd < 0) {
+    std::cerr << "flight recorder: cannot open " << _path << ": " << strerror(errno) << std::endl;
+    return;
+  }
+  // reserve the space up front so a full disk can't SIGBUS us mid write
+  if (int err = posix_fallocate(_fd, 0, size); err != 0 && ftruncate(_fd, size) < 0) {
+    std::cerr << "flight recorder: cannot size " << _path << ": " << strerror(err) << std::endl;
+    ::close(_fd);
+    _fd = -1;
+    return;
+  }
+  void * map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+  if (map == MAP_FAILED) {
+    std::cerr << "flight recorder: cannot map " << _path << ": " << strerror(errno) << std::endl;
+    ::close(_fd);
+    _fd = -1;
+    return;
+  }
+  _map = static_cast<char *>(map);
+  _next_block = 0;
+  _telemetry = nullptr;
+  _events = nullptr;
+
+  FileHeader * header = reinterpret_cast<FileHeader *>(_map);
+  header->version = VERSION;
+  header->block_size = BLOCK_SIZE;
+  header->channels = CHANNEL_COUNT;
+  header->family = _family;
+  header->created_realtime_ns = clockNs(CLOCK_REALTIME);
+  header->created_monotonic_ns = clockNs(CLOCK_MONOTONIC);
+  memcpy(header->magic, MAGIC, sizeof(MAGIC));
+  msync(_map, HEADER_SIZE, MS_SYNC);
+}
+
+void Recorder::close() {
+  if (!_map) return;
+  const size_t used = HEADER_SIZE + _next_block * BLOCK_SIZE;
+  msync(_map, used, MS_SYNC);
+  munmap(_map, HEADER_SIZE + _blocks * BLOCK_SIZE);
+  // give back the preallocated tail
+  if (ftruncate(_fd, used) < 0) {
+    std::cerr << "flight recorder: cannot trim " << _path << ": " << strerror(errno) << std::endl;
+  }
+  ::close(_fd);
+  _map = nullptr;
+  _fd = -1;
+}
+
+void Recorder::rotate() {
+  close();
+  for (int i = _keep - 1; i >= 0; --i) {
+    std::string from = i ? _path + "." + std::to_string(i) : _path;
+    std::string to = _path + "." + std::to_string(i + 1);
+    rename(from.c_str(), to.c_str());
+  }
+  open();
+  for (const auto & ev : _state) {
+    if (ev.type) append(ev);
+  }
+}
+
+BlockHeader * Recorder::allocate(uint16_t kind) {
+  if (!_map) return nullptr;
+  if (_next_block == _blocks) {
+    rotate();
+    if (!_map) return nullptr;
+  }
+  BlockHeader * block = reinterpret_cast<BlockHeader *>(_map + HEADER_SIZE + _next_block * BLOCK_SIZE);
+  ++_next_block;
+  block->kind = kind;
+  block->count = 0;
+  std::atomic_ref<uint32_t>(block->magic).store(BLOCK_MAGIC, std::memory_order_release);
+  return block;
+}
+
+void Recorder::record(const Snapshot & snap) {
+  std::lock_guard<std::mutex> guard(_lock);
+  if (!_telemetry || _telemetry->count == TELEMETRY_ROWS) {
+    _telemetry = allocate(BLOCK_TELEMETRY);
+    if (!_telemetry) return;
+  }
+  // rows are written straight into the mapping, one slot per column
+  const uint32_t row = _telemetry->count;
+  time_column(_telemetry)[row] = snap.timestamp_ns;
+  for (int ch = 0; ch < CHANNEL_COUNT; ++ch) {
+    channel_column(_telemetry, ch)[row] = channelValue(snap.ryzen, ch);
+  }
+  std::atomic_ref<uint32_t>(_telemetry->count).store(row + 1, std::memory_order_release);
+}
+
+void Recorder::event(uint32_t type, int32_t value, const std::string & text) {
+  LogEvent ev {};
+  ev.timestamp_ns = clockNs(CLOCK_MONOTONIC);
+  ev.type = type;
+  ev.value = value;
+  text.copy(ev.text, sizeof(ev.text) - 1);
+  std::lock_guard<std::mutex> guard(_lock);
+  if (type < EVENT_TYPES) _state[type] = ev;
+  append(ev);
+}
+
+void Recorder::append(const LogEvent & ev) {
+  if (!_events || _events->count == EVENT_ROWS) {
+    _events = allocate(BLOCK_EVENTS);
+    if (!_events) return;
+  }
+  const uint32_t row = _events->count;
+  event_rows(_events)[row] = ev;
+  std::atomic_ref<uint32_t>(_events->count).store(row + 1, std::memory_order_release);
+}
+
+LogReader::LogReader(const std::string & path) {
+  _fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (_fd < 0 || fstat(_fd, &st) < 0 || static_cast<size_t>(st.st_size) < HEADER_SIZE) {
+    if (_fd >= 0) ::close(_fd);
+    throw "Unable to open flight recorder log";
+  }
+  _size = st.st_size;
+  void * map = mmap(nullptr, _size, PROT_READ, MAP_SHARED, _fd, 0);
+  if (map == MAP_FAILED) {
+    ::close(_fd);
+    throw "Unable to map flight recorder log";
+  }
+  _map = static_cast<char *>(map);
+
+  const FileHeader * header = reinterpret_cast<const FileHeader *>(_map);
+  if (memcmp(header->magic, MAGIC, sizeof(MAGIC)) || header->version != VERSION ||
+      header->block_size != BLOCK_SIZE || header->channels == 0 || header->channels > CHANNEL_COUNT) {
+    munmap(_map, _size);
+    ::close(_fd);
+    throw "Not a SimpleTDP flight recorder log";
+  }
+  _channels = header->channels;
+  _rows = telemetryRows(_channels);
+
+  // blocks are handed out in order, the first one without a magic ends the log
+  for (size_t offset = HEADER_SIZE; offset + BLOCK_SIZE <= _size; offset += BLOCK_SIZE) {
+    auto block = reinterpret_cast<BlockHeader *>(_map + offset);
+    if (std::atomic_ref<uint32_t>(block->magic).load(std::memory_order_acquire) != BLOCK_MAGIC) break;
+    uint32_t count = std::atomic_ref<uint32_t>(block->count).load(std::memory_order_acquire);
+    if (block->kind == BLOCK_TELEMETRY) {
+      _telemetry.push_back({ block, static_cast<uint32_t>(std::min<size_t>(count, _rows)) });
+    } else if (block->kind == BLOCK_EVENTS) {
+      _events.push_back({ block, std::min<uint32_t>(count, EVENT_ROWS) });
+    }
+  }
+}
+
+LogReader::~LogReader() {
+  munmap(_map, _size);
+  ::close(_fd);
+}
+
+int LogReader::family() const {
+  return reinterpret_cast<const FileHeader *>(_map)->family;
+}
+
+uint64_t LogReader::createdRealtime() const {
+  return reinterpret_cast<const FileHeader *>(_map)->created_realtime_ns;
+}
+
+void LogReader::rewind() {
+  _sample_block = _sample_row = 0;
+  _event_block = _event_row = 0;
+}
+
+bool LogReader::peekSample(uint64_t & time) const {
+  size_t block = _sample_block, row = _sample_row;
+  while (block < _telemetry.size() && row >= _telemetry[block].count) {
+    ++block;
+    row = 0;
+  }
+  if (block == _telemetry.size()) return false;
+  time = time_column(_telemetry[block].header)[row];
+  return true;
+}
+
+bool LogReader::peekEvent(uint64_t & time) const {
+  size_t block = _event_block, row = _event_row;
+  while (block < _events.size() && row >= _events[block].count) {
+    ++block;
+    row = 0;
+  }
+  if (block == _events.size()) return false;
+  time = event_rows(_events[block].header)[row].timestamp_ns;
+  return true;
+}
+
+bool LogReader::next(Entry & entry) {
+  uint64_t sample_time, event_time;
+  const bool has_sample = peekSample(sample_time);
+  const bool has_event = peekEvent(event_time);
+  if (!has_sample && !has_event) return false;
+
+  if (has_event && (!has_sample || event_time <= sample_time)) {
+    while (_event_row >= _events[_event_block].count) {
+      ++_event_block;
+      _event_row = 0;
+    }
+    entry.is_event = true;
+    entry.ev = event_rows(_events[_event_block].header)[_event_row++];
+    return true;
+  }
+
+  while (_sample_row >= _telemetry[_sample_block].count) {
+    ++_sample_block;
+    _sample_row = 0;
+  }
+  BlockHeader * block = _telemetry[_sample_block].header;
+  entry.is_event = false;
+  entry.snap = {};
+  entry.snap.seq = ++_seq;
+  entry.snap.timestamp_ns = time_column(block)[_sample_row];
+  for (int ch = 0; ch < CHANNEL_COUNT; ++ch) {
+    setChannelValue(entry.snap.ryzen, ch, ch < _channels ? channel_column(block, ch, _rows)[_sample_row] : NAN);
+  }
+  ++_sample_row;
+  return true;
+}
+
+}
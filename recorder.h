@@ -0,0 +1,173 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "channels.h"
+#include "sampler.h"
+
+namespace cpu_utils {
+
+// Flight recorder log layout. A 4 KiB file header is followed by fixed size
+// blocks. Telemetry blocks are columnar: a timestamp column followed by one
+// float column per channel. Event blocks hold LogEvent records. A block's
+// rows become visible when its count is bumped, after the row is written,
+// so a crash loses at most the row in flight.
+namespace flight_log {
+
+constexpr char MAGIC[8] = { 'S', 'T', 'D', 'P', 'L', 'O', 'G', '\0' };
+constexpr uint32_t VERSION = 1;
+constexpr size_t HEADER_SIZE = 4096;
+constexpr size_t BLOCK_SIZE = 64 * 1024;
+constexpr uint32_t BLOCK_MAGIC = 0x4b4c4253; // "SBLK"
+
+enum BlockKind : uint16_t {
+  BLOCK_TELEMETRY = 1,
+  BLOCK_EVENTS,
+};
+
+enum EventType : uint32_t {
+  EV_SET_TDP = 1,   // value: watts
+  EV_SET_GOVERNOR,  // text
+  EV_SET_EPP,       // text
+  EV_SET_RATE,      // value: Hz
+  EV_SET_TDP_GOVERNOR, // value: mode, text: target
+  EV_APPLY_PROFILE, // value: 1 if applied, text: name
+  EVENT_TYPES
+};
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t block_size;
+  uint32_t channels;
+  int32_t family;
+  uint64_t created_realtime_ns;  // CLOCK_REALTIME at creation
+  uint64_t created_monotonic_ns; // CLOCK_MONOTONIC at the same moment
+};
+
+struct BlockHeader {
+  uint32_t magic;
+  uint16_t kind;
+  uint16_t reserved;
+  uint32_t count; // committed rows
+  uint32_t reserved2;
+};
+
+struct LogEvent {
+  uint64_t timestamp_ns;
+  uint32_t type;
+  int32_t value;
+  char text[32];
+};
+
+// a time column and one per channel, older logs may have fewer channels
+constexpr size_t telemetryRows(size_t channels) {
+  return (BLOCK_SIZE - sizeof(BlockHeader)) / (sizeof(uint64_t) + channels * sizeof(float));
+}
+constexpr size_t TELEMETRY_ROWS = telemetryRows(CHANNEL_COUNT);
+constexpr size_t EVENT_ROWS = (BLOCK_SIZE - sizeof(BlockHeader)) / sizeof(LogEvent);
+
+}
+
+// Appends telemetry and control events to a memory mapped log. Files are
+// preallocated and rotated to <path>.1 .. <path>.<keep> once full.
+struct Recorder {
+  static constexpr size_t DEFAULT_FILE_SIZE = 32 * 1024 * 1024;
+  static constexpr int DEFAULT_KEEP = 8;
+
+  Recorder(const std::string & path, int family, size_t file_size = DEFAULT_FILE_SIZE, int keep = DEFAULT_KEEP);
+
+  ~Recorder();
+
+  void record(const Snapshot & snap);
+  void event(uint32_t type, int32_t value, const std::string & text = {});
+
+private:
+  void open();
+  void close();
+  void rotate();
+  // next free block of the given kind, rotating the file if it is full
+  flight_log::BlockHeader * allocate(uint16_t kind);
+  void append(const flight_log::LogEvent & ev);
+
+  std::string _path;
+  int _family;
+  size_t _blocks;
+  int _keep;
+
+  std::mutex _lock;
+  int _fd = -1;
+  char * _map = nullptr;
+  size_t _next_block = 0;
+  flight_log::BlockHeader * _telemetry = nullptr;
+  flight_log::BlockHeader * _events = nullptr;
+  // last event of each type, repeated at the start of every file so each
+  // one replays on its own
+  std::array<flight_log::LogEvent, flight_log::EVENT_TYPES> _state = {};
+};
+
+// Read side of a single log file, for replay.
+struct LogReader {
+  struct Entry {
+    bool is_event;
+    Snapshot snap;           // valid when !is_event
+    flight_log::LogEvent ev; // valid when is_event
+  };
+
+  LogReader(const std::string & path);
+
+  ~LogReader();
+
+  int family() const;
+  uint64_t createdRealtime() const;
+
+  // walks samples and events merged in time order, returns false at the end
+  bool next(Entry & entry);
+  void rewind();
+
+private:
+  struct Block {
+    flight_log::BlockHeader * header;
+    uint32_t count;
+  };
+
+  bool peekSample(uint64_t & time) const;
+  bool peekEvent(uint64_t & time) const;
+
+  int _fd = -1;
+  char * _map = nullptr; // read only mapping
+  size_t _size = 0;
+  // of the file, channels past them read as NaN
+  int _channels = 0;
+  size_t _rows = 0;
+  std::vector<Block> _telemetry;
+  std::vector<Block> _events;
+  size_t _sample_block = 0, _sample_row = 0;
+  size_t _event_block = 0, _event_row = 0;
+  uint64_t _seq = 0;
+};
+
+}
@@ -0,0 +1,168 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "replay.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace cpu_utils {
+
+ReplayController::ReplayController(const std::string & path, double speed) : _log(path), _speed(speed) {
+  // show the first sample before playback starts
+  LogReader::Entry entry;
+  while (_log.next(entry)) {
+    if (!entry.is_event) {
+      _snapshot.store(entry.snap);
+      break;
+    }
+  }
+  _log.rewind();
+}
+
+ReplayController::~ReplayController() {
+  {
+    std::lock_guard<std::mutex> guard(_lock);
+    _running = false;
+  }
+  _wake.notify_all();
+  if (_thread.joinable()) {
+    _thread.join();
+  }
+}
+
+void ReplayController::setListener(std::function<void()> listener) {
+  _listener = std::move(listener);
+}
+
+void ReplayController::start() {
+  if (_thread.joinable()) return;
+  _running = true;
+  _thread = std::thread(&ReplayController::run, this);
+}
+
+Snapshot ReplayController::latest() const {
+  return _snapshot.load();
+}
+
+const CPUState & ReplayController::cpuState() const {
+  return _cs;
+}
+
+const GpuState & ReplayController::gpuState() const {
+  return _gs;
+}
+
+const CoreSteering::Settings & ReplayController::steering() const {
+  return _steering;
+}
+
+const std::vector<int> & ReplayController::curve() const {
+  return _curve;
+}
+
+const char * ReplayController::getFamilyName() const {
+  return familyName(_log.family());
+}
+
+int ReplayController::rate() const {
+  return _rate.load(std::memory_order_relaxed);
+}
+
+TdpGovernor::Settings ReplayController::tdpGovernor() const {
+  return _tdp_governor;
+}
+
+const std::string & ReplayController::profile() const {
+  return _profile;
+}
+
+void ReplayController::update() {
+  if (_info_version.load(std::memory_order_acquire) == _applied_version) return;
+  std::lock_guard<std::mutex> guard(_lock);
+  _cs = _received;
+  _tdp_governor = _received_tdp_governor;
+  _profile = _received_profile;
+  _applied_version = _info_version.load(std::memory_order_relaxed);
+}
+
+void ReplayController::run() {
+  using clock = std::chrono::steady_clock;
+  const auto start = clock::now();
+  uint64_t first = 0;
+  LogReader::Entry entry;
+  std::unique_lock<std::mutex> lock(_lock);
+  while (_running && _log.next(entry)) {
+    const uint64_t time = entry.is_event ? entry.ev.timestamp_ns : entry.snap.timestamp_ns;
+    if (!first) first = time;
+    if (_speed > 0) {
+      auto due = start + std::chrono::nanoseconds(static_cast<int64_t>((time - first) / _speed));
+      if (_wake.wait_until(lock, due, [this] { return !_running; })) break;
+    }
+
+    if (!entry.is_event) {
+      _snapshot.store(entry.snap);
+    } else {
+      // a profile logs its steps before itself, so they clear the name first
+      switch (entry.ev.type) {
+        case flight_log::EV_SET_TDP:
+          // the governor's own writes are no manual change
+          if (_received_tdp_governor.mode == TdpGovernor::OFF) _received_profile.clear();
+          break;
+        case flight_log::EV_SET_GOVERNOR:
+          _received.scaling_governor = entry.ev.text;
+          _received.scaling_available_governors = { _received.scaling_governor };
+          _received_profile.clear();
+          break;
+        case flight_log::EV_SET_EPP:
+          _received.epp = entry.ev.text;
+          _received.epp_available_options = { _received.epp };
+          _received_profile.clear();
+          break;
+        case flight_log::EV_SET_RATE:
+          _rate.store(entry.ev.value, std::memory_order_relaxed);
+          break;
+        case flight_log::EV_SET_TDP_GOVERNOR:
+          _received_tdp_governor.mode = entry.ev.value;
+          _received_tdp_governor.target = atof(entry.ev.text);
+          _received_profile.clear();
+          break;
+        case flight_log::EV_APPLY_PROFILE:
+          // SMT and boost toggles log as one step profiles of those names
+          if (entry.ev.value && strcmp(entry.ev.text, "smt") && strcmp(entry.ev.text, "boost")) {
+            _received_profile = entry.ev.text;
+          }
+          break;
+        default:
+          break;
+      }
+      _info_version.fetch_add(1, std::memory_order_release);
+    }
+
+    lock.unlock();
+    if (_listener) _listener();
+    lock.lock();
+  }
+  if (_running) {
+    std::cout << "Replay finished" << std::endl;
+  }
+}
+
+}
@@ -0,0 +1,99 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "controller.h"
+#include "recorder.h"
+#include "seqlock.h"
+
+namespace cpu_utils {
+
+// Plays a flight recorder log back through the UI. speed scales the
+// recorded timing, 0 replays as fast as possible. Controls are ignored.
+struct ReplayController : Controller {
+  ReplayController(const std::string & path, double speed);
+
+  ~ReplayController();
+
+  void setListener(std::function<void()> listener) override;
+  void start() override;
+
+  Snapshot latest() const override;
+  const CPUState & cpuState() const override;
+  const char * getFamilyName() const override;
+  int rate() const override;
+  TdpGovernor::Settings tdpGovernor() const override;
+  const std::string & profile() const override;
+  const GpuState & gpuState() const override;
+  const CoreSteering::Settings & steering() const override;
+  const std::vector<int> & curve() const override;
+
+  void update() override;
+
+  void setTdp(int) override {}
+  void setScalingGovernor(const std::string &) override {}
+  void setEPP(const std::string &) override {}
+  void setRate(int) override {}
+  void setTdpGovernor(const TdpGovernor::Settings &) override {}
+  void setSmt(bool) override {}
+  void setBoost(bool) override {}
+  void applyProfile(const Profile &) override {}
+  void setGpuPerformanceLevel(const std::string &) override {}
+  void setGpuSclk(int, int) override {}
+  void setGpuPowerProfile(int) override {}
+  void setPstateStatus(const std::string &) override {}
+  void setFreqRange(const std::vector<int> &, int, int) override {}
+  void steer(const CoreSteering::Settings &) override {}
+  void setCurve(const std::vector<int> &) override {}
+
+private:
+  void run();
+
+  LogReader _log;
+  double _speed;
+  std::function<void()> _listener;
+  SeqLock<Snapshot> _snapshot;
+
+  bool _running = false;
+  std::mutex _lock;
+  std::condition_variable _wake;
+  std::thread _thread;
+
+  // replayed governor/epp events, picked up by update()
+  CPUState _received;
+  TdpGovernor::Settings _received_tdp_governor;
+  std::string _received_profile;
+  std::atomic<int> _rate { 0 };
+  std::atomic<uint64_t> _info_version { 0 };
+  uint64_t _applied_version = 0;
+  CPUState _cs;
+  // not recorded, stays empty
+  GpuState _gs;
+  CoreSteering::Settings _steering;
+  std::vector<int> _curve;
+  TdpGovernor::Settings _tdp_governor;
+  std::string _profile;
+};
+
+}
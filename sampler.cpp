@@ -0,0 +1,139 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "sampler.h"
+#include "clock.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace cpu_utils {
+
+namespace {
+
+}
+
+Sampler::Sampler(RyzenState & rs, int rate_hz) : _rs(rs), _rate(std::clamp(rate_hz, MIN_RATE, MAX_RATE)) {}
+
+Sampler::~Sampler() {
+  stop();
+}
+
+void Sampler::start() {
+  if (_thread.joinable()) return;
+  sample();
+  _running = true;
+  _thread = std::thread(&Sampler::run, this);
+}
+
+void Sampler::stop() {
+  {
+    std::lock_guard<std::mutex> guard(_lock);
+    _running = false;
+  }
+  _wake.notify_all();
+  if (_thread.joinable()) {
+    _thread.join();
+  }
+}
+
+void Sampler::setListener(std::function<void()> listener) {
+  _listener = std::move(listener);
+}
+
+void Sampler::setRate(int rate_hz) {
+  {
+    std::lock_guard<std::mutex> guard(_lock);
+    _rate.store(std::clamp(rate_hz, MIN_RATE, MAX_RATE), std::memory_order_relaxed);
+    _reschedule = true;
+  }
+  _wake.notify_all();
+}
+
+int Sampler::rate() const {
+  return _rate.load(std::memory_order_relaxed);
+}
+
+Snapshot Sampler::latest() const {
+  return _snapshot.load();
+}
+
+uint64_t Sampler::seq() const {
+  return _snapshot.version();
+}
+
+int Sampler::subscribe(MetricMask metrics) {
+  std::lock_guard<std::mutex> guard(_lock);
+  _subscriptions.push_back(metrics);
+  _metrics.fetch_or(metrics, std::memory_order_relaxed);
+  return static_cast<int>(_subscriptions.size()) - 1;
+}
+
+void Sampler::setSubscription(int id, MetricMask metrics) {
+  std::lock_guard<std::mutex> guard(_lock);
+  _subscriptions.at(id) = metrics;
+  MetricMask all = 0;
+  for (MetricMask mask : _subscriptions) all |= mask;
+  _metrics.store(all, std::memory_order_relaxed);
+}
+
+void Sampler::unsubscribe(int id) {
+  setSubscription(id, 0);
+}
+
+MetricMask Sampler::subscribed() const {
+  return _metrics.load(std::memory_order_relaxed);
+}
+
+void Sampler::sample() {
+  _rs.tick(subscribed());
+  Snapshot snap;
+  snap.seq = ++_seq;
+  snap.timestamp_ns = monotonicNs();
+  snap.ryzen = _rs;
+  snap.smu = _rs.smuStats();
+  _snapshot.store(snap);
+  if (_listener) _listener();
+}
+
+void Sampler::run() {
+  trace::setThreadName("sampler");
+  using clock = std::chrono::steady_clock;
+  auto period = [this] { return std::chrono::microseconds(1000000 / rate()); };
+  auto next = clock::now() + period();
+  std::unique_lock<std::mutex> lock(_lock);
+  while (_running) {
+    if (_wake.wait_until(lock, next, [this]{ return !_running || _reschedule; })) {
+      _reschedule = false;
+      next = clock::now() + period();
+      continue;
+    }
+    lock.unlock();
+    sample();
+    lock.lock();
+    // a stall longer than one period restarts the schedule instead of
+    // firing a burst of catch-up samples
+    next += period();
+    if (auto now = clock::now(); next < now) {
+      next = now + period();
+    }
+  }
+}
+
+}
@@ -0,0 +1,92 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "cpu_utils.h"
+#include "seqlock.h"
+
+namespace cpu_utils {
+
+struct Snapshot {
+  uint64_t seq;
+  uint64_t timestamp_ns; // CLOCK_MONOTONIC
+  RyzenTelemetry ryzen;
+  SmuStats smu;
+};
+
+// Runs RyzenState::tick() on its own thread at a fixed rate and publishes
+// the result, so readers never wait on the SMU.
+struct Sampler {
+  static constexpr int MIN_RATE = 1;
+  static constexpr int MAX_RATE = 20;
+
+  Sampler(RyzenState & rs, int rate_hz = 4);
+
+  ~Sampler();
+
+  // takes the first sample synchronously, then keeps sampling in the background
+  void start();
+  void stop();
+
+  // called after every published sample, on the sampling thread. Set it
+  // before start().
+  void setListener(std::function<void()> listener);
+
+  void setRate(int rate_hz);
+  int rate() const;
+
+  Snapshot latest() const;
+  uint64_t seq() const;
+
+  // Consumers subscribe to the metrics they read from latest(), a sample
+  // only refreshes their union. Returns the id to change or drop it with.
+  int subscribe(MetricMask metrics);
+  void setSubscription(int id, MetricMask metrics);
+  void unsubscribe(int id);
+  MetricMask subscribed() const;
+
+private:
+  void run();
+  void sample();
+
+  RyzenState & _rs;
+  SeqLock<Snapshot> _snapshot;
+  std::function<void()> _listener;
+  std::atomic<int> _rate;
+  uint64_t _seq = 0;
+  // by id, guarded by _lock
+  std::vector<MetricMask> _subscriptions;
+  std::atomic<MetricMask> _metrics { 0 };
+
+  bool _running = false;
+  bool _reschedule = false;
+  std::mutex _lock;
+  std::condition_variable _wake;
+  std::thread _thread;
+};
+
+}
@@ -0,0 +1,75 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace cpu_utils {
+
+// Single writer, many readers. Readers never block the writer, they retry
+// if a store raced with their copy. The payload is kept as relaxed atomic
+// words so the racing copy is well defined.
+template <typename T>
+struct SeqLock {
+  static_assert(std::is_trivially_copyable_v<T>, "SeqLock payload must be trivially copyable");
+
+  void store(const T & value) {
+    uint64_t words[WORDS] = {};
+    std::memcpy(words, &value, sizeof(T));
+    const uint64_t seq = _seq.load(std::memory_order_relaxed);
+    _seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < WORDS; ++i) {
+      _data[i].store(words[i], std::memory_order_relaxed);
+    }
+    _seq.store(seq + 2, std::memory_order_release);
+  }
+
+  T load() const {
+    uint64_t words[WORDS];
+    uint64_t before, after;
+    do {
+      before = _seq.load(std::memory_order_acquire);
+      for (size_t i = 0; i < WORDS; ++i) {
+        words[i] = _data[i].load(std::memory_order_relaxed);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      after = _seq.load(std::memory_order_relaxed);
+    } while ((before & 1) || before != after);
+    T value;
+    std::memcpy(&value, words, sizeof(T));
+    return value;
+  }
+
+  // number of completed stores, cheap way to check for new data
+  uint64_t version() const {
+    return _seq.load(std::memory_order_acquire) >> 1;
+  }
+
+private:
+  static constexpr size_t WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+  std::atomic<uint64_t> _seq { 0 };
+  std::atomic<uint64_t> _data[WORDS] = {};
+};
+
+}
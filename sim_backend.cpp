@@ -0,0 +1,197 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "sim_backend.h"
+#include "clock.h"
+
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+
+namespace cpu_utils {
+
+namespace {
+
+}
+
+SimulatedBackend::SimulatedBackend() : SimulatedBackend(Config{}) {}
+
+SimulatedBackend::SimulatedBackend(const Config & config)
+  : _config(config), _rng(config.seed ? config.seed : 1),
+    _die_c(config.ambient_c), _skin_c(config.ambient_c) {
+  _stapm_limit = _slow_limit = _apu_slow_limit = 15;
+  _fast_limit = 17;
+  _curve.assign(std::max(1, config.cores), 0);
+}
+
+int SimulatedBackend::family() const {
+  return FAM_SIMULATED;
+}
+
+double SimulatedBackend::noise() {
+  // xorshift64, deterministic for a given seed
+  _rng ^= _rng << 13;
+  _rng ^= _rng >> 7;
+  _rng ^= _rng << 17;
+  return (static_cast<double>(_rng >> 11) / static_cast<double>(1ull << 53)) * 2 - 1;
+}
+
+void SimulatedBackend::step(double dt) {
+  std::lock_guard<std::mutex> guard(_lock);
+  const Config & c = _config;
+  _time += dt;
+
+  const bool burst = std::fmod(_time, c.burst_period_s) < c.burst_period_s / 2;
+  _demand = std::max(0.0, c.demand_w + (burst ? c.burst_w : -c.burst_w) + c.noise_w * noise());
+  // a count is about 3 mV off a ~1.1 V rail, power goes with its square
+  double offset = 0;
+  for (int core : _curve) offset += core;
+  const double volts = 1 + offset / _curve.size() * 0.003 / 1.1;
+  _demand *= volts * volts;
+
+  // A limit may be exceeded while its average is below it, which is what
+  // lets short bursts run above the sustained limits. The allowance
+  // shrinks to the limit itself as the average catches up.
+  auto allowance = [](double limit, double avg) { return limit + std::max(0.0, limit - avg) * 2; };
+  double allowed = _fast_limit;
+  allowed = std::min(allowed, allowance(_slow_limit, _slow_avg));
+  allowed = std::min(allowed, allowance(_apu_slow_limit, _slow_avg));
+  allowed = std::min(allowed, allowance(_stapm_limit, _stapm_avg));
+  // thermal throttling holds the die at its limit
+  if (_die_c >= c.tctl_limit_c) {
+    allowed = std::min(allowed, (c.tctl_limit_c - c.ambient_c) / c.die_r);
+  }
+  _power = std::min(_demand, allowed);
+
+  _stapm_avg += (_power - _stapm_avg) * (1 - std::exp(-dt / c.stapm_time_s));
+  _slow_avg += (_power - _slow_avg) * (1 - std::exp(-dt / c.slow_time_s));
+
+  // die: C dT/dt = P - (T - Tamb) / R, solved exactly over the step
+  const double die_target = c.ambient_c + _power * c.die_r;
+  _die_c = die_target + (_die_c - die_target) * std::exp(-dt / (c.die_r * c.die_c));
+  const double skin_target = c.ambient_c + (_die_c - c.ambient_c) * c.skin_ratio;
+  _skin_c = skin_target + (_skin_c - skin_target) * std::exp(-dt / c.skin_tau_s);
+}
+
+double SimulatedBackend::time() const {
+  std::lock_guard<std::mutex> guard(_lock);
+  return _time;
+}
+
+double SimulatedBackend::demand() const {
+  std::lock_guard<std::mutex> guard(_lock);
+  return _demand;
+}
+
+void SimulatedBackend::read(RyzenTelemetry & out, MetricMask) {
+  if (_config.step_s > 0) {
+    step(_config.step_s);
+  } else {
+    const uint64_t now = monotonicNs();
+    if (_last_ns) {
+      step(std::min(1.0, (now - _last_ns) * 1e-9));
+    }
+    _last_ns = now;
+  }
+
+  std::lock_guard<std::mutex> guard(_lock);
+  const Config & c = _config;
+  out.stapm_limit = static_cast<int>(_stapm_limit);
+  out.stapm_fast_limit = static_cast<int>(_fast_limit);
+  out.stapm_slow_limit = static_cast<int>(_slow_limit);
+  out.apu_slow_limit = static_cast<int>(_apu_slow_limit);
+  out.stapm_value = _stapm_avg;
+  out.stapm_fast_value = _power;
+  out.stapm_slow_value = _slow_avg;
+  out.apu_slow_value = _slow_avg;
+  out.stapm_time = c.stapm_time_s;
+  out.stapm_slow_time = c.slow_time_s;
+  // ~1.1 V core rail carrying 80 % of the package power
+  out.vrm_limit = 55;
+  out.vrm_value = _power * 0.8 / 1.1;
+  out.vrm_soc_limit = 15;
+  out.vrm_soc_value = _power * 0.2 / 0.9;
+  out.vrm_max_limit = 90;
+  out.vrm_max_value = out.vrm_value * 1.3;
+  out.vrm_soc_max_limit = 25;
+  out.vrm_soc_max_value = out.vrm_soc_value * 1.3;
+  out.core_temp_limit = c.tctl_limit_c;
+  out.core_temp_value = _die_c;
+  out.apu_skin_temp_limit = c.skin_limit_c;
+  out.apu_skin_temp_value = _skin_c;
+  out.dgpu_skin_temp_limit = 0;
+  out.dgpu_skin_temp_value = 0;
+  // busy in %, the work asked for against the clock it gets. Clocks scale
+  // roughly with the cube root of power, so a capped workload stays busy
+  // for longer.
+  out.cclk_setpoint = 100;
+  const double clock = std::cbrt(std::min(1.0, _power / 54.0));
+  out.cclk_busy_value = clock > 0 ? 100 * std::min(1.0, _demand / 54.0 / clock) : 0;
+}
+
+// like the firmware, keep limits in range and in whole watts
+uint32_t SimulatedBackend::clamp(uint32_t mw) const {
+  return std::clamp(mw, _config.min_limit_mw, _config.max_limit_mw);
+}
+
+int SimulatedBackend::setStapmLimit(uint32_t mw) {
+  std::lock_guard<std::mutex> guard(_lock);
+  _stapm_limit = clamp(mw) / 1000;
+  return 0;
+}
+
+int SimulatedBackend::setFastLimit(uint32_t mw) {
+  std::lock_guard<std::mutex> guard(_lock);
+  _fast_limit = clamp(mw) / 1000;
+  return 0;
+}
+
+int SimulatedBackend::setSlowLimit(uint32_t mw) {
+  std::lock_guard<std::mutex> guard(_lock);
+  _slow_limit = clamp(mw) / 1000;
+  return 0;
+}
+
+int SimulatedBackend::setApuSlowLimit(uint32_t mw) {
+  std::lock_guard<std::mutex> guard(_lock);
+  _apu_slow_limit = clamp(mw) / 1000;
+  return 0;
+}
+
+int SimulatedBackend::setMaxPerformance() {
+  return 0;
+}
+
+int SimulatedBackend::setPowerSaving() {
+  return 0;
+}
+
+int SimulatedBackend::setCurveAll(int offset) {
+  std::lock_guard<std::mutex> guard(_lock);
+  std::fill(_curve.begin(), _curve.end(), offset);
+  return 0;
+}
+
+int SimulatedBackend::setCurveCore(int core, int offset) {
+  std::lock_guard<std::mutex> guard(_lock);
+  if (core < 0 || static_cast<size_t>(core) >= _curve.size()) return -1;
+  _curve[core] = offset;
+  return 0;
+}
+
+}
@@ -0,0 +1,101 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "backend.h"
+
+namespace cpu_utils {
+
+// A made up APU for running everything without hardware or root. Package
+// power follows a deterministic workload, capped by the fast limit
+// instantly and by the slow/STAPM limits through their averaging windows.
+// The die and skin heat up through RC stages and the die throttles at its
+// limit. Limits are clamped to what the "firmware" accepts.
+struct SimulatedBackend : PowerBackend {
+  struct Config {
+    double step_s = 0;           // simulated time per read(), 0 follows the wall clock
+    uint32_t seed = 1;
+    double demand_w = 25;        // average power the workload asks for
+    double burst_w = 10;         // square wave on top of it
+    double burst_period_s = 30;
+    double noise_w = 1;
+    double ambient_c = 25;
+    double die_r = 2.5;          // K/W die to ambient
+    double die_c = 8;            // J/K
+    double skin_ratio = 0.55;    // fraction of the die rise that reaches the skin
+    double skin_tau_s = 120;
+    double stapm_time_s = 200;
+    double slow_time_s = 10;
+    uint32_t min_limit_mw = 4000;
+    uint32_t max_limit_mw = 30000;
+    double tctl_limit_c = 95;
+    double skin_limit_c = 45;
+    int cores = 8;
+  };
+
+  SimulatedBackend();
+  SimulatedBackend(const Config & config);
+
+  int family() const override;
+  // cheap to model, fills everything
+  void read(RyzenTelemetry & out, MetricMask metrics) override;
+
+  int setStapmLimit(uint32_t mw) override;
+  int setFastLimit(uint32_t mw) override;
+  int setSlowLimit(uint32_t mw) override;
+  int setApuSlowLimit(uint32_t mw) override;
+
+  int setMaxPerformance() override;
+  int setPowerSaving() override;
+
+  // scale the workload's power as the lower voltage would
+  int setCurveAll(int offset) override;
+  int setCurveCore(int core, int offset) override;
+
+  // advance the model without reading it
+  void step(double dt);
+  double time() const;
+
+  // power the workload would draw without limits, for tests
+  double demand() const;
+
+private:
+  uint32_t clamp(uint32_t mw) const;
+  double noise();
+
+  Config _config;
+  mutable std::mutex _lock;
+  uint64_t _last_ns = 0;
+  uint64_t _rng;
+
+  double _time = 0;
+  double _stapm_limit, _fast_limit, _slow_limit, _apu_slow_limit; // W
+  double _power = 0;       // instantaneous package power
+  double _stapm_avg = 0;
+  double _slow_avg = 0;
+  double _die_c, _skin_c;
+  double _demand = 0;
+  std::vector<int> _curve;
+};
+
+}
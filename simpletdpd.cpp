@@ -0,0 +1,952 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "controller.h"
+#include "core_sampler.h"
+#include "curve.h"
+#include "exporter.h"
+#include "power_policy.h"
+#include "protocol.h"
+#include "sim_backend.h"
+#include "trace.h"
+#include "tuner.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include <grp.h>
+#include <poll.h>
+#include <pwd.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MIN_TDP 1
+#define MAX_TDP 120
+#define STATE_PATH "/var/lib/simpletdp/state.txt"
+// the socket's group without --group, if there is one
+#define DEFAULT_GROUP "simpletdp"
+
+namespace {
+
+struct Client {
+  int fd;
+  bool subscribed;
+  cpu_utils::MetricMask metrics;
+  ucred peer;  // from SO_PEERCRED at accept
+  bool privileged;
+};
+
+// root, or a member of the socket's group if it has one
+static bool is_privileged(const ucred & peer, gid_t group)
+{
+  if (peer.uid == 0) return true;
+  if (group == static_cast<gid_t>(-1)) return false;
+  if (peer.gid == group) return true;
+  struct passwd * pw = getpwuid(peer.uid);
+  if (!pw) return false;
+  int count = 64;
+  std::vector<gid_t> groups (count);
+  if (getgrouplist(pw->pw_name, peer.gid, groups.data(), &count) < 0) {
+    groups.resize(count);
+    if (getgrouplist(pw->pw_name, peer.gid, groups.data(), &count) < 0) return false;
+  }
+  groups.resize(count);
+  return std::find(groups.begin(), groups.end(), group) != groups.end();
+}
+
+// root, or the user the process runs as
+static bool owns_process(const ucred & peer, int pid)
+{
+  if (peer.uid == 0) return true;
+  struct stat st;
+  const std::string proc = "/proc/" + std::to_string(pid);
+  return stat(proc.c_str(), &st) == 0 && st.st_uid == peer.uid;
+}
+
+static bool contains(const std::vector<std::string> & options, const std::string & option)
+{
+  return std::find(options.begin(), options.end(), option) != options.end();
+}
+
+static std::string info(const cpu_utils::LocalController & ctrl)
+{
+  cpu_utils::protocol::Info info;
+  info.family = ctrl.getFamily();
+  info.rate = ctrl.rate();
+  info.tdp_governor = ctrl.tdpGovernor();
+  info.cpu = ctrl.cpuState();
+  info.profile = ctrl.profile();
+  info.gpu = ctrl.gpuState();
+  info.steering = ctrl.steering();
+  info.curve = ctrl.curve();
+  std::string text = cpu_utils::protocol::formatInfo(info);
+  if (text.size() > cpu_utils::protocol::MAX_MESSAGE - sizeof(cpu_utils::protocol::Header)) {
+    std::cerr << "Info of " << text.size() << " bytes does not fit a message" << std::endl;
+  }
+  return text;
+}
+
+// what the clients read, one that polls may read anything. The exporter
+// reads everything.
+static void subscribe(cpu_utils::LocalController & ctrl, const std::vector<Client> & clients, bool exporting)
+{
+  cpu_utils::MetricMask metrics = exporting ? cpu_utils::ALL_METRICS : 0;
+  for (const auto & client : clients) {
+    metrics |= client.subscribed ? client.metrics : cpu_utils::ALL_METRICS;
+  }
+  ctrl.subscribe(metrics);
+}
+
+static cpu_utils::ExporterInfo exporter_info(const cpu_utils::LocalController & ctrl)
+{
+  cpu_utils::ExporterInfo info;
+  info.rate = ctrl.rate();
+  info.scaling_governor = ctrl.cpuState().scaling_governor;
+  info.epp = ctrl.cpuState().epp;
+  info.tdp_governor = ctrl.tdpGovernor();
+  return info;
+}
+
+static void broadcast_info(cpu_utils::LocalController & ctrl, const std::vector<Client> & clients)
+{
+  const auto text = info(ctrl);
+  for (const auto & client : clients) {
+    if (client.subscribed) {
+      cpu_utils::protocol::sendText(client.fd, cpu_utils::protocol::MSG_INFO, text);
+    }
+  }
+}
+
+// Applies the policy's profile for source when it differs from the active
+// one. waited_ms is how long ago the change started, negative at startup.
+static void switch_power(cpu_utils::LocalController & ctrl, const std::vector<Client> & clients,
+                         const cpu_utils::PowerPolicy & policy, const std::vector<cpu_utils::Profile> & profiles,
+                         const cpu_utils::PowerSource & source, double waited_ms, std::string & active)
+{
+  const std::string & name = policy.select(source);
+  if (name == active) return;
+  active = name;
+  if (name.empty()) return;
+  TRACE_SPAN("power_switch");
+  auto profile = std::find_if(profiles.begin(), profiles.end(), [&](const cpu_utils::Profile & p) { return p.name == name; });
+  const auto report = ctrl.apply(*profile);
+  const double apply_ms = report.total_us * 1e-3;
+  const std::string battery = source.capacity >= 0 ? " " + std::to_string(source.capacity) + "%" : "";
+  printf("Power source %s%s: profile %s %s", source.ac ? "AC" : "battery", battery.c_str(), name.c_str(), report.ok ? "applied" : "failed");
+  if (waited_ms >= 0) {
+    printf(" %.1f ms after the first uevent (%.1f ms debounce, %.1f ms apply)", waited_ms + apply_ms, waited_ms, apply_ms);
+  }
+  printf("\n");
+  fflush(stdout);
+  broadcast_info(ctrl, clients);
+}
+
+// returns false if the client should be dropped
+static bool handle(cpu_utils::LocalController & ctrl, std::vector<Client> & clients, Client & client)
+{
+  using namespace cpu_utils::protocol;
+  Message msg;
+  if (!recv(client.fd, msg)) {
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+  }
+  TRACE_SPAN("request");
+
+  // anybody who can connect may read, only root and the group may change
+  // anything
+  const bool reads = msg.header.type == MSG_GET_SNAPSHOT || msg.header.type == MSG_GET_INFO ||
+                     msg.header.type == MSG_SUBSCRIBE || msg.header.type == MSG_UNSUBSCRIBE;
+  if (!reads && !client.privileged) {
+    return sendValue(client.fd, MSG_ACK, static_cast<int32_t>(EPERM));
+  }
+
+  int32_t status = 0;
+  switch (msg.header.type) {
+    case MSG_GET_SNAPSHOT:
+      return sendValue(client.fd, MSG_SNAPSHOT, ctrl.latest());
+    case MSG_GET_INFO:
+      return sendText(client.fd, MSG_INFO, info(ctrl));
+    case MSG_SET_TDP: {
+      int32_t tdp;
+      if (!msg.as(tdp) || tdp < MIN_TDP || tdp > MAX_TDP) {
+        status = EINVAL;
+        break;
+      }
+      // the governor mode or the profile goes with it
+      const bool announce = ctrl.tdpGovernor().mode != cpu_utils::TdpGovernor::OFF || !ctrl.profile().empty();
+      ctrl.setTdp(tdp);
+      if (announce) {
+        broadcast_info(ctrl, clients);
+      }
+      break;
+    }
+    case MSG_SET_GOVERNOR:
+      if (!contains(ctrl.cpuState().scaling_available_governors, msg.text())) {
+        status = EINVAL;
+        break;
+      }
+      ctrl.setScalingGovernor(msg.text());
+      broadcast_info(ctrl, clients);
+      break;
+    case MSG_SET_EPP:
+      if (!contains(ctrl.cpuState().epp_available_options, msg.text())) {
+        status = EINVAL;
+        break;
+      }
+      ctrl.setEPP(msg.text());
+      broadcast_info(ctrl, clients);
+      break;
+    case MSG_SET_RATE: {
+      int32_t rate;
+      if (!msg.as(rate)) {
+        status = EINVAL;
+        break;
+      }
+      ctrl.setRate(rate);
+      broadcast_info(ctrl, clients);
+      break;
+    }
+    case MSG_SET_TDP_GOVERNOR: {
+      cpu_utils::TdpGovernor::Settings settings;
+      if (!msg.as(settings) || settings.mode < 0 || settings.mode >= cpu_utils::TdpGovernor::MODE_COUNT ||
+          settings.min_tdp < MIN_TDP || settings.max_tdp > MAX_TDP || settings.min_tdp > settings.max_tdp) {
+        status = EINVAL;
+        break;
+      }
+      ctrl.setTdpGovernor(settings);
+      broadcast_info(ctrl, clients);
+      break;
+    }
+    case MSG_SET_SMT:
+    case MSG_SET_BOOST: {
+      int32_t enabled;
+      if (!msg.as(enabled) || (enabled != 0 && enabled != 1)) {
+        status = EINVAL;
+        break;
+      }
+      const auto & cs = ctrl.cpuState();
+      if ((msg.header.type == MSG_SET_SMT ? cs.smt : cs.boost) < 0) {
+        status = ENOTSUP;
+        break;
+      }
+      if (msg.header.type == MSG_SET_SMT) {
+        ctrl.setSmt(enabled);
+      } else {
+        ctrl.setBoost(enabled);
+      }
+      broadcast_info(ctrl, clients);
+      break;
+    }
+    case MSG_APPLY_PROFILE: {
+      cpu_utils::Profile profile;
+      if (!cpu_utils::parseProfile(msg.text(), profile) ||
+          (profile.tdp >= 0 && (profile.tdp < MIN_TDP || profile.tdp > MAX_TDP)) ||
+          (!profile.governor.empty() && !contains(ctrl.cpuState().scaling_available_governors, profile.governor)) ||
+          (!profile.epp.empty() && !contains(ctrl.cpuState().epp_available_options, profile.epp))) {
+        status = EINVAL;
+        break;
+      }
+      if (!ctrl.apply(profile).ok) {
+        status = EIO;
+      }
+      broadcast_info(ctrl, clients);
+      break;
+    }
+    case MSG_SET_GPU_LEVEL:
+    case MSG_SET_GPU_SCLK:
+    case MSG_SET_GPU_POWER_PROFILE: {
+      const auto & gs = ctrl.gpuState();
+      if (gs.device.empty()) {
+        status = ENOTSUP;
+        break;
+      }
+      // the setters read the state back, it tells whether they stuck
+      if (msg.header.type == MSG_SET_GPU_LEVEL) {
+        const std::string level = msg.text();
+        if (!contains(gs.performance_levels, level)) {
+          status = EINVAL;
+          break;
+        }
+        ctrl.setGpuPerformanceLevel(level);
+        if (gs.performance_level != level) status = EIO;
+      } else if (msg.header.type == MSG_SET_GPU_SCLK) {
+        int32_t range[2];
+        if (!msg.as(range) || gs.sclk_lo < 0 || range[0] < gs.sclk_lo || range[1] > gs.sclk_hi || range[0] > range[1]) {
+          status = gs.sclk_lo < 0 ? ENOTSUP : EINVAL;
+          break;
+        }
+        ctrl.setGpuSclk(range[0], range[1]);
+        if (gs.sclk_min != range[0] || gs.sclk_max != range[1]) status = EIO;
+      } else {
+        int32_t index;
+        if (!msg.as(index) || index < 0 || static_cast<size_t>(index) >= gs.power_profiles.size()) {
+          status = EINVAL;
+          break;
+        }
+        ctrl.setGpuPowerProfile(index);
+        if (gs.power_profile != index) status = EIO;
+      }
+      broadcast_info(ctrl, clients);
+      break;
+    }
+    case MSG_SET_PSTATE: {
+      const auto & cs = ctrl.cpuState();
+      const std::string status_name = msg.text();
+      if (cs.pstate_status.empty()) {
+        status = ENOTSUP;
+        break;
+      }
+      if (!contains(cs.pstate_statuses, status_name)) {
+        status = EINVAL;
+        break;
+      }
+      ctrl.setPstateStatus(status_name);
+      if (cs.pstate_status != status_name) status = EIO;
+      broadcast_info(ctrl, clients);
+      break;
+    }
+    case MSG_SET_FREQ_RANGE: {
+      std::vector<int> cpus;
+      int min_khz, max_khz;
+      const size_t count = ctrl.cpuState().cpus.size();
+      if (!cpu_utils::protocol::parseFreqRange(msg.text(), cpus, min_khz, max_khz) ||
+          std::any_of(cpus.begin(), cpus.end(), [&](int cpu) { return static_cast<size_t>(cpu) >= count; })) {
+        status = EINVAL;
+        break;
+      }
+      ctrl.setFreqRange(cpus, min_khz, max_khz);
+      broadcast_info(ctrl, clients);
+      break;
+    }
+    case MSG_STEER: {
+      cpu_utils::CoreSteering::Settings settings;
+      if (!msg.as(settings) || settings.pid < 0 || settings.cap_khz < 0) {
+        status = EINVAL;
+        break;
+      }
+      // pinning someone else's process is not up to the caller, nor is
+      // releasing it
+      const int target = settings.pid ? settings.pid : ctrl.steering().pid;
+      if (target && !owns_process(client.peer, target)) {
+        status = EPERM;
+        break;
+      }
+      // a failure that didn't set errno still isn't a success
+      errno = 0;
+      if (!ctrl.steerProcess(settings)) {
+        status = errno ? errno : EIO;
+      }
+      broadcast_info(ctrl, clients);
+      break;
+    }
+    case MSG_SET_CURVE: {
+      std::vector<int> offsets;
+      if (!cpu_utils::protocol::parseCurve(msg.text(), offsets) || offsets.size() != ctrl.curve().size() ||
+          std::any_of(offsets.begin(), offsets.end(), [](int offset) { return offset < -30 || offset > 30; })) {
+        status = EINVAL;
+        break;
+      }
+      if (ctrl.cpuState().curveCoreIds().empty() &&
+          std::any_of(offsets.begin(), offsets.end(), [&](int offset) { return offset != offsets.front(); })) {
+        status = ENOTSUP;
+        break;
+      }
+      ctrl.setCurve(offsets);
+      if (ctrl.curve() != offsets) status = EIO;
+      broadcast_info(ctrl, clients);
+      break;
+    }
+    case MSG_SUBSCRIBE: {
+      cpu_utils::MetricMask metrics = cpu_utils::ALL_METRICS;
+      if (msg.header.size && !msg.as(metrics)) {
+        status = EINVAL;
+        break;
+      }
+      client.subscribed = true;
+      client.metrics = metrics;
+      break;
+    }
+    case MSG_UNSUBSCRIBE:
+      client.subscribed = false;
+      break;
+    default:
+      status = ENOSYS;
+      break;
+  }
+  return sendValue(client.fd, MSG_ACK, status);
+}
+
+// Loopback harness: time GET_SNAPSHOT round trips against a running daemon.
+static int ping(const char * path, int count)
+{
+  using namespace cpu_utils::protocol;
+  using clock = std::chrono::steady_clock;
+  int fd = connectSocket(path);
+  if (fd < 0) {
+    printf("Error: cannot connect to %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  std::vector<double> rtt;
+  rtt.reserve(count);
+  Message msg;
+  for (int i = -10; i < count; ++i) {
+    auto start = clock::now();
+    if (!send(fd, MSG_GET_SNAPSHOT) || !recv(fd, msg) || msg.header.type != MSG_SNAPSHOT) {
+      printf("Error: request failed\n");
+      close(fd);
+      return -1;
+    }
+    // the first few requests only warm up caches
+    if (i >= 0) {
+      rtt.push_back(std::chrono::duration<double, std::micro>(clock::now() - start).count());
+    }
+  }
+  close(fd);
+  std::sort(rtt.begin(), rtt.end());
+  auto at = [&](double q) { return rtt[std::min(rtt.size() - 1, static_cast<size_t>(q * rtt.size()))]; };
+  printf("%d requests, round trip (us): min %.1f p50 %.1f p99 %.1f max %.1f\n",
+         count, rtt.front(), at(0.5), at(0.99), rtt.back());
+  return 0;
+}
+
+// Closed loop harness: run the TDP governor against the simulated APU and
+// report how it settles.
+static int governor_sim(const char * mode, float target, int seconds)
+{
+  using cpu_utils::TdpGovernor;
+  TdpGovernor::Settings settings;
+  settings.target = target;
+  // the simulated APU has no battery
+  if (!strcmp(mode, "skin")) {
+    settings.mode = TdpGovernor::SKIN_TEMP;
+  } else if (!strcmp(mode, "power")) {
+    settings.mode = TdpGovernor::PACKAGE_POWER;
+  } else {
+    printf("Error: --governor-sim mode must be skin or power\n");
+    return -1;
+  }
+  const int starts[] = { settings.min_tdp + 2, settings.max_tdp - 5 };
+  for (int start : starts) {
+    auto result = cpu_utils::simulateGovernor(settings, seconds, 4, start);
+    printf("%s -> %.1f %s from %d W: converged in %.0f s, overshoot %.2f, final error %.2f, %d TDP writes\n",
+           TdpGovernor::modeName(settings.mode), target, TdpGovernor::modeUnit(settings.mode), start,
+           result.convergence_s, result.overshoot, result.final_error, result.writes);
+  }
+  return 0;
+}
+
+// Apply latency of the per-CPU sysfs writer against a fake tree in a
+// temporary directory.
+static int bench_sysfs(int cpus)
+{
+  char dir[] = "/tmp/simpletdp-sysfs.XXXXXX";
+  if (!mkdtemp(dir)) {
+    printf("Error: cannot create a temporary directory: %s\n", strerror(errno));
+    return -1;
+  }
+  auto result = cpu_utils::benchSysfsWriter(dir, cpus, 100);
+  std::filesystem::remove_all(dir);
+  printf("%d CPUs, apply latency (us): cold %.1f, changed %.1f, unchanged %.1f, ofstream per CPU %.1f\n",
+         cpus, result.cold_us, result.apply_us, result.noop_us, result.baseline_us);
+  return 0;
+}
+
+// Per-sample cost of the per-core sampler against a fake tree in a
+// temporary directory.
+static int bench_cores(int cpus)
+{
+  char dir[] = "/tmp/simpletdp-cores.XXXXXX";
+  if (!mkdtemp(dir)) {
+    printf("Error: cannot create a temporary directory: %s\n", strerror(errno));
+    return -1;
+  }
+  auto result = cpu_utils::benchCoreSampler(dir, cpus, 1000);
+  std::filesystem::remove_all(dir);
+  printf("%d CPUs, per-core sample (us): mean %.1f, max %.1f, budget %.1f\n",
+         cpus, result.mean_us, result.max_us, cpu_utils::CoreSampler::BUDGET_NS * 1e-3);
+  return 0;
+}
+
+// Sweep the TDP under a fixed load and file where throughput per watt
+// stops paying off. The simulator steps its own clock so this runs in
+// simulated time.
+static int tune(const cpu_utils::TuneSettings & settings, bool simulate, const std::filesystem::path & sysfs_root,
+                const char * path)
+{
+  if (settings.min_tdp < 1 || settings.max_tdp < settings.min_tdp || settings.step < 1) {
+    printf("Error: --tune needs 1 <= min <= max and a positive step\n");
+    return -1;
+  }
+  try {
+    std::unique_ptr<cpu_utils::PowerBackend> backend;
+    if (simulate) {
+      cpu_utils::SimulatedBackend::Config config;
+      config.step_s = settings.tick_s;
+      // steady and past the highest limit, so the limit is what binds
+      config.demand_w = 40;
+      config.burst_w = 0;
+      backend = std::make_unique<cpu_utils::SimulatedBackend>(config);
+    } else {
+      backend = std::make_unique<cpu_utils::RyzenAdjBackend>();
+    }
+    cpu_utils::RyzenState rs (std::move(backend));
+    cpu_utils::CPUState cs;
+    cs.sysfs_root = sysfs_root;
+    cs.initOnline();
+    std::unique_ptr<cpu_utils::TuneLoad> load;
+    if (simulate) {
+      load = std::make_unique<cpu_utils::SimulatedLoad>(rs);
+    } else {
+      load = std::make_unique<cpu_utils::KernelLoad>(cs);
+    }
+    printf("%5s %8s %14s %22s %8s %8s %10s\n", "TDP", "settle", "power (W)", load->unit(), "core", "skin", "per watt");
+    auto result = cpu_utils::runTdpSweep(rs, *load, settings, [](const cpu_utils::TunePoint & p) {
+      printf("%5d %7.1fs %7.2f ±%5.2f %12.1f ±%8.1f %7.1fC %7.1fC %10.2f\n", p.tdp, p.settle_s, p.power_w, p.power_sd,
+             p.throughput, p.throughput_sd, p.core_temp, p.skin_temp, p.perfPerWatt());
+      fflush(stdout);
+    });
+    const std::string device = cpu_utils::deviceName(sysfs_root, rs.getFamily());
+    printf("%s: knee at %d W, best throughput per watt at %d W\n", device.c_str(), result.knee_tdp, result.best_tdp);
+    const std::filesystem::path file = path ? std::filesystem::path(path) : cpu_utils::tunePath(device);
+    cpu_utils::saveTuneResult(file, device, result);
+    printf("Saved to %s\n", file.c_str());
+  } catch (const char * err) {
+    printf("Error: %s\n", err);
+    return -1;
+  }
+  return 0;
+}
+
+// Walk the Curve Optimizer offsets down under the stress kernel, saving
+// after every step so a crash resumes where it left off. The simulator
+// steps its own clock so this runs in simulated time.
+static int curve_search(const cpu_utils::CurveSettings & settings, bool simulate, const std::filesystem::path & sysfs_root,
+                        const char * path)
+{
+  if (settings.step < 1 || settings.limit < -30 || settings.limit > 0 || settings.test_s <= 0) {
+    printf("Error: --curve-search needs a positive step, -30 <= limit <= 0 and positive seconds\n");
+    return -1;
+  }
+  try {
+    cpu_utils::CPUState cs;
+    cs.sysfs_root = sysfs_root;
+    cs.init();
+    std::unique_ptr<cpu_utils::PowerBackend> backend;
+    if (simulate) {
+      cpu_utils::SimulatedBackend::Config config;
+      config.step_s = settings.tick_s;
+      // steady and under the limits, so the power follows the voltage
+      config.demand_w = 12;
+      config.burst_w = 0;
+      config.cores = cs.physicalCores().size();
+      backend = std::make_unique<cpu_utils::SimulatedBackend>(config);
+      // no clocks to hold, and the real ones stay alone
+      cs.freq.clear();
+    } else {
+      backend = std::make_unique<cpu_utils::RyzenAdjBackend>();
+    }
+    cpu_utils::RyzenState rs (std::move(backend));
+    cpu_utils::SysfsWriter writer;
+    std::unique_ptr<cpu_utils::StressLoad> stress;
+    if (simulate) {
+      stress = std::make_unique<cpu_utils::SimulatedStress>();
+    } else {
+      stress = std::make_unique<cpu_utils::KernelStress>();
+    }
+    const std::string device = cpu_utils::deviceName(sysfs_root, rs.getFamily());
+    const std::filesystem::path file = path ? std::filesystem::path(path) : cpu_utils::curvePath(device);
+    cpu_utils::CurveProfile profile;
+    if (cpu_utils::loadCurve(file, profile)) {
+      printf("Resuming from %s%s\n", file.c_str(),
+             profile.testing.empty() ? "" : ", backing off the cores of the step that did not finish");
+    }
+    cpu_utils::runCurveSearch(rs, cs, *stress, writer, settings, profile, [&](const cpu_utils::CurveProfile & p) {
+      cpu_utils::saveCurve(file, device, p);
+    }, [](const std::vector<int> & offsets, const std::vector<bool> & failed) {
+      for (size_t core = 0; core < offsets.size(); ++core) {
+        printf(" %4d%c", offsets[core], failed[core] ? '!' : ' ');
+      }
+      printf("\n");
+      fflush(stdout);
+    });
+    printf("%s: offsets %s\n", device.c_str(), cpu_utils::protocol::formatCurve(profile.offsets).c_str());
+    printf("Package power %.2f W -> %.2f W (%+.1f%%)", profile.base_w, profile.tuned_w,
+           profile.base_w > 0 ? (profile.tuned_w / profile.base_w - 1) * 100 : 0.0);
+    if (profile.freq_khz > 0) printf(" at %d MHz", profile.freq_khz / 1000);
+    printf("\nSaved to %s\n", file.c_str());
+  } catch (const char * err) {
+    printf("Error: %s\n", err);
+    return -1;
+  }
+  return 0;
+}
+
+// Offsets the SMU forgot on the last reset. Not those of a search that
+// never finished, the step it was on may be what reset the machine.
+static void apply_saved_curve(cpu_utils::LocalController & ctrl, const std::filesystem::path & sysfs_root)
+{
+  const auto path = cpu_utils::curvePath(cpu_utils::deviceName(sysfs_root, ctrl.getFamily()));
+  cpu_utils::CurveProfile profile;
+  if (!cpu_utils::loadCurve(path, profile)) return;
+  if (!profile.testing.empty()) {
+    std::cerr << path.string() << ": a curve search did not finish, run simpletdpd --curve-search to resume it" << std::endl;
+    return;
+  }
+  if (profile.offsets.size() != ctrl.curve().size()) {
+    std::cerr << path.string() << ": offsets for " << profile.offsets.size() << " cores, there are "
+              << ctrl.curve().size() << std::endl;
+    return;
+  }
+  ctrl.setCurve(profile.offsets);
+  if (ctrl.curve() == profile.offsets) {
+    std::cout << "Applied the curve offsets from " << path.string() << std::endl;
+  }
+}
+
+static void usage(const char * name)
+{
+  printf("Usage: %s [--socket <path>] [--rate <%d-%d Hz>] [--group <name>] [--record <file>] [--simulate] [--sysfs-root <dir>]\n"
+         "          [--metrics-port <port>] [--metrics-textfile <file>] [--trace <file>]\n"
+         "          [--profiles <file>] [--on-ac <profile>] [--on-battery <profile>] [--on-low-battery <percent> <profile>]...\n"
+         "          [--power-debounce <ms>] [--no-curve] [--state-file <file>] [--no-restore]\n"
+         "       %s [--socket <path>] --ping <count>\n"
+         "       %s --governor-sim <skin|power> <target> [--seconds <n>]\n"
+         "       %s --bench-sysfs <cpus>\n"
+         "       %s --bench-cores <cpus>\n"
+         "       %s --tune <min W> <max W> [--tune-step <W>] [--tune-file <file>] [--simulate] [--sysfs-root <dir>]\n"
+         "       %s --curve-search [--curve-step <n>] [--curve-limit <n>] [--curve-seconds <s>] [--curve-file <file>]\n"
+         "          [--simulate] [--sysfs-root <dir>]\n",
+         name, cpu_utils::Sampler::MIN_RATE, cpu_utils::Sampler::MAX_RATE, name, name, name, name, name, name);
+}
+
+}
+
+int main(int argc, char ** argv){
+  const char * socketPath = SOCKET_PATH;
+  const char * group = nullptr;
+  const char * recordPath = nullptr;
+  const char * tracePath = nullptr;
+  const char * sysfsRoot = "/sys";
+  bool simulate = false;
+  int sampleRate = 4;
+  int pingCount = 0;
+  const char * simMode = nullptr;
+  float simTarget = 0;
+  int simSeconds = 1800;
+  int benchCpus = 0;
+  int benchCores = 0;
+  bool tuneSweep = false;
+  cpu_utils::TuneSettings tuneSettings;
+  const char * tuneFile = nullptr;
+  bool curveSearch = false;
+  cpu_utils::CurveSettings curveSettings;
+  const char * curveFile = nullptr;
+  bool applyCurve = true;
+  const char * statePath = STATE_PATH;
+  bool restoreState = true;
+  int metricsPort = 0;
+  const char * metricsTextfile = nullptr;
+  std::vector<cpu_utils::Profile> profiles = cpu_utils::builtinProfiles();
+  cpu_utils::PowerPolicy powerPolicy;
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--socket") && i + 1 < argc) {
+      socketPath = argv[++i];
+    } else if (!strcmp(argv[i], "--rate") && i + 1 < argc) {
+      sampleRate = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--group") && i + 1 < argc) {
+      group = argv[++i];
+    } else if (!strcmp(argv[i], "--record") && i + 1 < argc) {
+      recordPath = argv[++i];
+    } else if (!strcmp(argv[i], "--trace") && i + 1 < argc) {
+      tracePath = argv[++i];
+    } else if (!strcmp(argv[i], "--metrics-port") && i + 1 < argc) {
+      metricsPort = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--metrics-textfile") && i + 1 < argc) {
+      metricsTextfile = argv[++i];
+    } else if (!strcmp(argv[i], "--profiles") && i + 1 < argc) {
+      try {
+        profiles = cpu_utils::loadProfiles(argv[++i]);
+      } catch (const char * err) {
+        printf("Error: %s: %s\n", argv[i], err);
+        return -1;
+      }
+    } else if (!strcmp(argv[i], "--on-ac") && i + 1 < argc) {
+      powerPolicy.ac = argv[++i];
+    } else if (!strcmp(argv[i], "--on-battery") && i + 1 < argc) {
+      powerPolicy.battery = argv[++i];
+    } else if (!strcmp(argv[i], "--on-low-battery") && i + 2 < argc) {
+      const int percent = atoi(argv[++i]);
+      powerPolicy.low_battery.push_back({ percent, argv[++i] });
+    } else if (!strcmp(argv[i], "--power-debounce") && i + 1 < argc) {
+      powerPolicy.debounce_ms = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--simulate")) {
+      simulate = true;
+    } else if (!strcmp(argv[i], "--sysfs-root") && i + 1 < argc) {
+      sysfsRoot = argv[++i];
+    } else if (!strcmp(argv[i], "--ping") && i + 1 < argc) {
+      pingCount = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--governor-sim") && i + 2 < argc) {
+      simMode = argv[++i];
+      simTarget = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--seconds") && i + 1 < argc) {
+      simSeconds = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--bench-sysfs") && i + 1 < argc) {
+      benchCpus = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--bench-cores") && i + 1 < argc) {
+      benchCores = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--tune") && i + 2 < argc) {
+      tuneSweep = true;
+      tuneSettings.min_tdp = atoi(argv[++i]);
+      tuneSettings.max_tdp = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--tune-step") && i + 1 < argc) {
+      tuneSettings.step = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--tune-file") && i + 1 < argc) {
+      tuneFile = argv[++i];
+    } else if (!strcmp(argv[i], "--curve-search")) {
+      curveSearch = true;
+    } else if (!strcmp(argv[i], "--curve-step") && i + 1 < argc) {
+      curveSettings.step = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--curve-limit") && i + 1 < argc) {
+      curveSettings.limit = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--curve-seconds") && i + 1 < argc) {
+      curveSettings.test_s = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--curve-file") && i + 1 < argc) {
+      curveFile = argv[++i];
+    } else if (!strcmp(argv[i], "--no-curve")) {
+      applyCurve = false;
+    } else if (!strcmp(argv[i], "--state-file") && i + 1 < argc) {
+      statePath = argv[++i];
+    } else if (!strcmp(argv[i], "--no-restore")) {
+      restoreState = false;
+    } else {
+      usage(argv[0]);
+      return -1;
+    }
+  }
+
+  if (pingCount > 0) {
+    return ping(socketPath, pingCount);
+  }
+  if (simMode) {
+    return governor_sim(simMode, simTarget, simSeconds);
+  }
+  if (benchCpus > 0) {
+    return bench_sysfs(benchCpus);
+  }
+  if (benchCores > 0) {
+    return bench_cores(benchCores);
+  }
+  if (tuneSweep) {
+    return tune(tuneSettings, simulate, sysfsRoot, tuneFile);
+  }
+  if (curveSearch) {
+    return curve_search(curveSettings, simulate, sysfsRoot, curveFile);
+  }
+  std::vector<std::string> policyProfiles = { powerPolicy.ac, powerPolicy.battery };
+  for (const auto & rule : powerPolicy.low_battery) {
+    policyProfiles.push_back(rule.profile);
+  }
+  for (const auto & name : policyProfiles) {
+    if (!name.empty() && std::none_of(profiles.begin(), profiles.end(), [&](const cpu_utils::Profile & p) { return p.name == name; })) {
+      printf("Error: unknown profile %s\n", name.c_str());
+      return -1;
+    }
+  }
+
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  // dumps the trace
+  sigaddset(&signals, SIGUSR1);
+  // block before any thread is spawned so only the signalfd sees them
+  sigprocmask(SIG_BLOCK, &signals, nullptr);
+  int sigFd = signalfd(-1, &signals, SFD_CLOEXEC);
+
+  // the sampler thread only pokes this, the main loop sleeps in poll() otherwise
+  int sampleFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+  try {
+    std::unique_ptr<cpu_utils::PowerBackend> backend;
+    if (simulate) {
+      backend = std::make_unique<cpu_utils::SimulatedBackend>();
+    } else {
+      backend = std::make_unique<cpu_utils::RyzenAdjBackend>();
+    }
+    if (tracePath) {
+      cpu_utils::trace::setEnabled(true);
+    }
+    cpu_utils::trace::setThreadName("main");
+    cpu_utils::LocalController ctrl{sampleRate, std::move(backend), sysfsRoot};
+    if (recordPath) {
+      ctrl.record(recordPath);
+    }
+    // the firmware came up with its own limits, the power policy goes
+    // over these once it starts
+    ctrl.persist(statePath, restoreState);
+    if (applyCurve) {
+      apply_saved_curve(ctrl, sysfsRoot);
+    }
+    ctrl.setListener([sampleFd] {
+      uint64_t one = 1;
+      [[maybe_unused]] auto n = write(sampleFd, &one, sizeof(one));
+    });
+
+    int listenFd = cpu_utils::protocol::listenSocket(socketPath);
+    if (listenFd < 0) {
+      printf("Error: cannot listen on %s: %s\n", socketPath, strerror(errno));
+      return -1;
+    }
+    // root only unless there is a group to hand it to
+    gid_t socketGroup = -1;
+    struct group * gr = getgrnam(group ? group : DEFAULT_GROUP);
+    if (group && (!gr || chown(socketPath, -1, gr->gr_gid) < 0)) {
+      printf("Error: cannot hand %s to group %s\n", socketPath, group);
+      return -1;
+    }
+    if (gr && (group || chown(socketPath, 0, gr->gr_gid) == 0)) {
+      socketGroup = gr->gr_gid;
+    }
+    chmod(socketPath, 0660);
+
+    std::unique_ptr<cpu_utils::MetricsExporter> exporter;
+    if (metricsPort || metricsTextfile) {
+      exporter = std::make_unique<cpu_utils::MetricsExporter>(metricsPort, metricsTextfile ? metricsTextfile : "");
+    }
+    // nobody is reading until a client connects
+    subscribe(ctrl, {}, exporter != nullptr);
+    ctrl.start();
+
+    std::vector<Client> clients;
+    // the profile picked for the current power source
+    std::string powerProfile;
+    std::unique_ptr<cpu_utils::PowerMonitor> power;
+    if (!powerPolicy.empty()) {
+      power = std::make_unique<cpu_utils::PowerMonitor>(sysfsRoot, powerPolicy.debounce_ms);
+      if (!power->start()) {
+        std::cerr << "Cannot listen for power supply events: " << strerror(errno) << std::endl;
+      }
+      switch_power(ctrl, clients, powerPolicy, profiles, cpu_utils::readPowerSource(sysfsRoot), -1, powerProfile);
+    }
+    std::cout << "simpletdpd listening on " << socketPath << std::endl;
+
+    std::vector<pollfd> fds;
+    uint64_t cpuVersion = ctrl.cpuVersion();
+    bool done = false;
+    while (!done) {
+      fds.clear();
+      fds.push_back({ sigFd, POLLIN, 0 });
+      fds.push_back({ sampleFd, POLLIN, 0 });
+      fds.push_back({ listenFd, POLLIN, 0 });
+      // never readable without a policy
+      fds.push_back({ power ? power->fd() : -1, POLLIN, 0 });
+      for (const auto & client : clients) {
+        fds.push_back({ client.fd, POLLIN, 0 });
+      }
+      if (poll(fds.data(), fds.size(), -1) < 0) {
+        if (errno == EINTR) continue;
+        break;
+      }
+
+      if (fds[0].revents) {
+        signalfd_siginfo info;
+        if (read(sigFd, &info, sizeof(info)) == sizeof(info) && info.ssi_signo == SIGUSR1) {
+          if (tracePath && !cpu_utils::trace::dump(tracePath)) {
+            printf("Error: cannot write %s\n", tracePath);
+          }
+        } else {
+          done = true;
+        }
+      }
+
+      if (fds[1].revents) {
+        uint64_t count;
+        [[maybe_unused]] auto n = read(sampleFd, &count, sizeof(count));
+        // the same wakeup covers CPU hotplug
+        ctrl.update();
+        if (ctrl.cpuVersion() != cpuVersion) {
+          cpuVersion = ctrl.cpuVersion();
+          broadcast_info(ctrl, clients);
+        }
+        const auto snap = ctrl.latest();
+        if (exporter) {
+          exporter->publish(snap, exporter_info(ctrl));
+        }
+        for (const auto & client : clients) {
+          // a client that can't keep up just misses samples
+          if (client.subscribed) {
+            cpu_utils::protocol::sendValue(client.fd, cpu_utils::protocol::MSG_SNAPSHOT, snap);
+          }
+        }
+      }
+
+      if (fds[2].revents) {
+        int fd;
+        while ((fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+          ucred peer {};
+          socklen_t size = sizeof(peer);
+          if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &size) < 0) {
+            close(fd);
+            continue;
+          }
+          clients.push_back({ fd, false, 0, peer, is_privileged(peer, socketGroup) });
+        }
+      }
+
+      if (fds[3].revents) {
+        double waited_ms;
+        const auto source = power->settle(waited_ms);
+        switch_power(ctrl, clients, powerPolicy, profiles, source, waited_ms, powerProfile);
+      }
+
+      // clients accepted above have no entry in fds yet
+      for (size_t i = 4; i < fds.size(); ++i) {
+        if (!fds[i].revents) continue;
+        auto client = std::find_if(clients.begin(), clients.end(), [&](const Client & c) { return c.fd == fds[i].fd; });
+        if ((fds[i].revents & (POLLERR | POLLHUP)) || !handle(ctrl, clients, *client)) {
+          close(client->fd);
+          clients.erase(client);
+        }
+      }
+      subscribe(ctrl, clients, exporter != nullptr);
+    }
+
+    for (const auto & client : clients) {
+      close(client.fd);
+    }
+    if (tracePath && !cpu_utils::trace::dump(tracePath)) {
+      printf("Error: cannot write %s\n", tracePath);
+    }
+    close(listenFd);
+    unlink(socketPath);
+  } catch (const char * err) {
+    printf("Error: %s\n", err);
+    return -1;
+  }
+
+  return 0;
+}
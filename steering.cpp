@@ -0,0 +1,152 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "steering.h"
+#include "trace.h"
+
+#include <cerrno>
+#include <cstdlib>
+
+#include <sched.h>
+
+namespace cpu_utils {
+
+namespace {
+
+static std::vector<int> online_cpus(const CPUState & cs)
+{
+  std::vector<int> online;
+  for (size_t i = 0; i < cs.cpus.size(); ++i) {
+    if (std::get<1>(cs.cpus[i])) online.push_back(i);
+  }
+  return online;
+}
+
+}
+
+CoreSteering::CoreSteering(const std::filesystem::path & proc_root) : _proc_root(proc_root) {}
+
+bool CoreSteering::pin(int pid, const std::vector<int> & cpus, std::vector<Saved> * saved) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) {
+    if (cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+  }
+  std::error_code ec;
+  bool any = false;
+  for (const auto & task : std::filesystem::directory_iterator(_proc_root / std::to_string(pid) / "task", ec)) {
+    const int tid = atoi(task.path().filename().c_str());
+    if (tid <= 0) continue;
+    Saved before { tid, {} };
+    if (saved && sched_getaffinity(tid, sizeof(before.mask), &before.mask) != 0) continue;
+    // threads may exit while we go
+    if (sched_setaffinity(tid, sizeof(set), &set) != 0) continue;
+    if (saved) saved->push_back(before);
+    any = true;
+  }
+  if (ec) errno = ESRCH;
+  return any;
+}
+
+void CoreSteering::unpin(const CPUState & cs) {
+  cpu_set_t online;
+  CPU_ZERO(&online);
+  for (int cpu : online_cpus(cs)) {
+    if (cpu < CPU_SETSIZE) CPU_SET(cpu, &online);
+  }
+  auto saved = [&](int tid) -> const cpu_set_t * {
+    for (const auto & task : _saved) {
+      if (task.tid == tid) return &task.mask;
+    }
+    return nullptr;
+  };
+  const cpu_set_t * main = saved(_settings.pid);
+  std::error_code ec;
+  // gone by now is fine
+  for (const auto & task : std::filesystem::directory_iterator(_proc_root / std::to_string(_settings.pid) / "task", ec)) {
+    const int tid = atoi(task.path().filename().c_str());
+    if (tid <= 0) continue;
+    const cpu_set_t * mask = saved(tid);
+    if (!mask) mask = main ? main : &online;
+    sched_setaffinity(tid, sizeof(*mask), mask);
+  }
+  _saved.clear();
+}
+
+bool CoreSteering::steer(CPUState & cs, const Settings & settings, SysfsWriter & writer) {
+  TRACE_SPAN("cpu_steer");
+  if (settings.pid <= 0 || settings.cores <= 0) {
+    errno = EINVAL;
+    return false;
+  }
+  const std::vector<int> preferred = cs.preferredCpus(settings.cores);
+  if (preferred.empty()) return false;
+  // a different process, or the same one on other cores where what it had
+  // before the first pin stays saved
+  const bool other = _settings.pid != settings.pid;
+  std::vector<Saved> saved;
+  if (!pin(settings.pid, preferred, other ? &saved : nullptr)) return false;
+  if (other) {
+    if (_settings.pid) unpin(cs);
+    _saved = std::move(saved);
+  }
+  uncap(cs, writer);
+
+  _settings = settings;
+  _preferred = preferred;
+  if (settings.cap_khz > 0) {
+    std::vector<bool> keep (cs.cpus.size(), false);
+    for (int cpu : preferred) keep[cpu] = true;
+    std::vector<int> rest;
+    for (size_t i = 0; i < cs.cpus.size(); ++i) {
+      if (keep[i] || !std::get<1>(cs.cpus[i])) continue;
+      rest.push_back(i);
+      _capped.push_back({ static_cast<int>(i), cs.freq[i].scaling_min_khz, cs.freq[i].scaling_max_khz });
+    }
+    // the minimum comes down with the cap if it has to
+    for (int cpu : rest) {
+      cs.setFreqRange({ cpu }, std::min(cs.freq[cpu].scaling_min_khz, settings.cap_khz), settings.cap_khz, writer);
+    }
+  }
+  return true;
+}
+
+void CoreSteering::release(CPUState & cs, SysfsWriter & writer) {
+  if (!_settings.pid) return;
+  unpin(cs);
+  uncap(cs, writer);
+  _preferred.clear();
+  _settings.pid = 0;
+}
+
+void CoreSteering::uncap(CPUState & cs, SysfsWriter & writer) {
+  for (const auto & capped : _capped) {
+    cs.setFreqRange({ capped.cpu }, capped.min_khz, capped.max_khz, writer);
+  }
+  _capped.clear();
+}
+
+const CoreSteering::Settings & CoreSteering::settings() const {
+  return _settings;
+}
+
+const std::vector<int> & CoreSteering::preferred() const {
+  return _preferred;
+}
+
+}
@@ -0,0 +1,80 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <filesystem>
+#include <vector>
+
+#include <sched.h>
+
+#include "cpu_utils.h"
+
+namespace cpu_utils {
+
+// Pins a process onto the highest ranked cores and caps the maximum
+// frequency of the others, so a game bound by one or two threads gets the
+// fastest cores and the rest leave it the power budget, without a higher
+// TDP.
+struct CoreSteering {
+  struct Settings {
+    int pid = 0;       // 0 when nothing is steered
+    int cores = 2;
+    int cap_khz = 0;   // for the other CPUs, 0 leaves them alone
+  };
+
+  explicit CoreSteering(const std::filesystem::path & proc_root = "/proc");
+
+  // every thread of the process, threads it starts later inherit it.
+  // Replaces what was steered before. False with errno set if the process
+  // can't be pinned, nothing is changed then.
+  bool steer(CPUState & cs, const Settings & settings, SysfsWriter & writer);
+  // gives the process back the affinity it had and puts the capped maximums
+  // back
+  void release(CPUState & cs, SysfsWriter & writer);
+
+  const Settings & settings() const;
+  // where the process runs
+  const std::vector<int> & preferred() const;
+
+private:
+  struct Saved {
+    int tid;
+    cpu_set_t mask;   // before it was pinned
+  };
+
+  // saved gets the affinity of every thread it pins, when not null
+  bool pin(int pid, const std::vector<int> & cpus, std::vector<Saved> * saved);
+  // threads started since get the main thread's, online CPUs if unknown
+  void unpin(const CPUState & cs);
+  void uncap(CPUState & cs, SysfsWriter & writer);
+
+  struct Capped {
+    int cpu;
+    int min_khz;   // scaling range before the cap
+    int max_khz;
+  };
+
+  std::filesystem::path _proc_root;
+  Settings _settings;
+  std::vector<int> _preferred;
+  std::vector<Saved> _saved;
+  std::vector<Capped> _capped;
+};
+
+}
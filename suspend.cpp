@@ -0,0 +1,51 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "suspend.h"
+
+#include <ctime>
+
+namespace cpu_utils {
+
+namespace {
+
+static int64_t clock_ns(clockid_t clock)
+{
+  timespec ts;
+  clock_gettime(clock, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000ll + ts.tv_nsec;
+}
+
+static int64_t gap_ns()
+{
+  return clock_ns(CLOCK_BOOTTIME) - clock_ns(CLOCK_MONOTONIC);
+}
+
+}
+
+SuspendClock::SuspendClock() : _gap_ns(gap_ns()) {}
+
+uint64_t SuspendClock::suspendedNs() {
+  const int64_t gap = gap_ns();
+  const int64_t suspended = gap - _gap_ns;
+  if (suspended < MIN_SUSPEND_NS) return 0;
+  _gap_ns = gap;
+  return suspended;
+}
+
+}
@@ -0,0 +1,41 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstdint>
+
+namespace cpu_utils {
+
+// CLOCK_MONOTONIC stops while the machine is suspended, CLOCK_BOOTTIME
+// doesn't, so the gap between them grows by every suspend. Two clock reads
+// per check, made whenever the caller wakes up anyway, nothing polls.
+struct SuspendClock {
+  // below this the gap is read jitter
+  static constexpr int64_t MIN_SUSPEND_NS = 10000000;
+
+  SuspendClock();
+
+  // time spent suspended since the last call, 0 if there was no suspend
+  uint64_t suspendedNs();
+
+private:
+  int64_t _gap_ns;
+};
+
+}
@@ -0,0 +1,220 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "sysfs_writer.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <string_view>
+
+#include <fcntl.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+
+#ifndef SYSFS_MAGIC
+#define SYSFS_MAGIC 0x62656572
+#endif
+
+namespace cpu_utils {
+
+namespace {
+
+// what a sysfs attribute holds, without the trailing newline
+static bool read_value(int fd, char * buf, size_t size, std::string_view & value)
+{
+  ssize_t n = pread(fd, buf, size, 0);
+  if (n < 0) return false;
+  while (n > 0 && isspace(static_cast<unsigned char>(buf[n - 1]))) --n;
+  value = std::string_view(buf, n);
+  return true;
+}
+
+}
+
+SysfsWriter::SysfsWriter(int threads) {
+  if (threads <= 0) {
+    threads = std::clamp<int>(std::thread::hardware_concurrency(), 1, 8);
+  }
+  // the caller works too
+  for (int i = 1; i < threads; ++i) {
+    _threads.emplace_back(&SysfsWriter::run, this);
+  }
+}
+
+SysfsWriter::~SysfsWriter() {
+  {
+    std::lock_guard<std::mutex> guard(_lock);
+    _running = false;
+  }
+  _wake.notify_all();
+  for (auto & thread : _threads) {
+    thread.join();
+  }
+  reset();
+}
+
+std::vector<SysfsWriter::Failure> SysfsWriter::apply(const std::vector<std::filesystem::path> & paths, const std::string & value) {
+  TRACE_SPAN("sysfs_apply");
+  std::vector<Failure> failures;
+  std::unique_lock<std::mutex> guard(_lock);
+  _jobs.clear();
+  for (const auto & path : paths) {
+    int fd;
+    if (auto it = _fds.find(path.native()); it != _fds.end()) {
+      fd = it->second;
+    } else {
+      fd = open(path);
+      if (fd >= 0) _fds.emplace(path.native(), fd);
+    }
+    _jobs.push_back({ fd, fd < 0 ? errno : 0, false });
+  }
+  _value = value + "\n";
+  _next = 0;
+  _done = 0;
+  ++_generation;
+  guard.unlock();
+  _wake.notify_all();
+
+  work();
+
+  guard.lock();
+  _finished.wait(guard, [this] { return _done == _jobs.size(); });
+  for (size_t i = 0; i < _jobs.size(); ++i) {
+    if (_jobs[i].error) failures.push_back({ i, _jobs[i].error });
+  }
+  return failures;
+}
+
+void SysfsWriter::reset() {
+  for (const auto & [path, fd] : _fds) {
+    close(fd);
+  }
+  _fds.clear();
+}
+
+size_t SysfsWriter::written() const {
+  return std::count_if(_jobs.begin(), _jobs.end(), [](const Job & job) { return job.written; });
+}
+
+void SysfsWriter::run() {
+  uint64_t seen = 0;
+  std::unique_lock<std::mutex> guard(_lock);
+  while (true) {
+    _wake.wait(guard, [&] { return !_running || _generation != seen; });
+    if (!_running) return;
+    seen = _generation;
+    guard.unlock();
+    work();
+    guard.lock();
+  }
+}
+
+void SysfsWriter::work() {
+  std::unique_lock<std::mutex> guard(_lock);
+  while (_next < _jobs.size()) {
+    Job & job = _jobs[_next++];
+    guard.unlock();
+    write(job);
+    guard.lock();
+    if (++_done == _jobs.size()) {
+      _finished.notify_all();
+    }
+  }
+}
+
+void SysfsWriter::write(Job & job) {
+  if (job.fd < 0) return;
+  char buf[256];
+  std::string_view current;
+  std::string_view value (_value.data(), _value.size() - 1);
+  if (!read_value(job.fd, buf, sizeof(buf), current)) {
+    job.error = errno;
+    return;
+  }
+  if (current == value) return;
+
+  if (pwrite(job.fd, _value.data(), _value.size(), 0) < 0) {
+    job.error = errno;
+    return;
+  }
+  job.written = true;
+  // a regular file (a fake tree) keeps whatever was past the new value
+  struct statfs fs;
+  if (fstatfs(job.fd, &fs) == 0 && fs.f_type != SYSFS_MAGIC) {
+    [[maybe_unused]] int r = ftruncate(job.fd, _value.size());
+  }
+
+  if (!read_value(job.fd, buf, sizeof(buf), current)) {
+    job.error = errno;
+  } else if (current != value) {
+    job.error = EIO;
+  }
+}
+
+int SysfsWriter::open(const std::filesystem::path & path) {
+  return ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+}
+
+SysfsBenchResult benchSysfsWriter(const std::filesystem::path & root, int cpus, int rounds) {
+  using clock = std::chrono::steady_clock;
+  std::vector<std::filesystem::path> paths;
+  for (int i = 0; i < cpus; ++i) {
+    const auto dir = root / "devices" / "system" / "cpu" / ("cpu" + std::to_string(i)) / "cpufreq";
+    std::filesystem::create_directories(dir);
+    paths.push_back(dir / "scaling_governor");
+    std::ofstream (paths.back()) << "powersave" << std::endl;
+  }
+  const std::string values[] = { "performance", "powersave" };
+  auto us_since = [](clock::time_point start) {
+    return std::chrono::duration<double, std::micro>(clock::now() - start).count();
+  };
+
+  SysfsBenchResult result {};
+  SysfsWriter writer;
+  auto start = clock::now();
+  writer.apply(paths, values[0]);
+  result.cold_us = us_since(start);
+
+  for (int i = 1; i <= rounds; ++i) {
+    start = clock::now();
+    writer.apply(paths, values[i % 2]);
+    result.apply_us += us_since(start);
+    start = clock::now();
+    writer.apply(paths, values[i % 2]);
+    result.noop_us += us_since(start);
+  }
+  result.apply_us /= rounds;
+  result.noop_us /= rounds;
+
+  for (int i = 0; i < rounds; ++i) {
+    start = clock::now();
+    for (const auto & path : paths) {
+      std::ofstream output (path, std::ios::out | std::ios::trunc);
+      output << values[i % 2] << std::endl;
+    }
+    result.baseline_us += us_since(start);
+  }
+  result.baseline_us /= rounds;
+  return result;
+}
+
+}
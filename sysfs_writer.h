@@ -0,0 +1,96 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace cpu_utils {
+
+// Writes one value to a set of sysfs attributes, e.g. the same cpufreq
+// setting on every CPU. Files stay open between calls, attributes that
+// already hold the value are left alone, the rest are written from a small
+// pool of threads and read back to check the kernel took them.
+struct SysfsWriter {
+  struct Failure {
+    size_t index;  // into the paths passed to apply()
+    int error;     // errno, EIO if the value didn't stick
+  };
+
+  // 0 picks one thread per core, up to 8
+  explicit SysfsWriter(int threads = 0);
+
+  ~SysfsWriter();
+
+  SysfsWriter(const SysfsWriter &) = delete;
+  SysfsWriter & operator=(const SysfsWriter &) = delete;
+
+  // blocks until every path is written or has failed
+  std::vector<Failure> apply(const std::vector<std::filesystem::path> & paths, const std::string & value);
+
+  // close the cached files, e.g. after CPUs went away
+  void reset();
+
+  // files written by the last apply(), the others already held the value
+  size_t written() const;
+
+private:
+  struct Job {
+    int fd;
+    int error;
+    bool written;
+  };
+
+  void run();
+  void work();
+  void write(Job & job);
+  int open(const std::filesystem::path & path);
+
+  std::unordered_map<std::string, int> _fds;
+
+  // current apply(), shared with the workers
+  std::vector<Job> _jobs;
+  std::string _value;
+  size_t _next = 0;
+  size_t _done = 0;
+  uint64_t _generation = 0;
+  bool _running = true;
+  std::mutex _lock;
+  std::condition_variable _wake;
+  std::condition_variable _finished;
+  std::vector<std::thread> _threads;
+};
+
+// Times apply() against a fake sysfs tree of the given size, alternating
+// between two values so every CPU is written each round.
+struct SysfsBenchResult {
+  double cold_us;     // first apply, opening every file
+  double apply_us;    // mean of the rest
+  double noop_us;     // mean apply of the value already set
+  double baseline_us; // mean of an ofstream per CPU, written serially
+};
+
+SysfsBenchResult benchSysfsWriter(const std::filesystem::path & root, int cpus, int rounds);
+
+}
@@ -0,0 +1,179 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "topology.h"
+
+#include <charconv>
+#include <cstring>
+#include <fstream>
+
+// above what any kernel is built for, so a list can't ask for much
+#define MAX_CPUS 8192
+
+namespace cpu_utils {
+
+namespace {
+
+static std::string read_line(const std::filesystem::path & path)
+{
+  std::ifstream input (path);
+  std::string line;
+  std::getline(input, line);
+  return line;
+}
+
+static int read_int(const std::filesystem::path & path, int fallback)
+{
+  const std::string line = read_line(path);
+  int value;
+  auto [end, ec] = std::from_chars(line.data(), line.data() + line.size(), value);
+  return ec == std::errc() ? value : fallback;
+}
+
+static std::filesystem::path cpu_dir(const std::filesystem::path & sysfs_root, int cpu)
+{
+  return sysfs_root / "devices" / "system" / "cpu" / ("cpu" + std::to_string(cpu));
+}
+
+// the CPU number of a hotplug uevent for /devices/system/cpu/cpuN, or -1
+static int hotplug_cpu(const Uevent & event)
+{
+  if (event.action != "add" && event.action != "remove" && event.action != "online" && event.action != "offline") return -1;
+  std::string_view devpath = event.devpath;
+  if (!devpath.starts_with("/devices/system/cpu/cpu")) return -1;
+  devpath.remove_prefix(strlen("/devices/system/cpu/cpu"));
+  int cpu;
+  auto [end, ec] = std::from_chars(devpath.data(), devpath.data() + devpath.size(), cpu);
+  return ec == std::errc() && end == devpath.data() + devpath.size() ? cpu : -1;
+}
+
+}
+
+std::vector<int> parseCpuList(std::string_view list) {
+  std::vector<int> cpus;
+  while (!list.empty() && isspace(static_cast<unsigned char>(list.back()))) list.remove_suffix(1);
+  while (!list.empty()) {
+    const size_t comma = list.find(',');
+    std::string_view range = list.substr(0, comma);
+    list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+
+    int first, last;
+    const char * end = range.data() + range.size();
+    auto [dash, ec] = std::from_chars(range.data(), end, first);
+    if (ec != std::errc() || first < 0) return {};
+    last = first;
+    if (dash != end) {
+      if (*dash != '-') return {};
+      auto [stop, ec2] = std::from_chars(dash + 1, end, last);
+      if (ec2 != std::errc() || stop != end || last < first) return {};
+    }
+    if (last >= MAX_CPUS || cpus.size() + (last - first) >= MAX_CPUS) return {};
+    for (int cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+std::string formatCpuList(const std::vector<int> & cpus) {
+  std::string out;
+  for (size_t i = 0; i < cpus.size();) {
+    size_t last = i;
+    while (last + 1 < cpus.size() && cpus[last + 1] == cpus[last] + 1) ++last;
+    if (!out.empty()) out += ',';
+    out += std::to_string(cpus[i]);
+    if (last > i) out += '-' + std::to_string(cpus[last]);
+    i = last + 1;
+  }
+  return out;
+}
+
+void CpuTopology::load(const std::filesystem::path & sysfs_root) {
+  const auto cpu_path = sysfs_root / "devices" / "system" / "cpu";
+  const auto possible = parseCpuList(read_line(cpu_path / "possible"));
+  if (possible.empty()) {
+    // trees without the lists, e.g. a hand made fake one
+    cpus.clear();
+    for (int cpu = 0; std::filesystem::exists(cpu_dir(sysfs_root, cpu)); ++cpu) {
+      cpus.emplace_back();
+      refresh(sysfs_root, cpu);
+    }
+    return;
+  }
+  cpus.assign(possible.back() + 1, {});
+  for (int cpu : parseCpuList(read_line(cpu_path / "present"))) {
+    if (static_cast<size_t>(cpu) < cpus.size()) cpus[cpu].present = true;
+  }
+  for (int cpu : parseCpuList(read_line(cpu_path / "online"))) {
+    if (static_cast<size_t>(cpu) >= cpus.size()) continue;
+    Cpu & state = cpus[cpu];
+    const auto dir = cpu_dir(sysfs_root, cpu);
+    state.online = true;
+    state.package = read_int(dir / "topology" / "physical_package_id", -1);
+    state.core = read_int(dir / "topology" / "core_id", -1);
+    state.ccx = read_int(dir / "cache" / "index3" / "id", -1);
+  }
+}
+
+bool CpuTopology::refresh(const std::filesystem::path & sysfs_root, int cpu) {
+  if (cpu < 0 || static_cast<size_t>(cpu) >= cpus.size()) return false;
+  const auto dir = cpu_dir(sysfs_root, cpu);
+  Cpu state = cpus[cpu];
+  state.present = std::filesystem::exists(dir);
+  // cpu0 usually can't be offlined and has no online file
+  state.online = state.present && read_int(dir / "online", 1) == 1;
+  if (state.online) {
+    state.package = read_int(dir / "topology" / "physical_package_id", -1);
+    state.core = read_int(dir / "topology" / "core_id", -1);
+    state.ccx = read_int(dir / "cache" / "index3" / "id", -1);
+  }
+  const bool changed = state.present != cpus[cpu].present || state.online != cpus[cpu].online ||
+                       state.package != cpus[cpu].package || state.core != cpus[cpu].core || state.ccx != cpus[cpu].ccx;
+  cpus[cpu] = state;
+  return changed;
+}
+
+size_t CpuTopology::size() const {
+  return cpus.size();
+}
+
+std::vector<int> CpuTopology::siblings(int cpu) const {
+  std::vector<int> result;
+  if (cpu < 0 || static_cast<size_t>(cpu) >= cpus.size()) return result;
+  const Cpu & self = cpus[cpu];
+  if (self.core < 0) return { cpu };
+  for (size_t i = 0; i < cpus.size(); ++i) {
+    if (cpus[i].core == self.core && cpus[i].package == self.package) {
+      result.push_back(i);
+    }
+  }
+  return result;
+}
+
+bool HotplugMonitor::start(std::function<void(int)> listener) {
+  return _monitor.start("cpu", [listener = std::move(listener)](const Uevent & event) {
+    int cpu = hotplug_cpu(event);
+    if (cpu >= 0) listener(cpu);
+  });
+}
+
+void HotplugMonitor::stop() {
+  _monitor.stop();
+}
+
+}
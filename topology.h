@@ -0,0 +1,71 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "uevent.h"
+
+namespace cpu_utils {
+
+// "0-3,8,10-11" as the kernel writes cpu lists, empty on garbage and on
+// CPUs past any kernel's limit
+std::vector<int> parseCpuList(std::string_view list);
+// the other way, ranges of sorted runs
+std::string formatCpuList(const std::vector<int> & cpus);
+
+// Every possible logical CPU, indexed by CPU number. Built once from the
+// possible/present/online lists, then kept current one CPU at a time.
+struct CpuTopology {
+  struct Cpu {
+    bool present = false;
+    bool online = false;
+    // -1 until the CPU has been online, the kernel hides them otherwise
+    int package = -1;
+    int core = -1;
+    int ccx = -1;     // L3 cache id, one per CCX on Zen
+  };
+
+  void load(const std::filesystem::path & sysfs_root);
+  // re-read one CPU after a hotplug event, returns true if anything changed
+  bool refresh(const std::filesystem::path & sysfs_root, int cpu);
+
+  size_t size() const;
+  // logical CPUs sharing a core with cpu, cpu included
+  std::vector<int> siblings(int cpu) const;
+
+  std::vector<Cpu> cpus;
+};
+
+// Listens for cpu add/remove/online/offline uevents from the kernel.
+struct HotplugMonitor {
+  // listener gets the CPU number, on the monitor's thread. Returns false if
+  // the uevent socket can't be opened.
+  bool start(std::function<void(int)> listener);
+  void stop();
+
+private:
+  UeventMonitor _monitor;
+};
+
+}
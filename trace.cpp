@@ -0,0 +1,191 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "trace.h"
+#include "clock.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace cpu_utils {
+
+namespace trace {
+
+namespace {
+
+// Written only by its thread. Readers copy a range and then drop whatever
+// the writer lapped in the meantime, every field is a relaxed atomic so
+// the racing copy is well defined.
+struct Ring {
+  struct Slot {
+    std::atomic<const char *> name { nullptr };
+    std::atomic<uint64_t> start { 0 };
+    std::atomic<uint64_t> end { 0 };
+  };
+
+  int tid;
+  std::atomic<const char *> thread_name { nullptr };
+  std::atomic<uint64_t> head { 0 };
+  Slot slots[RING_SIZE];
+};
+
+struct Event {
+  const char * name;
+  uint64_t start;
+  uint64_t end;
+};
+
+struct Registry {
+  std::mutex lock;
+  // never freed, a thread that exited still shows up in dumps
+  std::vector<std::unique_ptr<Ring>> rings;
+};
+
+static Registry & registry()
+{
+  static Registry registry;
+  return registry;
+}
+
+// a ring is only allocated once its thread records a span
+thread_local Ring * local = nullptr;
+thread_local const char * local_name = nullptr;
+
+static Ring & local_ring()
+{
+  if (!local) {
+    auto owned = std::make_unique<Ring>();
+    owned->tid = static_cast<int>(syscall(SYS_gettid));
+    owned->thread_name.store(local_name, std::memory_order_relaxed);
+    local = owned.get();
+    Registry & reg = registry();
+    std::lock_guard<std::mutex> guard(reg.lock);
+    reg.rings.push_back(std::move(owned));
+  }
+  return *local;
+}
+
+static void copy_ring(const Ring & ring, std::vector<Event> & out)
+{
+  const uint64_t head = ring.head.load(std::memory_order_acquire);
+  const uint64_t from = head > RING_SIZE ? head - RING_SIZE : 0;
+  const size_t first = out.size();
+  for (uint64_t i = from; i < head; ++i) {
+    const Ring::Slot & slot = ring.slots[i % RING_SIZE];
+    out.push_back({ slot.name.load(std::memory_order_relaxed), slot.start.load(std::memory_order_relaxed),
+                    slot.end.load(std::memory_order_relaxed) });
+  }
+  std::atomic_thread_fence(std::memory_order_acquire);
+  const uint64_t after = ring.head.load(std::memory_order_relaxed);
+  // slots the writer got to while we were copying, and the one it may be
+  // in the middle of, which isn't published yet
+  const uint64_t lapped = after + 1 > RING_SIZE ? after + 1 - RING_SIZE : 0;
+  if (lapped > from) {
+    const size_t drop = std::min<uint64_t>(lapped - from, head - from);
+    out.erase(out.begin() + first, out.begin() + first + drop);
+  }
+}
+
+}
+
+std::atomic<bool> active { false };
+
+void setEnabled(bool enabled) {
+  active.store(enabled, std::memory_order_relaxed);
+}
+
+uint64_t now() {
+  return monotonicNs();
+}
+
+void record(const char * name, uint64_t start_ns, uint64_t end_ns) {
+  Ring & ring = local_ring();
+  const uint64_t head = ring.head.load(std::memory_order_relaxed);
+  Ring::Slot & slot = ring.slots[head % RING_SIZE];
+  // a reader that sees any of the stores below also sees head, so it
+  // knows the slot is being written
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.name.store(name, std::memory_order_relaxed);
+  slot.start.store(start_ns, std::memory_order_relaxed);
+  slot.end.store(end_ns, std::memory_order_relaxed);
+  ring.head.store(head + 1, std::memory_order_release);
+}
+
+void setThreadName(const char * name) {
+  local_name = name;
+  if (local) local->thread_name.store(name, std::memory_order_relaxed);
+}
+
+std::vector<SpanStats> stats(uint64_t window_ns) {
+  std::vector<Event> events;
+  {
+    Registry & reg = registry();
+    std::lock_guard<std::mutex> guard(reg.lock);
+    for (const auto & ring : reg.rings) copy_ring(*ring, events);
+  }
+  const uint64_t since = now() - window_ns;
+  // the same literal may have a different address in each translation unit
+  std::map<std::string, std::vector<uint64_t>> durations;
+  for (const Event & event : events) {
+    if (event.end >= since) durations[event.name].push_back(event.end - event.start);
+  }
+  std::vector<SpanStats> result;
+  for (auto & [name, ns] : durations) {
+    std::sort(ns.begin(), ns.end());
+    auto at = [&](double q) { return ns[std::min(ns.size() - 1, static_cast<size_t>(q * ns.size()))] * 1e-3; };
+    result.push_back({ name, ns.size(), at(0.5), at(0.99), ns.back() * 1e-3 });
+  }
+  return result;
+}
+
+bool dump(const std::string & path) {
+  FILE * out = fopen(path.c_str(), "w");
+  if (!out) return false;
+  const int pid = getpid();
+  fprintf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+  bool first = true;
+  Registry & reg = registry();
+  std::lock_guard<std::mutex> guard(reg.lock);
+  std::vector<Event> events;
+  for (const auto & ring : reg.rings) {
+    if (const char * name = ring->thread_name.load(std::memory_order_relaxed)) {
+      fprintf(out, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+              first ? "" : ",", pid, ring->tid, name);
+      first = false;
+    }
+    events.clear();
+    copy_ring(*ring, events);
+    for (const Event & event : events) {
+      fprintf(out, "%s\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": %d, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+              first ? "" : ",", event.name, pid, ring->tid, event.start * 1e-3, (event.end - event.start) * 1e-3);
+      first = false;
+    }
+  }
+  fprintf(out, "\n]}\n");
+  return fclose(out) == 0;
+}
+
+}
+
+}
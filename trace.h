@@ -0,0 +1,102 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace cpu_utils {
+
+// Scoped spans recorded into a ring per thread, for finding where a stall
+// went. TRACE_SPAN("name") times the rest of the enclosing scope while
+// tracing is enabled; disabled it costs a relaxed load, and building with
+// SIMPLETDP_NO_TRACE (make TRACE=0) compiles it away. Names must be string
+// literals.
+namespace trace {
+
+// spans kept per thread, the oldest are overwritten
+constexpr size_t RING_SIZE = 8192;
+
+extern std::atomic<bool> active;
+
+inline bool enabled() {
+  return active.load(std::memory_order_relaxed);
+}
+
+void setEnabled(bool enabled);
+// CLOCK_MONOTONIC, the same clock on every thread
+uint64_t now();
+void record(const char * name, uint64_t start_ns, uint64_t end_ns);
+// shows up in dumps instead of the thread id
+void setThreadName(const char * name);
+
+// times its scope, or up to end()
+#ifdef SIMPLETDP_NO_TRACE
+struct Span {
+  explicit Span(const char *) {}
+  void end() {}
+};
+#else
+struct Span {
+  explicit Span(const char * name) : _name(name), _start(enabled() ? now() : 0) {}
+
+  ~Span() {
+    end();
+  }
+
+  void end() {
+    if (_start) record(_name, _start, now());
+    _start = 0;
+  }
+
+  Span(const Span &) = delete;
+  Span & operator=(const Span &) = delete;
+
+private:
+  const char * _name;
+  uint64_t _start;
+};
+#endif
+
+struct SpanStats {
+  std::string name;
+  size_t count;
+  double p50_us;
+  double p99_us;
+  double max_us;
+};
+
+// per span name over the spans that ended in the last window_ns, by name
+std::vector<SpanStats> stats(uint64_t window_ns);
+
+// every span still in the rings as Chrome trace event JSON, which Perfetto
+// and chrome://tracing open. False if the file can't be written.
+bool dump(const std::string & path);
+
+}
+
+}
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#define TRACE_SPAN(name) cpu_utils::trace::Span TRACE_CONCAT(trace_span_, __LINE__) (name)
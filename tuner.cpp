@@ -0,0 +1,317 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "tuner.h"
+
+#include <chrono>
+#include <cmath>
+#include <fstream>
+
+#include <pthread.h>
+#include <sched.h>
+
+#define TUNE_DIR "/var/lib/simpletdp"
+// per call of the kernel, a few hundred microseconds
+#define KERNEL_ROUNDS 4096
+// 8 accumulators of 8 lanes, a multiply and an add each
+#define KERNEL_FLOPS (8 * 8 * 2)
+
+namespace cpu_utils {
+
+namespace {
+
+typedef float v8f __attribute__((vector_size(32)));
+
+// Multiply-adds on independent registers, nothing touches memory. The
+// accumulators decay towards a fixed point so they stay finite.
+#if defined(__x86_64__)
+__attribute__((target_clones("fma", "default")))
+#endif
+static float kernel(float seed, int rounds)
+{
+  v8f acc[8];
+  for (int i = 0; i < 8; ++i) {
+    acc[i] = v8f{} + (seed + i);
+  }
+  const v8f m = v8f{} + 0.999f;
+  const v8f c = v8f{} + 0.001f;
+  for (int r = 0; r < rounds; ++r) {
+    for (int i = 0; i < 8; ++i) {
+      acc[i] = acc[i] * m + c;
+    }
+  }
+  v8f sum = acc[0];
+  for (int i = 1; i < 8; ++i) {
+    sum += acc[i];
+  }
+  float total = 0;
+  for (int lane = 0; lane < 8; ++lane) {
+    total += sum[lane];
+  }
+  return total;
+}
+
+// Made up, shaped like the real thing: clocks, and with them throughput,
+// grow with about the square root of the power above the idle floor.
+static double simulated_throughput(double power_w)
+{
+  return power_w > 3 ? 20 * std::sqrt(power_w - 3) : 0;
+}
+
+static std::string read_line(const std::filesystem::path & path)
+{
+  std::ifstream input (path);
+  std::string line;
+  std::getline(input, line);
+  return line;
+}
+
+static void mean_sd(double sum, double squares, int n, double & mean, double & sd)
+{
+  mean = sum / n;
+  sd = n > 1 ? std::sqrt(std::max(0.0, (squares - n * mean * mean) / (n - 1))) : 0;
+}
+
+// Puts back the limits found when it was made, however the sweep ends, so
+// a running daemon's LimitCache is right again.
+struct LimitsGuard {
+  LimitsGuard(RyzenState & rs) : _rs(rs) {
+    _rs.tick(LimitCache::METRICS);
+    _limits = _rs.limits();
+  }
+
+  ~LimitsGuard() {
+    if (_limits[LimitCache::STAPM]) _rs.setLimits(_limits, true);
+  }
+
+  RyzenState & _rs;
+  LimitCache::Limits _limits;
+};
+
+}
+
+KernelLoad::KernelLoad(const CPUState & cs) {
+  for (size_t i = 0; i < cs.cpus.size(); ++i) {
+    if (std::get<1>(cs.cpus[i])) _cpus.push_back(i);
+  }
+  _counters = std::make_unique<Counter[]>(_cpus.size());
+}
+
+KernelLoad::~KernelLoad() {
+  stop();
+}
+
+void KernelLoad::start() {
+  if (_running.exchange(true)) return;
+  for (size_t i = 0; i < _cpus.size(); ++i) {
+    _counters[i].rounds.store(0, std::memory_order_relaxed);
+    _threads.emplace_back(&KernelLoad::run, this, i, _cpus[i]);
+  }
+}
+
+void KernelLoad::stop() {
+  _running = false;
+  for (auto & thread : _threads) {
+    thread.join();
+  }
+  _threads.clear();
+}
+
+double KernelLoad::work() const {
+  uint64_t rounds = 0;
+  for (size_t i = 0; i < _cpus.size(); ++i) {
+    rounds += _counters[i].rounds.load(std::memory_order_relaxed);
+  }
+  return rounds * static_cast<double>(KERNEL_FLOPS) * 1e-9;
+}
+
+const char * KernelLoad::unit() const {
+  return "GFLOP/s";
+}
+
+double KernelLoad::wait(double dt) {
+  using clock = std::chrono::steady_clock;
+  const auto start = clock::now();
+  std::this_thread::sleep_for(std::chrono::duration<double>(dt));
+  return std::chrono::duration<double>(clock::now() - start).count();
+}
+
+void KernelLoad::run(size_t index, int cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  float sink = 1;
+  while (_running.load(std::memory_order_relaxed)) {
+    sink = kernel(sink * 1e-6f + 1, KERNEL_ROUNDS);
+    _counters[index].rounds.fetch_add(KERNEL_ROUNDS, std::memory_order_relaxed);
+  }
+  // so the kernel can't be left out
+  _counters[index].sink = sink;
+}
+
+SimulatedLoad::SimulatedLoad(const RyzenState & rs) : _rs(rs) {}
+
+void SimulatedLoad::start() {
+  _work = 0;
+}
+
+void SimulatedLoad::stop() {}
+
+double SimulatedLoad::work() const {
+  return _work;
+}
+
+const char * SimulatedLoad::unit() const {
+  return "sim ops/s";
+}
+
+double SimulatedLoad::wait(double dt) {
+  // the backend steps its own clock on every read
+  _work += simulated_throughput(_rs.stapm_fast_value) * dt;
+  return dt;
+}
+
+double TunePoint::perfPerWatt() const {
+  return power_w > 0 ? throughput / power_w : 0;
+}
+
+TuneResult runTdpSweep(RyzenState & rs, TuneLoad & load, const TuneSettings & settings,
+                       const std::function<void(const TunePoint &)> & progress) {
+  constexpr MetricMask metrics = metricBit(CH_STAPM_FAST_VALUE) | metricBit(CH_STAPM_SLOW_VALUE) |
+                                 metricBit(CH_CORE_TEMP_VALUE) | metricBit(CH_APU_SKIN_TEMP_VALUE);
+  TuneResult result;
+  result.unit = load.unit();
+  LimitsGuard guard (rs);
+  load.start();
+  for (int tdp = settings.min_tdp; tdp <= settings.max_tdp; tdp += settings.step) {
+    if (!rs.setTdp(tdp, true)) {
+      load.stop();
+      throw "The SMU refused a TDP limit";
+    }
+    TunePoint point {};
+    point.tdp = tdp;
+    // the slow average catching up with the fast one means the power
+    // stopped moving
+    double waited = 0;
+    while (waited < settings.settle_s) {
+      waited += load.wait(settings.tick_s);
+      rs.tick(metrics);
+      if (waited >= 2 && std::fabs(rs.stapm_slow_value - rs.stapm_fast_value) <= settings.settle_w) break;
+    }
+    point.settle_s = waited;
+
+    double power = 0, power_sq = 0, throughput = 0, throughput_sq = 0;
+    double core = 0, skin = 0;
+    int samples = 0;
+    for (int w = 0; w < settings.windows; ++w) {
+      const double start = load.work();
+      double elapsed = 0, window_power = 0;
+      int window_samples = 0;
+      while (elapsed < settings.measure_s) {
+        elapsed += load.wait(settings.tick_s);
+        rs.tick(metrics);
+        window_power += rs.stapm_fast_value;
+        core += rs.core_temp_value;
+        skin += rs.apu_skin_temp_value;
+        ++window_samples;
+      }
+      samples += window_samples;
+      const double p = window_power / window_samples;
+      const double t = (load.work() - start) / elapsed;
+      power += p;
+      power_sq += p * p;
+      throughput += t;
+      throughput_sq += t * t;
+    }
+    mean_sd(power, power_sq, settings.windows, point.power_w, point.power_sd);
+    mean_sd(throughput, throughput_sq, settings.windows, point.throughput, point.throughput_sd);
+    point.core_temp = core / samples;
+    point.skin_temp = skin / samples;
+    result.points.push_back(point);
+    if (progress) progress(point);
+  }
+  load.stop();
+
+  const auto & points = result.points;
+  if (points.empty()) return result;
+  double best = -1;
+  for (const auto & point : points) {
+    if (point.perfPerWatt() > best) {
+      best = point.perfPerWatt();
+      result.best_tdp = point.tdp;
+    }
+  }
+  // against power where it moved, against the TDP where the firmware
+  // held it flat
+  const bool by_power = points.back().power_w - points.front().power_w > settings.settle_w;
+  auto x = [&](const TunePoint & p) { return by_power ? p.power_w : p.tdp; };
+  const double x0 = x(points.front()), x1 = x(points.back());
+  const double y0 = points.front().throughput, y1 = points.back().throughput;
+  result.knee_tdp = points.back().tdp;
+  if (points.size() >= 3 && x1 > x0 && y1 > y0) {
+    double most = 0;
+    for (const auto & point : points) {
+      const double above = (point.throughput - y0) / (y1 - y0) - (x(point) - x0) / (x1 - x0);
+      if (above > most) {
+        most = above;
+        result.knee_tdp = point.tdp;
+      }
+    }
+  }
+  return result;
+}
+
+std::string deviceName(const std::filesystem::path & sysfs_root, int family) {
+  if (family == FAM_SIMULATED) return "simulated";
+  const auto dmi = sysfs_root / "class" / "dmi" / "id";
+  std::string name = read_line(dmi / "sys_vendor") + " " + read_line(dmi / "product_name");
+  if (name == " ") name = familyName(family);
+  return name;
+}
+
+std::filesystem::path devicePath(const char * kind, const std::string & device) {
+  std::string file = std::string(kind) + "-";
+  for (char c : device) {
+    file += isalnum(static_cast<unsigned char>(c)) ? c : '-';
+  }
+  return std::filesystem::path(TUNE_DIR) / (file + ".txt");
+}
+
+std::filesystem::path tunePath(const std::string & device) {
+  return devicePath("tune", device);
+}
+
+void saveTuneResult(const std::filesystem::path & path, const std::string & device, const TuneResult & result) {
+  std::error_code ec;
+  if (path.has_parent_path()) std::filesystem::create_directories(path.parent_path(), ec);
+  std::ofstream out (path);
+  out << "# " << device << '\n'
+      << "# tdp settle_s power_w power_sd throughput throughput_sd core_c skin_c, throughput in " << result.unit << '\n';
+  for (const auto & p : result.points) {
+    out << p.tdp << ' ' << p.settle_s << ' ' << p.power_w << ' ' << p.power_sd << ' ' << p.throughput << ' '
+        << p.throughput_sd << ' ' << p.core_temp << ' ' << p.skin_temp << '\n';
+  }
+  out << "knee " << result.knee_tdp << '\n'
+      << "best " << result.best_tdp << '\n';
+  if (!out) {
+    throw "Unable to write the tune file";
+  }
+}
+
+}
@@ -0,0 +1,136 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cpu_utils.h"
+
+namespace cpu_utils {
+
+// What a TDP sweep keeps the APU busy with. work() counts what got done
+// since start(), in unit().
+struct TuneLoad {
+  virtual ~TuneLoad() = default;
+
+  virtual void start() = 0;
+  virtual void stop() = 0;
+  virtual double work() const = 0;
+  virtual const char * unit() const = 0;
+  // lets about dt seconds of load pass, returns how many did
+  virtual double wait(double dt) = 0;
+};
+
+// The built-in FMA kernel on a thread per online CPU, each pinned to its
+// CPU. Fused multiply-adds where the CPU has FMA, SSE otherwise.
+struct KernelLoad : TuneLoad {
+  KernelLoad(const CPUState & cs);
+
+  ~KernelLoad();
+
+  void start() override;
+  void stop() override;
+  double work() const override;
+  const char * unit() const override;
+  double wait(double dt) override;
+
+private:
+  // a cache line each, the threads never share one
+  struct alignas(64) Counter {
+    std::atomic<uint64_t> rounds { 0 };
+    float sink = 0;
+  };
+
+  void run(size_t index, int cpu);
+
+  std::vector<int> _cpus;
+  std::unique_ptr<Counter[]> _counters;
+  std::atomic<bool> _running { false };
+  std::vector<std::thread> _threads;
+};
+
+// Throughput modelled from the package power of a SimulatedBackend, which
+// has to step on its own clock (Config::step_s) so a sweep runs in
+// simulated time.
+struct SimulatedLoad : TuneLoad {
+  SimulatedLoad(const RyzenState & rs);
+
+  void start() override;
+  void stop() override;
+  double work() const override;
+  const char * unit() const override;
+  double wait(double dt) override;
+
+private:
+  const RyzenState & _rs;
+  double _work = 0;
+};
+
+struct TuneSettings {
+  int min_tdp = 4;
+  int max_tdp = 30;
+  int step = 2;
+  double tick_s = 0.1;      // telemetry interval
+  double settle_s = 30;     // longest wait for PPT to settle at a step
+  double settle_w = 0.3;    // settled once the slow PPT is this close to the fast one
+  double measure_s = 5;     // per window
+  int windows = 3;          // measured back to back, for the variance
+};
+
+struct TunePoint {
+  int tdp;
+  double settle_s;
+  double power_w, power_sd;   // fast PPT
+  double throughput, throughput_sd;
+  double core_temp, skin_temp;
+
+  double perfPerWatt() const;
+};
+
+struct TuneResult {
+  std::vector<TunePoint> points;
+  const char * unit;
+  // where throughput against power bends over, the most above the line
+  // between the first and last point (Kneedle)
+  int knee_tdp = -1;
+  int best_tdp = -1;  // highest throughput per watt
+};
+
+// Steps through the TDPs from min_tdp up, waits for PPT to settle at each,
+// then measures the load. progress gets each point as it is done. The
+// limits from before are put back however it ends.
+TuneResult runTdpSweep(RyzenState & rs, TuneLoad & load, const TuneSettings & settings,
+                       const std::function<void(const TunePoint &)> & progress = {});
+
+// what the result is filed under, from DMI, "simulated" for the simulator
+std::string deviceName(const std::filesystem::path & sysfs_root, int family);
+// /var/lib/simpletdp/<kind>-<device>.txt
+std::filesystem::path devicePath(const char * kind, const std::string & device);
+// the "tune" one
+std::filesystem::path tunePath(const std::string & device);
+// one point per line and the knee, throws if the file can't be written
+void saveTuneResult(const std::filesystem::path & path, const std::string & device, const TuneResult & result);
+
+}
@@ -0,0 +1,112 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "uevent.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <linux/netlink.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace cpu_utils {
+
+namespace {
+
+// splits a message into its fields, false for udev's own format
+static bool parse_uevent(const char * buf, size_t size, Uevent & event)
+{
+  event = {};
+  event.buf = buf;
+  event.size = size;
+  // "ACTION@DEVPATH" first, udev's start with "libudev"
+  if (size == 0 || !memchr(buf, '@', strnlen(buf, size))) return false;
+  event.action = event.get("ACTION");
+  event.subsystem = event.get("SUBSYSTEM");
+  event.devpath = event.get("DEVPATH");
+  return true;
+}
+
+}
+
+std::string_view Uevent::get(std::string_view key) const {
+  for (const char * p = buf; p < buf + size; p += strlen(p) + 1) {
+    std::string_view field (p, strnlen(p, buf + size - p));
+    if (field.size() > key.size() && field[key.size()] == '=' && field.starts_with(key)) {
+      return field.substr(key.size() + 1);
+    }
+  }
+  return {};
+}
+
+UeventMonitor::~UeventMonitor() {
+  stop();
+}
+
+bool UeventMonitor::start(const std::string & subsystem, std::function<void(const Uevent &)> listener) {
+  if (_thread.joinable()) return true;
+  _socket = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+  if (_socket < 0) return false;
+  sockaddr_nl addr {};
+  addr.nl_family = AF_NETLINK;
+  // group 1 is the kernel's own events, udev rebroadcasts on 2
+  addr.nl_groups = 1;
+  if (bind(_socket, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+    close(_socket);
+    _socket = -1;
+    return false;
+  }
+  _stop = eventfd(0, EFD_CLOEXEC);
+  _subsystem = subsystem;
+  _listener = std::move(listener);
+  _thread = std::thread(&UeventMonitor::run, this);
+  return true;
+}
+
+void UeventMonitor::stop() {
+  if (_thread.joinable()) {
+    uint64_t one = 1;
+    [[maybe_unused]] auto n = write(_stop, &one, sizeof(one));
+    _thread.join();
+  }
+  if (_socket >= 0) close(_socket);
+  if (_stop >= 0) close(_stop);
+  _socket = -1;
+  _stop = -1;
+}
+
+void UeventMonitor::run() {
+  char buf[8192];
+  pollfd fds[] = { { _socket, POLLIN, 0 }, { _stop, POLLIN, 0 } };
+  while (true) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) continue;
+      return;
+    }
+    if (fds[1].revents) return;
+    ssize_t n = recv(_socket, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n <= 0) continue;
+    Uevent event;
+    if (parse_uevent(buf, n, event) && event.subsystem == _subsystem) _listener(event);
+  }
+}
+
+}
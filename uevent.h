@@ -0,0 +1,62 @@
+/*
+* SimpleTDP
+* Copyright (C) 2024 Z-Shang
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <thread>
+
+namespace cpu_utils {
+
+// One kernel uevent, the KEY=value fields of a netlink message. Only valid
+// inside the listener.
+struct Uevent {
+  // the value of key, empty if missing
+  std::string_view get(std::string_view key) const;
+
+  std::string_view action;
+  std::string_view subsystem;
+  std::string_view devpath;
+  const char * buf;
+  size_t size;
+};
+
+// Listens for the kernel's uevents of one subsystem.
+struct UeventMonitor {
+  UeventMonitor() = default;
+
+  ~UeventMonitor();
+
+  // listener runs on the monitor's thread. Returns false if the uevent
+  // socket can't be opened.
+  bool start(const std::string & subsystem, std::function<void(const Uevent &)> listener);
+  void stop();
+
+private:
+  void run();
+
+  std::string _subsystem;
+  std::function<void(const Uevent &)> _listener;
+  int _socket = -1;
+  int _stop = -1;
+  std::thread _thread;
+};
+
+}